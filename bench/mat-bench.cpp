@@ -0,0 +1,505 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mat.h"
+#include "mat_batch.h"
+#include "mat_cholesky.h"
+#include "mat_eval.h"
+#include "mat_io.h"
+#include "mat_kernels.h"
+#include "mat_lu.h"
+#include "mat_parallel.h"
+#include "mat_sparse.h"
+
+/**
+* Micro-benchmarks for every Matrix operator over square sizes 2, 4, ..., max-size
+* (4096 by default). The families below run at fixed orders instead, all of
+* them by default; an explicit max-size skips those above it too.
+*
+* Each case is run with a doubling iteration count until one batch takes at
+* least min-time seconds, in the manner of Google Benchmark, and reports the
+* time per operation, the FLOP rate and the memory traffic rate. The byte
+* count is the minimum traffic: every operand read once and the result
+* written once.
+*
+* The batch cases time 2 x 2 to 4 x 4 products, inverses, determinants and
+* transposes over a MatrixBatch (batch-*) against the same work done by a
+* loop over individual Matrix objects (loop-*); their times are per matrix.
+*
+* The sparse cases (spmv/n, spmm/n) multiply an n x n CsrMatrix with
+* sparse_per_row random entries per row by a vector and by an n x 16 Matrix.
+*
+* The file cases (binary-save/n, binary-load/n, binary-map/n) write, read and
+* map an n x n matrix file in the working directory; their byte rate is the
+* file size over the time, with the checksum always verified.
+*
+* The text cases write and parse an n x n matrix as CSV in memory with
+* write_text and read_text (text-write/n, text-read/n), against operator<<
+* and operator>> on the same data (text-ostream/n, text-istream/n); their
+* byte rate is the length of the text over the time.
+*
+* Usage: mat-bench [--filter=substr] [--min-time=seconds] [--max-size=n] [--json=file]
+*/
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    /**
+    * Largest order of the sweep over 2, 4, ... when --max-size is not given.
+    */
+    constexpr size_t default_max_size = 4096;
+
+    struct Options {
+        std::string filter;
+        double min_time = 0.1;
+        size_t max_size = 0; //< Largest order of any case; 0 when --max-size is not given
+        std::string json;
+
+        bool fits(size_t n) const { return max_size == 0 || n <= max_size; }
+    };
+
+    /**
+    * Keeps the optimizer from discarding a result that is otherwise unused.
+    */
+    volatile double sink;
+
+    void keep(const Matrix& m) { sink = m(0, 0); }
+    void keep(double v) { sink = v; }
+
+    struct Case {
+        const char* name;
+        size_t max_size; //< Larger sizes are skipped; 0 means no limit besides --max-size
+        std::function<double(double n)> flops; //< Floating-point operations per call
+        std::function<double(double n)> bytes; //< Minimum bytes moved per call
+        std::function<void(const Matrix& a, const Matrix& b)> run;
+        bool same_operands = false; //< Pass two equal matrices, so comparisons scan everything
+    };
+
+    std::vector<Case> make_cases() {
+        const auto none = [](double) { return 0.0; };
+        return {
+            {"add", 0, [](double n) { return n * n; }, [](double n) { return 24 * n * n; },
+             [](const Matrix& a, const Matrix& b) { keep(Matrix(a + b)); }},
+            {"sub", 0, [](double n) { return n * n; }, [](double n) { return 24 * n * n; },
+             [](const Matrix& a, const Matrix& b) { keep(Matrix(a - b)); }},
+            {"scale", 0, [](double n) { return n * n; }, [](double n) { return 16 * n * n; },
+             [](const Matrix& a, const Matrix&) { keep(Matrix(a * 1.5)); }},
+            {"gemm", 0, [](double n) { return 2 * n * n * n; }, [](double n) { return 24 * n * n; },
+             [](const Matrix& a, const Matrix& b) { keep(a * b); }},
+            {"transpose", 0, none, [](double n) { return 16 * n * n; },
+             [](const Matrix& a, const Matrix&) { keep(!a); }},
+            {"determinant", 0, [](double n) { return 2.0 / 3.0 * n * n * n; }, [](double n) { return 16 * n * n; },
+             [](const Matrix& a, const Matrix&) { keep(*a); }},
+            {"inverse", 0, [](double n) { return 2 * n * n * n; }, [](double n) { return 16 * n * n; },
+             [](const Matrix& a, const Matrix&) { keep(~a); }},
+            // n right-hand sides: factor once, then substitute; compare with inverse followed by gemm.
+            {"solve", 0, [](double n) { return 8.0 / 3.0 * n * n * n; }, [](double n) { return 24 * n * n; },
+             [](const Matrix& a, const Matrix& b) { keep(solve(a, b)); }},
+            // Reads the lower triangle as a symmetric matrix, which make_operand keeps positive definite.
+            {"cholesky", 0, [](double n) { return n * n * n / 3.0; }, [](double n) { return 16 * n * n; },
+             [](const Matrix& a, const Matrix&) { keep(Cholesky(a).factor()); }},
+            // n^2 cofactor determinants of order n - 1 each.
+            {"adjoint", 64, [](double n) { return n * n * 2.0 / 3.0 * (n - 1) * (n - 1) * (n - 1); },
+             [](double n) { return 16 * n * n; },
+             [](const Matrix& a, const Matrix&) { keep(a.adjoint()); }},
+            {"equal", 0, none, [](double n) { return 16 * n * n; },
+             [](const Matrix& a, const Matrix& b) { sink = (a == b) ? 1.0 : 0.0; }, true},
+        };
+    }
+
+    /**
+    * A diagonally dominant matrix, so determinant and inverse stay well conditioned.
+    */
+    Matrix make_operand(size_t n, unsigned seed) {
+        Matrix m(n, n);
+        unsigned state = seed;
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                state = state * 1664525u + 1013904223u;
+                m(i, j) = static_cast<double>(state >> 8) / static_cast<double>(1u << 24) - 0.5;
+            }
+            m(i, i) += static_cast<double>(n);
+        }
+        return m;
+    }
+
+    struct Result {
+        std::string name;
+        size_t size;
+        size_t iterations;
+        double ns_per_op;
+        double gflops;
+        double bytes_per_second;
+    };
+
+    /**
+    * Times run() and reports per-op figures, where one call performs ops operations.
+    */
+    Result measure(const std::string& name, size_t n, double flops, double bytes, size_t ops,
+                   const std::function<void()>& run, double min_time) {
+        run(); // warm up caches, the thread pool and the kernel dispatch
+        size_t iterations = 1;
+        double seconds = 0;
+        for (;;) {
+            auto start = Clock::now();
+            for (size_t i = 0; i < iterations; ++i) {
+                run();
+            }
+            seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            if (seconds >= min_time) {
+                break;
+            }
+            // Jump close to the target once the batch is long enough to trust.
+            const double grow = seconds > min_time / 10 ? 1.4 * min_time / seconds : 10.0;
+            iterations = std::max(iterations + 1, static_cast<size_t>(iterations * grow));
+        }
+        const double per_op = seconds / static_cast<double>(iterations) / static_cast<double>(ops);
+        return {name, n, iterations, per_op * 1e9, flops / per_op * 1e-9, bytes / per_op};
+    }
+
+    /**
+    * Matrices per batch in the batch cases: large enough to amortize the
+    * call, small enough to stay in L2 at order 4.
+    */
+    constexpr size_t batch_count = 4096;
+
+    struct BatchCase {
+        const char* name;
+        std::function<double(double n)> flops; //< Per matrix
+        std::function<double(double n)> bytes; //< Per matrix
+        std::function<void(const MatrixBatch& a, const MatrixBatch& b)> batched;
+        std::function<void(const std::vector<Matrix>& a, const std::vector<Matrix>& b)> loop;
+    };
+
+    std::vector<BatchCase> make_batch_cases() {
+        return {
+            {"gemm", [](double n) { return 2 * n * n * n; }, [](double n) { return 24 * n * n; },
+             [](const MatrixBatch& a, const MatrixBatch& b) { sink = (a * b)(0, 0, 0); },
+             [](const std::vector<Matrix>& a, const std::vector<Matrix>& b) {
+                 for (size_t i = 0; i < a.size(); ++i) keep(a[i] * b[i]);
+             }},
+            {"inverse", [](double n) { return 2 * n * n * n; }, [](double n) { return 16 * n * n; },
+             [](const MatrixBatch& a, const MatrixBatch&) { sink = (~a)(0, 0, 0); },
+             [](const std::vector<Matrix>& a, const std::vector<Matrix>&) {
+                 for (const Matrix& m : a) keep(~m);
+             }},
+            {"determinant", [](double n) { return 2.0 / 3.0 * n * n * n; }, [](double n) { return 8 * n * n + 8; },
+             [](const MatrixBatch& a, const MatrixBatch&) { sink = (*a)[0]; },
+             [](const std::vector<Matrix>& a, const std::vector<Matrix>&) {
+                 for (const Matrix& m : a) keep(*m);
+             }},
+            {"transpose", [](double) { return 0.0; }, [](double n) { return 16 * n * n; },
+             [](const MatrixBatch& a, const MatrixBatch&) { sink = (!a)(0, 0, 0); },
+             [](const std::vector<Matrix>& a, const std::vector<Matrix>&) {
+                 for (const Matrix& m : a) keep(!m);
+             }},
+        };
+    }
+
+    /**
+    * Entries per row of the sparse cases, about the average degree of a road or web graph.
+    */
+    constexpr size_t sparse_per_row = 8;
+
+    CsrMatrix make_sparse(size_t n) {
+        std::vector<Triplet> entries;
+        entries.reserve(n * sparse_per_row);
+        unsigned long long state = 42;
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t k = 0; k < sparse_per_row; ++k) {
+                state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+                entries.push_back({i, static_cast<size_t>(state >> 33) % n, static_cast<double>(k + 1)});
+            }
+        }
+        return CsrMatrix::from_triplets(n, n, entries);
+    }
+
+    std::string format_bytes(double bytes_per_second) {
+        const char* units[] = {"B/s", "KiB/s", "MiB/s", "GiB/s", "TiB/s"};
+        size_t u = 0;
+        while (bytes_per_second >= 1024 && u + 1 < sizeof(units) / sizeof(units[0])) {
+            bytes_per_second /= 1024;
+            ++u;
+        }
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(2) << bytes_per_second << " " << units[u];
+        return out.str();
+    }
+
+    /**
+    * Runs the cases whose name matches --filter, printing each result as it
+    * comes and keeping them all for --json. A case is named prefix/n.
+    */
+    class Bench {
+    public:
+        explicit Bench(const Options& opt) : opt(opt) {}
+
+        bool wants(const std::string& prefix, size_t n) const {
+            return (prefix + "/" + std::to_string(n)).find(opt.filter) != std::string::npos;
+        }
+
+        /**
+        * Times body() as the case prefix/n when it matches; one call performs ops operations.
+        */
+        void run(const std::string& prefix, size_t n, double flops, double bytes, size_t ops,
+                 const std::function<void()>& body) {
+            if (!wants(prefix, n)) {
+                return;
+            }
+            Result r = measure(prefix + "/" + std::to_string(n), n, flops, bytes, ops, body, opt.min_time);
+            std::cout << std::left << std::setw(20) << r.name << std::right << std::fixed
+                      << std::setw(13) << std::setprecision(1) << r.ns_per_op << " ns"
+                      << std::setw(12) << r.iterations << std::setw(12) << std::setprecision(3) << r.gflops
+                      << std::setw(16) << format_bytes(r.bytes_per_second) << std::endl;
+            results_.push_back(std::move(r));
+        }
+
+        const std::vector<Result>& results() const { return results_; }
+
+    private:
+        const Options& opt;
+        std::vector<Result> results_;
+    };
+
+    /**
+    * Cases that share an expensive fixture per size, such as a sparse matrix
+    * or a file. run builds the fixture for n and times each case on it with
+    * Bench::run; it is skipped when no name/n matches the filter.
+    */
+    struct FixtureCase {
+        std::vector<const char*> names;
+        std::vector<size_t> sizes;
+        std::function<void(Bench& bench, size_t n)> run;
+    };
+
+    std::vector<FixtureCase> make_fixture_cases() {
+        return {
+            {{"spmv", "spmm"}, {size_t(1) << 14, size_t(1) << 17, size_t(1) << 20}, [](Bench& bench, size_t n) {
+                 const CsrMatrix a = make_sparse(n);
+                 const double nnz = static_cast<double>(a.nnz()), dn = static_cast<double>(n);
+                 const std::vector<double> x(n, 1.0);
+                 std::vector<double> y(n);
+                 bench.run("spmv", n, 2 * nnz, 16 * nnz + 24 * dn, 1, [&] {
+                     a.multiply(x.data(), y.data());
+                     sink = y[0];
+                 });
+                 if (n <= (size_t(1) << 17)) {
+                     const Matrix b(n, 16);
+                     bench.run("spmm", n, 32 * nnz, 16 * nnz + 8 * dn + 256 * dn, 1, [&] { keep(a * b); });
+                 }
+             }},
+            {{"binary-save", "binary-load", "binary-map"}, {1024, 4096}, [](Bench& bench, size_t n) {
+                 const Matrix a = make_operand(n, 1);
+                 const std::string path = "mat-bench-" + std::to_string(n) + ".mat";
+                 const double bytes = 8.0 * static_cast<double>(n * n);
+                 save_binary(path, a);
+                 bench.run("binary-save", n, 0, bytes, 1, [&] { save_binary(path, a); });
+                 bench.run("binary-load", n, 0, bytes, 1, [&] { keep(load_binary(path)); });
+                 bench.run("binary-map", n, 0, bytes, 1, [&] { sink = MappedMatrix(path)(n - 1, n - 1); });
+                 std::remove(path.c_str());
+             }},
+            {{"text-write", "text-read", "text-ostream", "text-istream"}, {256, 1024}, [](Bench& bench, size_t n) {
+                 const Matrix a = make_operand(n, 1);
+                 TextFormat csv;
+                 csv.delimiter = ',';
+                 std::ostringstream text;
+                 write_text(text, a, csv);
+                 const std::string data = text.str();
+                 std::ostringstream spaced;
+                 spaced << std::setprecision(17) << a;
+                 const std::string plain = spaced.str();
+                 const double bytes = static_cast<double>(data.size());
+                 bench.run("text-write", n, 0, bytes, 1, [&] {
+                     std::ostringstream out;
+                     write_text(out, a, csv);
+                     sink = static_cast<double>(out.tellp());
+                 });
+                 bench.run("text-read", n, 0, bytes, 1, [&] {
+                     std::istringstream in(data);
+                     keep(read_text(in, csv));
+                 });
+                 bench.run("text-ostream", n, 0, bytes, 1, [&] {
+                     std::ostringstream out;
+                     out << std::setprecision(17) << a;
+                     sink = static_cast<double>(out.tellp());
+                 });
+                 bench.run("text-istream", n, 0, static_cast<double>(plain.size()), 1, [&] {
+                     std::istringstream in(plain);
+                     Matrix m(n, n);
+                     for (size_t i = 0; i < n; ++i) {
+                         for (size_t j = 0; j < n; ++j) {
+                             in >> m(i, j);
+                         }
+                     }
+                     keep(m);
+                 });
+             }},
+            // Expressions sharing A*B, evaluated one by one and with one cache for the set.
+            {{"exprs-separate", "exprs-cached"}, {128, 512}, [](Bench& bench, size_t n) {
+                 std::map<std::string, Matrix> env;
+                 env.emplace("A", make_operand(n, 1));
+                 env.emplace("B", make_operand(n, 2));
+                 env.emplace("C", make_operand(n, 3));
+                 const MatrixLookup lookup = [&](const std::string& name) -> const Matrix& { return env.at(name); };
+                 std::vector<ExprPtr> exprs;
+                 for (const char* text : {"A*B + C", "A*B - C", "2 * (A*B)", "(A*B) * C", "!(A*B) + C"}) {
+                     exprs.push_back(parse_expression(text));
+                 }
+                 const double dn = static_cast<double>(n);
+                 const double flops = 2 * dn * dn * dn * static_cast<double>(exprs.size() + 1);
+                 bench.run("exprs-separate", n, flops, 0, 1, [&] {
+                     for (const ExprPtr& e : exprs) {
+                         keep(std::get<Matrix>(evaluate(e, lookup)));
+                     }
+                 });
+                 bench.run("exprs-cached", n, flops, 0, 1, [&] {
+                     ExprCache cache;
+                     for (const ExprPtr& e : exprs) {
+                         keep(std::get<Matrix>(evaluate(cache.intern(e), lookup, cache)));
+                     }
+                 });
+             }},
+            // A sum of independent products: evaluated as a task graph, against the same terms one by one.
+            {{"exprs-graph", "exprs-serial"}, {32, 64, 128, 512}, [](Bench& bench, size_t n) {
+                 const size_t terms = 32;
+                 std::map<std::string, Matrix> env;
+                 std::vector<const Matrix*> ops;
+                 std::string text;
+                 for (size_t t = 0; t < terms; ++t) {
+                     const std::string p = "P" + std::to_string(t), q = "Q" + std::to_string(t);
+                     ops.push_back(&env.emplace(p, make_operand(n, static_cast<unsigned>(2 * t + 1))).first->second);
+                     ops.push_back(&env.emplace(q, make_operand(n, static_cast<unsigned>(2 * t + 2))).first->second);
+                     text += (t == 0 ? "" : " + ") + p + "*" + q;
+                 }
+                 const MatrixLookup lookup = [&](const std::string& name) -> const Matrix& { return env.at(name); };
+                 const ExprPtr expr = parse_expression(text);
+                 const double dn = static_cast<double>(n);
+                 const double flops = 2 * dn * dn * dn * static_cast<double>(terms);
+                 bench.run("exprs-graph", n, flops, 0, 1, [&] { keep(std::get<Matrix>(evaluate(expr, lookup))); });
+                 bench.run("exprs-serial", n, flops, 0, 1, [&] {
+                     Matrix sum = *ops[0] * *ops[1];
+                     for (size_t t = 1; t < terms; ++t) {
+                         sum += *ops[2 * t] * *ops[2 * t + 1];
+                     }
+                     keep(sum);
+                 });
+             }},
+        };
+    }
+
+    void write_json(const std::string& path, const std::vector<Result>& results) {
+        std::ofstream out(path);
+        if (!out) {
+            throw std::runtime_error("Cannot open " + path + " for writing.");
+        }
+        out << std::setprecision(17);
+        out << "{\n  \"context\": {\n"
+            << "    \"isa\": \"" << mat_kernels::isa_name(mat_kernels::active_isa()) << "\",\n"
+            << "    \"threads\": " << mat_parallel::num_threads() << "\n  },\n"
+            << "  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            out << "    {\"name\": \"" << r.name << "\", \"size\": " << r.size
+                << ", \"iterations\": " << r.iterations << ", \"ns_per_op\": " << r.ns_per_op
+                << ", \"gflops\": " << r.gflops << ", \"bytes_per_second\": " << r.bytes_per_second << "}"
+                << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+
+    Options parse_options(int argc, char** argv) {
+        Options opt;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&](const char* prefix) -> const char* {
+                size_t len = std::strlen(prefix);
+                return arg.compare(0, len, prefix) == 0 ? argv[i] + len : nullptr;
+            };
+            if (const char* v = value("--filter=")) {
+                opt.filter = v;
+            } else if (const char* v = value("--min-time=")) {
+                opt.min_time = std::strtod(v, nullptr);
+            } else if (const char* v = value("--max-size=")) {
+                opt.max_size = std::strtoul(v, nullptr, 10);
+            } else if (const char* v = value("--json=")) {
+                opt.json = v;
+            } else {
+                throw std::invalid_argument("Unknown argument: " + arg +
+                                            "\nUsage: mat-bench [--filter=substr] [--min-time=seconds] [--max-size=n] [--json=file]");
+            }
+        }
+        return opt;
+    }
+
+}
+
+int main(int argc, char** argv) {
+    try {
+        const Options opt = parse_options(argc, argv);
+        std::cout << "ISA: " << mat_kernels::isa_name(mat_kernels::active_isa())
+                  << ", threads: " << mat_parallel::num_threads() << "\n"
+                  << std::left << std::setw(20) << "Benchmark" << std::right << std::setw(16) << "Time"
+                  << std::setw(12) << "Iterations" << std::setw(12) << "GFLOP/s" << std::setw(16) << "Bytes/s" << "\n"
+                  << std::string(76, '-') << std::endl;
+
+        Bench bench(opt);
+        const size_t sweep_max = opt.max_size != 0 ? opt.max_size : default_max_size;
+        for (const Case& c : make_cases()) {
+            for (size_t n = 2; n <= sweep_max && (c.max_size == 0 || n <= c.max_size); n *= 2) {
+                if (!bench.wants(c.name, n)) {
+                    continue;
+                }
+                const Matrix a = make_operand(n, 1);
+                const Matrix b = make_operand(n, c.same_operands ? 1 : 2);
+                const double dn = static_cast<double>(n);
+                bench.run(c.name, n, c.flops(dn), c.bytes(dn), 1, [&] { c.run(a, b); });
+            }
+        }
+        for (const BatchCase& c : make_batch_cases()) {
+            const std::string batched = std::string("batch-") + c.name, loop = std::string("loop-") + c.name;
+            for (size_t n = 2; n <= 4 && opt.fits(n); ++n) {
+                if (!bench.wants(batched, n) && !bench.wants(loop, n)) {
+                    continue;
+                }
+                MatrixBatch a(batch_count, n, n), b(batch_count, n, n);
+                std::vector<Matrix> la, lb;
+                for (size_t i = 0; i < batch_count; ++i) {
+                    la.push_back(make_operand(n, static_cast<unsigned>(2 * i + 1)));
+                    lb.push_back(make_operand(n, static_cast<unsigned>(2 * i + 2)));
+                    a.set(i, la.back().view());
+                    b.set(i, lb.back().view());
+                }
+                const double dn = static_cast<double>(n);
+                bench.run(batched, n, c.flops(dn), c.bytes(dn), batch_count, [&] { c.batched(a, b); });
+                bench.run(loop, n, c.flops(dn), c.bytes(dn), batch_count, [&] { c.loop(la, lb); });
+            }
+        }
+        for (const FixtureCase& c : make_fixture_cases()) {
+            for (size_t n : c.sizes) {
+                if (opt.fits(n) && std::any_of(c.names.begin(), c.names.end(), [&](const char* name) { return bench.wants(name, n); })) {
+                    c.run(bench, n);
+                }
+            }
+        }
+        if (!opt.json.empty()) {
+            write_json(opt.json, bench.results());
+        }
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -4,6 +4,12 @@
 #include <iostream>
 #include <vector>
 #include <stdexcept>
+#include <algorithm>
+#include <complex>
+
+#include "mat_alloc.h"
+#include "mat_expr.h"
+#include "mat_view.h"
 
 /**
 * A class for operations on matrices.
@@ -14,105 +20,599 @@
 * 5 Obtaining the inverse matrix (~)
 * 6 Multiplication by a number (*)
 * 7 The ability to combine operations into chains
+*
+* Addition, subtraction and multiplication by a scalar are lazy (see mat_expr.h)
+* and are fused into a single pass when the result is stored in a Matrix.
+*
+* The element type T is one of float, double, long double and
+* std::complex<double>; Matrix is BasicMatrix<double>. The members are compiled
+* once per element type in mat.cpp. Elementwise SIMD kernels exist for float
+* and double, the other types use the generic loops.
 */
-class Matrix {
+template <class T>
+class BasicMatrix : public MatExpr<BasicMatrix<T>> {
+public:
+    using value_type = T;
 private:
-    std::vector<std::vector<double>> data; //< Matrix data stored in a 2D vector
-    size_t rows, cols; //< Number of rows and columns in the matrix
+    std::vector<T, AlignedAllocator<T>> storage; //< Row-major elements in one 64-byte aligned buffer, always nrows * ld long
+    size_t nrows, ncols; //< Number of rows and columns in the matrix
+    size_t ld; //< Leading dimension: distance in elements between the starts of two consecutive rows
 
+    struct uninitialized_t {};
     /**
-    * \brief Checks if the dimensions of the matrices match.
-    * \param other The matrix to compare dimensions with.
-    * \throw std::invalid_argument if the dimensions do not match.
+    * \brief Constructs a matrix whose elements are left uninitialized.
+    * Used for results where every element is written before it is read.
+    */
+    BasicMatrix(size_t rows, size_t cols, uninitialized_t);
+    /**
+    * \brief Evaluates an expression into this matrix, which already has its shape.
     */
-    void check_dimensions(const Matrix& other) const;
+    template <class E>
+    void assign(const E& expr);
+
     /**
     * \brief Returns the cofactor matrix for a given element.
     * \param p Row index of the element.
     * \param q Column index of the element.
     * \return The cofactor matrix.
     */
-    Matrix get_cofactor(size_t p, size_t q) const;
+    BasicMatrix get_cofactor(size_t p, size_t q) const;
     /**
     * \brief Calculates the determinant of the matrix.
+    * Orders 1 and 2 use the closed form; larger matrices are LU factored with
+    * partial pivoting and the determinant is the signed product of the pivots.
     * \param mat The matrix for which to calculate the determinant.
     * \return The determinant of the matrix.
     */
-    double determinant(const Matrix& mat) const;
+    T determinant(const BasicMatrix& mat) const;
     /**
     * \brief Calculates the adjoint of the matrix.
     * \return The adjoint matrix.
     */
 public:
-    Matrix adjoint() const;
+    BasicMatrix adjoint() const;
     /**
     * \brief Constructs a matrix with specified number of rows and columns.
     * \param rows Number of rows.
     * \param cols Number of columns
     */
-    explicit Matrix(size_t rows, size_t cols);
+    explicit BasicMatrix(size_t rows, size_t cols);
     /**
     * \brief Constructs a matrix from a 2D vector of data.
     * \param data 2D vector containing the matrix data.
     */
-    Matrix(const std::vector<std::vector<double>>& data);
+    BasicMatrix(const std::vector<std::vector<T>>& data);
+    /**
+    * \brief Evaluates an elementwise expression in a single pass.
+    * \param expr The expression, e.g. A + B - C * 2.0.
+    */
+    template <class E>
+    BasicMatrix(const MatExpr<E>& expr);
+    BasicMatrix(const BasicMatrix&) = default;
+    BasicMatrix(BasicMatrix&&) = default;
+    BasicMatrix& operator=(const BasicMatrix&) = default;
+    BasicMatrix& operator=(BasicMatrix&&) = default;
     /**
-    * \brief Adds two matrices.
-    * \param other The matrix to add.
-    * \return The resulting matrix after addition.
+    * \brief Evaluates an elementwise expression into this matrix.
+    * The existing buffer is reused when the shape matches; the expression may
+    * refer to this matrix, since every element only depends on its own position.
+    * \param expr The expression to evaluate.
+    * \return This matrix.
+    */
+    template <class E>
+    BasicMatrix& operator=(const MatExpr<E>& expr);
+    /**
+    * \brief Adds a matrix or expression to this matrix in place.
+    * \param other The matrix or expression to add.
+    * \return This matrix.
     * \throw std::invalid_argument if the dimensions do not match.
     */
-    Matrix operator+(const Matrix& other) const;
+    template <class E>
+    BasicMatrix& operator+=(const MatExpr<E>& other);
     /**
-    * \brief Subtracts one matrix from another.
-    * \param other The matrix to subtract.
-    * \return The resulting matrix after subtraction.
+    * \brief Subtracts a matrix or expression from this matrix in place.
+    * \param other The matrix or expression to subtract.
+    * \return This matrix.
     * \throw std::invalid_argument if the dimensions do not match.
     */
-    Matrix operator-(const Matrix& other) const;
+    template <class E>
+    BasicMatrix& operator-=(const MatExpr<E>& other);
     /**
-    * \brief Multiplies two matrices.
+    * \brief Multiplies this matrix by a scalar in place.
+    * \param scalar The scalar to multiply with.
+    * \return This matrix.
+    */
+    BasicMatrix& operator*=(T scalar);
+    /**
+    * \brief Replaces this matrix by the product this * other.
+    * GEMM cannot write over its own input, so one result buffer is allocated
+    * and then moved into this matrix.
     * \param other The matrix to multiply with.
-    * \return The resulting matrix after multiplication.
+    * \return This matrix.
     * \throw std::invalid_argument if the dimensions do not match for multiplication.
     */
-    Matrix operator*(const Matrix& other) const;
+    BasicMatrix& operator*=(const BasicMatrix& other);
     /**
-    * \brief Checks if two matrices are equal.
-    * \param other The matrix to compare with.
-    * \return True if the matrices are equal, false otherwise.
+    * \brief Returns the number of rows.
     */
-    bool operator==(const Matrix& other) const;
+    size_t rows() const { return nrows; }
     /**
-    * \brief Multiplies the matrix by a scalar.
-    * \param scalar The scalar to multiply with.
-    * \return The resulting matrix after multiplication by the scalar.
+    * \brief Returns the number of columns.
+    */
+    size_t cols() const { return ncols; }
+    /**
+    * \brief Returns the leading dimension (row stride in elements).
+    */
+    size_t stride() const { return ld; }
+    /**
+    * \brief Returns a pointer to the first element of the row-major buffer.
+    */
+    T* data() { return storage.data(); }
+    const T* data() const { return storage.data(); }
+    /**
+    * \brief Returns a pointer to the first element of row i.
+    * \param i Row index.
     */
-    Matrix operator*(const double scalar) const;
+    T* row(size_t i) { return storage.data() + i * ld; }
+    const T* row(size_t i) const { return storage.data() + i * ld; }
+    /**
+    * \brief Returns a view of the whole matrix.
+    */
+    BasicConstMatrixView<T> view() const { return {data(), nrows, ncols, ld}; }
+    BasicMatrixView<T> view() { return {data(), nrows, ncols, ld}; }
+    /**
+    * \brief Returns a view of the h x w block starting at row r, column c; no data is copied.
+    * \throw std::out_of_range if the block does not fit in the matrix.
+    */
+    BasicConstMatrixView<T> block(size_t r, size_t c, size_t h, size_t w) const { return view().block(r, c, h, w); }
+    BasicMatrixView<T> block(size_t r, size_t c, size_t h, size_t w) { return view().block(r, c, h, w); }
+    /**
+    * \brief Returns a 1 x cols view of row i, or a rows x 1 view of column j.
+    * \throw std::out_of_range if the index is out of range.
+    */
+    BasicConstMatrixView<T> row_view(size_t i) const { return view().row_view(i); }
+    BasicMatrixView<T> row_view(size_t i) { return view().row_view(i); }
+    BasicConstMatrixView<T> col_view(size_t j) const { return view().col_view(j); }
+    BasicMatrixView<T> col_view(size_t j) { return view().col_view(j); }
+    /**
+    * \brief Accesses the element at row i, column j without bounds checking.
+    */
+    T& operator()(size_t i, size_t j) { return storage[i * ld + j]; }
+    T operator()(size_t i, size_t j) const { return storage[i * ld + j]; }
+    /**
+    * \brief Multiplies two matrices.
+    * \param other The matrix to multiply with.
+    * \return The resulting matrix after multiplication.
+    * \throw std::invalid_argument if the dimensions do not match for multiplication.
+    */
+    BasicMatrix operator*(const BasicMatrix& other) const;
+    /**
+    * \brief Multiplies op(a) * op(b), where op transposes an operand marked Transpose::yes.
+    * Transposed operands are read in place by GEMM and are not copied.
+    * \throw std::invalid_argument if the dimensions do not match for multiplication.
+    */
+    static BasicMatrix multiply(const BasicConstMatrixView<T>& a, mat_kernels::Transpose ta, const BasicConstMatrixView<T>& b, mat_kernels::Transpose tb);
     /**
     * \brief Returns the transpose of the matrix.
     * \return The transposed matrix.
     */
-    Matrix operator!() const;
+    BasicMatrix operator!() const;
     /**
-    * \brief Calculates the determinant of the matrix.
+    * \brief Transposes this square matrix in place, without a second buffer.
+    * \return This matrix.
+    * \throw std::invalid_argument if the matrix is not square.
+    */
+    BasicMatrix& transpose_in_place();
+    /**
+    * \brief Returns a transposed view of the matrix without copying it.
+    * The view can be used in products, elementwise expressions and output;
+    * it is materialized only when a Matrix is built or assigned from it. It
+    * refers to this matrix and must not outlive it.
+    */
+    MatTransposed<BasicMatrix> transposed() const & { return MatTransposed<BasicMatrix>(*this); }
+    MatTransposed<BasicMatrix> transposed() && = delete;
+    /**
+    * \brief Calculates the determinant of the matrix in O(n^3).
     * \return The determinant of the matrix.
+    * \throw std::invalid_argument if the matrix is not square.
     */
-    double operator*() const;
+    T operator*() const;
     /**
     * \brief Returns the inverse of the matrix.
+    * Computed in O(n^3) from an LU factorization with partial pivoting. The
+    * matrix is treated as singular when a pivot is not larger than
+    * n * epsilon * max|a_ij|.
     * \return The inverse matrix.
-    * \throw std::runtime_error if the matrix is singular (determinant is zero).
+    * \throw std::invalid_argument if the matrix is not square.
+    * \throw std::runtime_error if the matrix is singular to working precision.
     */
-    Matrix operator~() const;
+    BasicMatrix operator~() const;
+};
+
+
+
     /**
     * \brief Outputs the matrix to an output stream.
     * \param os The output stream to write to.
     * \param matrix The matrix to output.
     * \return The output stream after writing the matrix.
     */
-    friend std::ostream& operator<<(std::ostream& os, const Matrix& matrix);
-};
+    template <class T>
+    std::ostream& operator<<(std::ostream& os, const BasicMatrix<T>& matrix);
+
+    extern template class BasicMatrix<float>;
+    extern template class BasicMatrix<double>;
+    extern template class BasicMatrix<long double>;
+    extern template class BasicMatrix<std::complex<double>>;
+
+    template <class T>
+    BasicConstMatrixView<T> dense_view(const BasicMatrix<T>& m) { return m.view(); }
+    template <class T>
+    BasicConstMatrixView<T> dense_view(const MatRef<BasicMatrix<T>>& r) { return r.get().view(); }
+
+    /**
+    * \brief Tells whether two views share any part of the address range they span.
+    */
+    template <class T>
+    bool ranges_overlap(const BasicConstMatrixView<T>& a, const BasicConstMatrixView<T>& b) {
+        const T* a_end = a.data() + (a.rows() - 1) * a.stride() + a.cols();
+        const T* b_end = b.data() + (b.rows() - 1) * b.stride() + b.cols();
+        return a.data() < b_end && b.data() < a_end;
+    }
+
+    /**
+    * \brief Tells whether an expression reads memory of dst at positions other than the one it writes.
+    * Such an expression cannot be evaluated into dst in place: either a
+    * transposed view or a shifted block of dst would read elements that were
+    * already overwritten.
+    */
+    template <class E, class T>
+    bool overlaps_shifted(const E& e, const BasicConstMatrixView<T>& dst) {
+        if constexpr (is_dense_operand<E>::value) {
+            BasicConstMatrixView<T> v = dense_view(e);
+            return !(v.data() == dst.data() && v.stride() == dst.stride()) && ranges_overlap(v, dst);
+        } else if constexpr (is_mat_transposed<E>::value) {
+            return ranges_overlap(dense_view(e.get()), dst);
+        } else {
+            return false;
+        }
+    }
+
+    template <class L, class R, class Op, class T>
+    bool overlaps_shifted(const MatBinary<L, R, Op>& b, const BasicConstMatrixView<T>& dst) {
+        return overlaps_shifted(b.lhs(), dst) || overlaps_shifted(b.rhs(), dst);
+    }
+
+    template <class E, class T>
+    bool overlaps_shifted(const MatScaled<E>& e, const BasicConstMatrixView<T>& dst) { return overlaps_shifted(e.expr(), dst); }
+
+    /**
+    * \brief Tells whether a view can be processed as one run of rows * cols elements.
+    */
+    template <class T>
+    bool is_contiguous(const BasicConstMatrixView<T>& v) { return v.stride() == v.cols() || v.rows() == 1; }
+
+    template <class T>
+    bool is_contiguous(const BasicMatrixView<T>& v) { return v.stride() == v.cols() || v.rows() == 1; }
+
+    /**
+    * \brief Evaluates an expression of the same shape into a view that it does not overlap at a shifted position.
+    * Single operations on dense operands run the dispatched SIMD kernels,
+    * once over the whole buffer when every operand is contiguous and once per
+    * row otherwise.
+    */
+    template <class T, class E>
+    void assign_dense(const BasicMatrixView<T>& out, const E& expr) {
+        const size_t rows = out.rows(), cols = out.cols();
+        if constexpr (is_dense_operand<E>::value) {
+            BasicConstMatrixView<T> src = dense_view(expr);
+            if (src.data() != out.data()) {
+                for (size_t i = 0; i < rows; ++i) {
+                    std::copy(src.row(i), src.row(i) + cols, out.row(i));
+                }
+            }
+        } else if constexpr (is_mat_transposed<E>::value) {
+            const auto& m = expr.get();
+            mat_kernels::transpose(m.rows(), m.cols(), m.data(), m.stride(), out.data(), out.stride());
+        } else if constexpr (is_kernel_binary<E>::value) {
+            // A single operation on two matrices maps onto one dispatched SIMD kernel.
+            const auto kernel = mat_kernels::elementwise<T>().*E::op_type::template kernel<T>;
+            BasicConstMatrixView<T> a = dense_view(expr.lhs());
+            BasicConstMatrixView<T> b = dense_view(expr.rhs());
+            if (is_contiguous(a) && is_contiguous(b) && is_contiguous(out)) {
+                kernel(a.data(), b.data(), out.data(), rows * cols);
+            } else {
+                for (size_t i = 0; i < rows; ++i) {
+                    kernel(a.row(i), b.row(i), out.row(i), cols);
+                }
+            }
+        } else if constexpr (is_kernel_scaled<E>::value) {
+            const auto kernel = mat_kernels::elementwise<T>().scale;
+            BasicConstMatrixView<T> a = dense_view(expr.expr());
+            if (is_contiguous(a) && is_contiguous(out)) {
+                kernel(a.data(), expr.scalar(), out.data(), rows * cols);
+            } else {
+                for (size_t i = 0; i < rows; ++i) {
+                    kernel(a.row(i), expr.scalar(), out.row(i), cols);
+                }
+            }
+        } else {
+            for (size_t i = 0; i < rows; ++i) {
+                T* o = out.row(i);
+                for (size_t j = 0; j < cols; ++j) {
+                    o[j] = expr(i, j);
+                }
+            }
+        }
+    }
+
+    template <class T>
+    template <class E>
+    void BasicMatrix<T>::assign(const E& expr) {
+        static_assert(std::is_same<expr_value_t<E>, T>::value, "Expression element type must match the matrix.");
+        const BasicMatrix& self = *this;
+        if (overlaps_shifted(expr, self.view())) {
+            if constexpr (is_mat_transposed<E>::value) {
+                if (&expr.get() == this) {
+                    mat_kernels::transpose_inplace(nrows, data(), ld);
+                    return;
+                }
+            }
+            BasicMatrix result(nrows, ncols, uninitialized_t{});
+            result.assign(expr);
+            *this = std::move(result);
+            return;
+        }
+        assign_dense(view(), expr);
+    }
+
+    template <class T>
+    template <class E>
+    BasicMatrix<T>::BasicMatrix(const MatExpr<E>& expr) : BasicMatrix(expr.self().rows(), expr.self().cols(), uninitialized_t{}) {
+        assign(expr.self());
+    }
+
+    template <class T>
+    template <class E>
+    BasicMatrix<T>& BasicMatrix<T>::operator+=(const MatExpr<E>& other) {
+        assign(MatBinary<MatRef<BasicMatrix>, expr_operand_t<const E&>, AddOp>(MatRef<BasicMatrix>(*this), expr_operand_t<const E&>(other.self())));
+        return *this;
+    }
+
+    template <class T>
+    template <class E>
+    BasicMatrix<T>& BasicMatrix<T>::operator-=(const MatExpr<E>& other) {
+        assign(MatBinary<MatRef<BasicMatrix>, expr_operand_t<const E&>, SubOp>(MatRef<BasicMatrix>(*this), expr_operand_t<const E&>(other.self())));
+        return *this;
+    }
+
+    template <class T>
+    template <class E>
+    BasicMatrix<T>& BasicMatrix<T>::operator=(const MatExpr<E>& expr) {
+        const E& e = expr.self();
+        if (e.rows() == nrows && e.cols() == ncols) {
+            assign(e);
+        } else {
+            *this = BasicMatrix(expr);
+        }
+        return *this;
+    }
+
+    /**
+    * \brief Overloads for an expiring Matrix operand: the result is computed in
+    * place and the operand's buffer is moved into the returned Matrix, so no
+    * allocation happens. They are eager, unlike the lazy expression operators.
+    * \throw std::invalid_argument if the dimensions do not match.
+    */
+    template <class T, class R, class = std::enable_if_t<is_mat_expr<R>::value>>
+    BasicMatrix<T> operator+(BasicMatrix<T>&& l, R&& r) {
+        l += r;
+        return std::move(l);
+    }
+
+    template <class T, class L, class = std::enable_if_t<is_mat_expr<L>::value>>
+    BasicMatrix<T> operator+(L&& l, BasicMatrix<T>&& r) {
+        r += l;
+        return std::move(r);
+    }
+
+    template <class T>
+    BasicMatrix<T> operator+(BasicMatrix<T>&& l, BasicMatrix<T>&& r) {
+        l += r;
+        return std::move(l);
+    }
+
+    template <class T, class R, class = std::enable_if_t<is_mat_expr<R>::value>>
+    BasicMatrix<T> operator-(BasicMatrix<T>&& l, R&& r) {
+        l -= r;
+        return std::move(l);
+    }
+
+    template <class T, class L, class = std::enable_if_t<is_mat_expr<L>::value>>
+    BasicMatrix<T> operator-(L&& l, BasicMatrix<T>&& r) {
+        r = std::forward<L>(l) - r;
+        return std::move(r);
+    }
+
+    template <class T>
+    BasicMatrix<T> operator-(BasicMatrix<T>&& l, BasicMatrix<T>&& r) {
+        l -= r;
+        return std::move(l);
+    }
+
+    template <class T>
+    BasicMatrix<T> operator*(BasicMatrix<T>&& m, typename BasicMatrix<T>::value_type scalar) {
+        m *= scalar;
+        return std::move(m);
+    }
+
+    template <class T>
+    BasicMatrix<T> operator*(typename BasicMatrix<T>::value_type scalar, BasicMatrix<T>&& m) {
+        m *= scalar;
+        return std::move(m);
+    }
+
+    template <class T>
+    template <class E>
+    BasicMatrixView<T>& BasicMatrixView<T>::operator=(const MatExpr<E>& expr) {
+        const E& e = expr.self();
+        if (e.rows() != nrows || e.cols() != ncols) {
+            throw std::invalid_argument("Matrix dimensions must agree.");
+        }
+        if (overlaps_shifted(e, BasicConstMatrixView<T>(*this))) {
+            assign_dense(*this, BasicMatrix<T>(expr));
+        } else {
+            assign_dense(*this, e);
+        }
+        return *this;
+    }
+
+    template <class T>
+    BasicMatrixView<T>& BasicMatrixView<T>::operator=(const BasicMatrixView& other) {
+        return *this = static_cast<const MatExpr<BasicMatrixView>&>(other);
+    }
+
+    template <class T>
+    template <class E>
+    BasicMatrixView<T>& BasicMatrixView<T>::operator+=(const MatExpr<E>& other) {
+        return *this = MatBinary<BasicMatrixView, expr_operand_t<const E&>, AddOp>(*this, expr_operand_t<const E&>(other.self()));
+    }
+
+    template <class T>
+    template <class E>
+    BasicMatrixView<T>& BasicMatrixView<T>::operator-=(const MatExpr<E>& other) {
+        return *this = MatBinary<BasicMatrixView, expr_operand_t<const E&>, SubOp>(*this, expr_operand_t<const E&>(other.self()));
+    }
+
+    template <class T>
+    BasicMatrixView<T>& BasicMatrixView<T>::operator*=(T scalar) {
+        assign_dense(*this, MatScaled<BasicMatrixView>(*this, scalar));
+        return *this;
+    }
+
+    /**
+    * \brief Returns a Matrix operand unchanged and evaluates any other expression.
+    */
+    template <class T>
+    const BasicMatrix<T>& eval_operand(const BasicMatrix<T>& m) { return m; }
+    template <class T>
+    const BasicMatrix<T>& eval_operand(const MatRef<BasicMatrix<T>>& r) { return r.get(); }
+    template <class E>
+    BasicMatrix<expr_value_t<E>> eval_operand(const MatExpr<E>& e) { return BasicMatrix<expr_value_t<E>>(e); }
+
+    /**
+    * \brief Returns a matrix or transposed view unchanged for GEMM and evaluates any other expression.
+    */
+    template <class T>
+    BasicConstMatrixView<T> gemm_operand(const BasicMatrix<T>& m) { return m.view(); }
+    template <class T>
+    BasicConstMatrixView<T> gemm_operand(const MatRef<BasicMatrix<T>>& r) { return r.get().view(); }
+    template <class T>
+    BasicConstMatrixView<T> gemm_operand(const BasicConstMatrixView<T>& v) { return v; }
+    template <class T>
+    BasicConstMatrixView<T> gemm_operand(const BasicMatrixView<T>& v) { return v; }
+    template <class T>
+    const MatTransposed<BasicMatrix<T>>& gemm_operand(const MatTransposed<BasicMatrix<T>>& t) { return t; }
+    template <class E>
+    BasicMatrix<expr_value_t<E>> gemm_operand(const MatExpr<E>& e) { return BasicMatrix<expr_value_t<E>>(e); }
+
+    template <class T>
+    BasicConstMatrixView<T> gemm_source(const BasicConstMatrixView<T>& v) { return v; }
+    template <class T>
+    BasicConstMatrixView<T> gemm_source(const BasicMatrix<T>& m) { return m.view(); }
+    template <class T>
+    BasicConstMatrixView<T> gemm_source(const MatTransposed<BasicMatrix<T>>& t) { return t.get().view(); }
+
+    template <class L, class R>
+    BasicMatrix<expr_value_t<L>> multiply_operands(const L& l, const R& r) {
+        static_assert(std::is_same<expr_value_t<L>, expr_value_t<R>>::value, "Factors of a product must have the same element type.");
+        using mat_kernels::Transpose;
+        return BasicMatrix<expr_value_t<L>>::multiply(gemm_source(l), is_mat_transposed<L>::value ? Transpose::yes : Transpose::no,
+                                                      gemm_source(r), is_mat_transposed<R>::value ? Transpose::yes : Transpose::no);
+    }
+
+    /**
+    * \brief Multiplies two expressions with GEMM.
+    * Block views and transposed views are passed to GEMM as they are; other
+    * expressions are evaluated first. Matrix * Matrix is handled by the member operator.
+    * \throw std::invalid_argument if the dimensions do not match for multiplication.
+    */
+    template <class L, class R, class = std::enable_if_t<is_mat_expr<L>::value && is_mat_expr<R>::value &&
+                                                         !(is_mat_leaf<std::decay_t<L>>::value &&
+                                                           is_mat_leaf<std::decay_t<R>>::value)>>
+    BasicMatrix<expr_value_t<L>> operator*(L&& l, R&& r) {
+        return multiply_operands(gemm_operand(l), gemm_operand(r));
+    }
+
+    /**
+    * \brief Checks if two matrices or expressions are equal element by element.
+    * \param l The left operand.
+    * \param r The right operand.
+    * \return True if the matrices are equal, false otherwise.
+    * \throw std::invalid_argument if the dimensions do not match.
+    */
+    template <class L, class R>
+    bool operator==(const MatExpr<L>& l, const MatExpr<R>& r) {
+        using T = expr_value_t<L>;
+        static_assert(std::is_same<T, expr_value_t<R>>::value, "Compared matrices must have the same element type.");
+        const L& a = l.self();
+        const R& b = r.self();
+        if (a.rows() != b.rows() || a.cols() != b.cols()) {
+            throw std::invalid_argument("Matrix dimensions must agree.");
+        }
+        if constexpr (is_dense_operand<L>::value && is_dense_operand<R>::value && mat_kernels::has_elementwise_kernels<T>) {
+            BasicConstMatrixView<T> x = dense_view(a);
+            BasicConstMatrixView<T> y = dense_view(b);
+            const auto equal = mat_kernels::elementwise<T>().equal;
+            if (is_contiguous(x) && is_contiguous(y)) {
+                return equal(x.data(), y.data(), x.rows() * x.cols());
+            }
+            for (size_t i = 0; i < x.rows(); ++i) {
+                if (!equal(x.row(i), y.row(i), x.cols())) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        for (size_t i = 0; i < a.rows(); ++i) {
+            for (size_t j = 0; j < a.cols(); ++j) {
+                if (a(i, j) != b(i, j)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+    * \brief Transpose, determinant and inverse of an expression evaluate it first.
+    */
+    template <class E, class = std::enable_if_t<!is_mat_leaf<E>::value>>
+    BasicMatrix<expr_value_t<E>> operator!(const MatExpr<E>& e) { return !eval_operand(e.self()); }
+
+    template <class E, class = std::enable_if_t<!is_mat_leaf<E>::value>>
+    expr_value_t<E> operator*(const MatExpr<E>& e) { return *eval_operand(e.self()); }
+
+    template <class E, class = std::enable_if_t<!is_mat_leaf<E>::value>>
+    BasicMatrix<expr_value_t<E>> operator~(const MatExpr<E>& e) { return ~eval_operand(e.self()); }
+
+    template <class E, class = std::enable_if_t<!is_mat_leaf<E>::value>>
+    std::ostream& operator<<(std::ostream& os, const MatExpr<E>& e) { return os << eval_operand(e.self()); }
+
+    /**
+    * \brief Transposing a transposed view copies the underlying matrix; its
+    * determinant is that of the matrix. Neither materializes the view.
+    */
+    template <class T>
+    BasicMatrix<T> operator!(const MatTransposed<BasicMatrix<T>>& t) { return t.get(); }
+    template <class T>
+    T operator*(const MatTransposed<BasicMatrix<T>>& t) { return *t.get(); }
+
+    /**
+    * \brief Outputs a transposed view element by element without materializing it.
+    */
+    template <class T>
+    std::ostream& operator<<(std::ostream& os, const MatTransposed<BasicMatrix<T>>& t);
 
 
-#endif
\ No newline at end of file
+#endif
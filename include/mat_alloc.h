@@ -0,0 +1,66 @@
+#ifndef MAT_ALLOC_H
+#define MAT_ALLOC_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+/**
+* An allocator returning memory aligned to a fixed boundary.
+* It is the backing allocator of Matrix: every buffer starts on a cache line,
+* so SIMD loads of the first row never straddle two lines.
+* Elements constructed without arguments are default-initialized (left
+* uninitialized for arithmetic types), which lets result matrices skip the
+* zero fill when every element is going to be overwritten anyway.
+*/
+template <class T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <class U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept = default;
+
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    /**
+    * \brief Allocates storage for n objects aligned to Alignment bytes.
+    * \param n Number of objects.
+    * \return Pointer to the allocated storage.
+    * \throw std::bad_alloc if the allocation fails.
+    */
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t{Alignment}));
+    }
+
+    /**
+    * \brief Releases storage obtained from allocate.
+    * \param p Pointer returned by allocate.
+    */
+    void deallocate(T* p, std::size_t) noexcept {
+        ::operator delete(p, std::align_val_t{Alignment});
+    }
+
+    /**
+    * \brief Constructs an object in place; no arguments means default-initialization.
+    */
+    template <class U, class... Args>
+    void construct(U* p, Args&&... args) {
+        if constexpr (sizeof...(Args) == 0) {
+            ::new (static_cast<void*>(p)) U;
+        } else {
+            ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+        }
+    }
+
+    template <class U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+    template <class U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef MAT_BATCH_H
+#define MAT_BATCH_H
+
+#include <cstddef>
+#include <vector>
+
+#include "mat.h"
+#include "mat_alloc.h"
+
+/**
+* A batch of same-shaped small matrices stored as a structure of arrays.
+* Element (i, j) of every matrix lives in one contiguous plane of size()
+* values, so the batched operators run a short fixed sequence of arithmetic
+* per matrix and vectorize across the batch: one SIMD register holds the same
+* element of 4, 8 or 16 different matrices. This removes the per-object
+* allocation and dispatch overhead of a loop over Matrix, which dominates
+* for 2 x 2 to 4 x 4 operands.
+*
+* Determinants and inverses use closed forms up to order 4. Larger orders are
+* factored matrix by matrix with the LU kernels of Matrix.
+*
+* The templates are instantiated for float and double; MatrixBatch is BasicMatrixBatch<double>.
+*/
+template <class T>
+class BasicMatrixBatch {
+private:
+    std::vector<T, AlignedAllocator<T>> storage; //< rows * cols planes, each plane_stride elements long
+    size_t count; //< Number of matrices
+    size_t nrows, ncols; //< Shape of every matrix
+    size_t plane_stride; //< count rounded up to a cache line, so every plane starts aligned
+public:
+    using value_type = T;
+    /**
+    * \brief Constructs a batch of count zero matrices of rows x cols.
+    * \throw std::runtime_error if a dimension is 0.
+    */
+    BasicMatrixBatch(size_t count, size_t rows, size_t cols);
+    /**
+    * \brief Returns the number of matrices in the batch.
+    */
+    size_t size() const { return count; }
+    size_t rows() const { return nrows; }
+    size_t cols() const { return ncols; }
+    /**
+    * \brief Returns the distance in elements between two consecutive planes.
+    */
+    size_t stride() const { return plane_stride; }
+    /**
+    * \brief Returns the size() values of element (i, j), one per matrix.
+    */
+    T* plane(size_t i, size_t j) { return storage.data() + (i * ncols + j) * plane_stride; }
+    const T* plane(size_t i, size_t j) const { return storage.data() + (i * ncols + j) * plane_stride; }
+    /**
+    * \brief Accesses element (i, j) of matrix b without bounds checking.
+    */
+    T& operator()(size_t b, size_t i, size_t j) { return plane(i, j)[b]; }
+    T operator()(size_t b, size_t i, size_t j) const { return plane(i, j)[b]; }
+    /**
+    * \brief Copies matrix b out of the batch.
+    * \throw std::out_of_range if b is not smaller than size().
+    */
+    BasicMatrix<T> get(size_t b) const;
+    /**
+    * \brief Overwrites matrix b with a matrix or view of the batch shape.
+    * \throw std::out_of_range if b is not smaller than size().
+    * \throw std::invalid_argument if the shape does not match.
+    */
+    void set(size_t b, const BasicConstMatrixView<T>& m);
+    /**
+    * \brief Multiplies the matrices pairwise: result b is this[b] * other[b].
+    * \throw std::invalid_argument if the batch sizes or the inner dimensions do not match.
+    */
+    BasicMatrixBatch operator*(const BasicMatrixBatch& other) const;
+    /**
+    * \brief Returns the batch of transposes.
+    */
+    BasicMatrixBatch operator!() const;
+    /**
+    * \brief Returns the determinant of every matrix.
+    * \throw std::invalid_argument if the matrices are not square.
+    */
+    std::vector<T> operator*() const;
+    /**
+    * \brief Returns the batch of inverses.
+    * A matrix is treated as singular when its determinant is not larger
+    * than n * epsilon * max|a_ij|^n (orders up to 4) or when an LU pivot is
+    * not larger than n * epsilon * max|a_ij| (larger orders), as for
+    * FixedMatrix and Matrix.
+    * \throw std::invalid_argument if the matrices are not square.
+    * \throw std::runtime_error if any matrix of the batch is singular to working precision.
+    */
+    BasicMatrixBatch operator~() const;
+};
+
+using MatrixBatch = BasicMatrixBatch<double>;
+
+extern template class BasicMatrixBatch<float>;
+extern template class BasicMatrixBatch<double>;
+
+#endif
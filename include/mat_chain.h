@@ -0,0 +1,36 @@
+#ifndef MAT_CHAIN_H
+#define MAT_CHAIN_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "mat.h"
+
+/**
+* The cheapest parenthesization of a product A1 * A2 * ... * An.
+*/
+struct ChainOrder {
+    size_t count; //< Number of factors
+    std::vector<size_t> split; //< split[i * count + j]: the product Ai..Aj is (Ai..Ak) * (Ak+1..Aj) with k = split
+    double flops; //< Floating-point operations of the chosen order, counting 2 per multiply-add
+};
+
+/**
+* \brief Finds the cheapest order of a matrix chain with the classic O(n^3) dynamic program.
+* \param shapes (rows, cols) of each factor, in order.
+* \return The chosen split points and their FLOP estimate.
+* \throw std::invalid_argument if the list is empty or neighbouring shapes do not agree.
+*/
+ChainOrder plan_chain(const std::vector<std::pair<size_t, size_t>>& shapes);
+
+/**
+* \brief Multiplies a chain of matrices in the cheapest order.
+* \param factors The matrices A1..An, in order.
+* \param flops If not null, the FLOP estimate of the chosen order is added to it.
+* \return The product A1 * ... * An.
+* \throw std::invalid_argument if the list is empty or neighbouring shapes do not agree.
+*/
+Matrix multiply_chain(const std::vector<const Matrix*>& factors, double* flops = nullptr);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef MAT_CHOLESKY_H
+#define MAT_CHOLESKY_H
+
+#include <cstddef>
+#include <vector>
+
+#include "mat.h"
+
+/**
+* Cholesky factorization A = L * L^T of a symmetric positive-definite matrix,
+* such as a covariance matrix. Factoring costs about half as much as the LU
+* factorization behind Matrix::operator~, and the factor is kept so that
+* solves, the inverse and the log-determinant reuse it. Only the lower
+* triangle of the input is read; symmetry is assumed, not checked.
+*
+* The templates are instantiated for float, double and long double; Cholesky
+* is BasicCholesky<double>.
+*/
+template <class T>
+class BasicCholesky {
+private:
+    BasicMatrix<T> l; //< L in the lower triangle, zeros above the diagonal
+public:
+    using value_type = T;
+    /**
+    * \brief Factors a square matrix or view.
+    * \throw std::invalid_argument if the matrix is not square.
+    * \throw std::runtime_error if the matrix is not positive definite; the message names the failing pivot.
+    */
+    explicit BasicCholesky(const BasicConstMatrixView<T>& a);
+    explicit BasicCholesky(const BasicMatrix<T>& a) : BasicCholesky(a.view()) {}
+    /**
+    * \brief Returns the order of the factored matrix.
+    */
+    size_t size() const { return l.rows(); }
+    /**
+    * \brief Returns the lower triangular factor L.
+    */
+    const BasicMatrix<T>& factor() const { return l; }
+    /**
+    * \brief Solves A * X = B by forward and back substitution with L.
+    * \throw std::invalid_argument if B does not have size() rows.
+    */
+    BasicMatrix<T> solve(const BasicConstMatrixView<T>& b) const;
+    BasicMatrix<T> solve(const BasicMatrix<T>& b) const { return solve(b.view()); }
+    std::vector<T> solve(const std::vector<T>& b) const;
+    /**
+    * \brief Returns A^-1.
+    */
+    BasicMatrix<T> inverse() const;
+    /**
+    * \brief Returns log(det(A)) = 2 * sum(log(L_ii)), which does not overflow for large matrices.
+    */
+    T logdet() const;
+    /**
+    * \brief Refactors A + x * x^T in O(n^2) with Givens-like rotations.
+    * \throw std::invalid_argument if x does not have size() elements.
+    */
+    void update(const std::vector<T>& x);
+    /**
+    * \brief Refactors A - x * x^T in O(n^2); the factor is unchanged if this throws.
+    * \throw std::invalid_argument if x does not have size() elements.
+    * \throw std::runtime_error if A - x * x^T is not positive definite.
+    */
+    void downdate(const std::vector<T>& x);
+};
+
+using Cholesky = BasicCholesky<double>;
+
+extern template class BasicCholesky<float>;
+extern template class BasicCholesky<double>;
+extern template class BasicCholesky<long double>;
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef MAT_EVAL_H
+#define MAT_EVAL_H
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include "mat.h"
+
+/**
+* Parsing and evaluation of matrix expressions such as "(A + B) * ~C - 2 * !D".
+*
+* Grammar, from lowest to highest precedence:
+*
+*     expr    := expr ('+' | '-') expr     left associative
+*              | expr '*' expr             left associative, binds tighter than + and -
+*              | ('!' | '~' | '*' | '-') expr
+*              | name | number | '(' expr ')'
+*
+* Prefix '!' transposes, '~' inverts, '*' takes the determinant and '-'
+* negates; prefix operators bind tighter than any binary one. Names start
+* with a letter or '_' and may contain digits. Whitespace is ignored.
+*/
+
+struct ExprNode;
+using ExprPtr = std::shared_ptr<const ExprNode>;
+
+/**
+* A node of the expression tree. Nodes are immutable once built, so subtrees may be shared.
+*/
+struct ExprNode {
+    enum class Op { matrix, number, add, sub, mul, neg, transpose, inverse, determinant };
+
+    Op op;
+    std::string name; //< Matrix name for Op::matrix
+    double value = 0; //< Literal for Op::number
+    std::vector<ExprPtr> args; //< Two operands for binary nodes, one for unary nodes
+};
+
+/**
+* \brief Parses an expression into a tree.
+* \param text The expression.
+* \return The root of the tree.
+* \throw std::invalid_argument on a syntax error, or if parentheses and operators
+* nest more than 1000 levels deep; the message contains the offending position.
+*/
+ExprPtr parse_expression(const std::string& text);
+
+/**
+* \brief Prints a tree fully parenthesized, e.g. "((A + B) * !(C))".
+*/
+std::string to_string(const ExprNode& node);
+
+/**
+* The result of an evaluation: determinants and literals are scalars, everything else a Matrix.
+*/
+using ExprValue = std::variant<double, Matrix>;
+
+/**
+* Resolves a matrix name to its value; should throw for unknown names.
+*/
+using MatrixLookup = std::function<const Matrix&(const std::string& name)>;
+
+/**
+* Counters filled in by evaluate.
+*/
+struct EvalStats {
+    double gemm_flops = 0; //< FLOP estimate of all matrix products, in the order actually used
+    size_t products = 0; //< Number of matrix-matrix products performed
+    size_t reused = 0; //< Subexpressions whose result was reused instead of computed
+    bool parallel = false; //< Whether independent subexpressions ran concurrently
+};
+
+/**
+* Evaluations estimated at fewer flops than this always run on the calling
+* thread; below it, waking the pool costs more than the overlap saves.
+*/
+constexpr double eval_parallel_flops = 4.0 * 1024 * 1024;
+
+/**
+* Hash-consing table and result cache for evaluate.
+*
+* intern() maps structurally equal subtrees to one canonical node, keyed by
+* operator, name or literal, and the identity of the canonical operands, so
+* equal subexpressions of all interned expressions share a node. A node used
+* by more than one parent, or both as a root and as an operand, is shared:
+* evaluate computes it once and does not fold it into an enclosing product
+* chain. "A*B+C" and "A*B-D" share the node A*B.
+*
+* Results of shared nodes and of expensive ones (products, inverses,
+* determinants) are kept in an LRU cache bounded by a memory budget, so a
+* later evaluation reuses them. Names are assumed to denote the same matrix
+* as long as the cache lives; call clear() after changing one. Not thread-safe.
+*
+* The budget covers cached results only. Interned nodes and their use counts
+* grow with every new expression and are kept by clear(); a long-lived cache
+* that sees an unbounded stream of distinct expressions should call reset()
+* from time to time.
+*/
+class ExprCache {
+public:
+    using Result = std::variant<double, std::shared_ptr<const Matrix>>;
+
+    static constexpr size_t default_budget = size_t(256) << 20;
+
+    /**
+    * \param budget Bytes of results to keep; 0 keeps none but still hash-conses.
+    */
+    explicit ExprCache(size_t budget = default_budget);
+    /**
+    * \brief Returns the canonical node of a tree, interning its subtrees, and marks it as a root.
+    */
+    ExprPtr intern(const ExprPtr& expr);
+    /**
+    * \brief Whether a canonical node is used more than once among the interned expressions.
+    */
+    bool shared(const ExprNode& node) const;
+    /**
+    * \brief Whether a result is cached for a canonical node; does not count as a lookup.
+    */
+    bool contains(const ExprNode& node) const { return entries.count(&node) != 0; }
+    /**
+    * \brief Returns the cached result of a canonical node and marks it most recently used, or nullptr.
+    */
+    const Result* find(const ExprNode& node);
+    /**
+    * \brief Caches the result of a canonical node, evicting least recently used results to fit the budget.
+    * A result larger than the whole budget is not cached.
+    */
+    void insert(const ExprNode& node, Result value);
+    /**
+    * \brief Drops all cached results; interned nodes are kept.
+    */
+    void clear();
+    /**
+    * \brief Drops the cached results and the interned nodes with their use counts.
+    * Trees interned before stay valid and are interned anew when evaluated again.
+    */
+    void reset();
+    size_t budget() const { return limit; }
+    size_t bytes() const { return used; } //< Bytes of cached results
+    size_t size() const { return entries.size(); } //< Number of cached results
+    size_t interned() const { return nodes.size(); } //< Number of interned nodes
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+
+private:
+    struct Key {
+        ExprNode::Op op;
+        std::string name;
+        double value;
+        const ExprNode* lhs;
+        const ExprNode* rhs;
+        bool operator==(const Key& other) const;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+    struct Entry {
+        Result value;
+        size_t bytes;
+        std::list<const ExprNode*>::iterator pos; //< Place in the recency list
+    };
+
+    std::unordered_map<Key, ExprPtr, KeyHash> nodes; //< Canonical nodes
+    std::unordered_map<const ExprNode*, size_t> uses; //< Parents of each canonical node, plus one if it is a root
+    std::unordered_set<const ExprNode*> roots;
+    std::list<const ExprNode*> recency; //< Cached nodes, most recently used first
+    std::unordered_map<const ExprNode*, Entry> entries;
+    size_t limit;
+    size_t used = 0;
+    size_t hit_count = 0;
+    size_t miss_count = 0;
+
+    ExprPtr intern_node(const ExprPtr& node);
+};
+
+/**
+* \brief Evaluates a tree.
+* Nested products are flattened into one chain and multiplied in the
+* cheapest order (see mat_chain.h); scalar factors are applied once at the
+* end. Intermediate results are reused in place by the following
+* elementwise operation instead of being copied. The tree is hash-consed
+* first, so a subexpression that occurs several times is computed once.
+*
+* The distinct subexpressions form a dependency graph. When it has enough
+* independent work, such as the two products of (A*B) + (C*D) or many small
+* products, its nodes run concurrently on the thread pool, each product on
+* one thread (see mat_parallel::run_graph); when the graph is narrow and its
+* products large, nodes run one at a time and each product is threaded.
+* \param expr The tree to evaluate.
+* \param lookup Resolves matrix names.
+* \param stats If not null, receives counters about the evaluation.
+* \return The value of the expression.
+* \throw std::invalid_argument for operations whose operand shapes or kinds do not fit.
+* \throw std::runtime_error if a singular matrix is inverted.
+*/
+ExprValue evaluate(const ExprPtr& expr, const MatrixLookup& lookup, EvalStats* stats = nullptr);
+
+/**
+* \brief Evaluates a tree with a persistent cache: subexpressions shared with
+* expressions interned earlier are taken from the cache when present, and
+* shared or expensive results are added to it.
+* \throw Same as evaluate.
+*/
+ExprValue evaluate(const ExprPtr& expr, const MatrixLookup& lookup, ExprCache& cache, EvalStats* stats = nullptr);
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef MAT_EXPR_H
+#define MAT_EXPR_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "mat_kernels.h"
+
+/**
+* Expression templates for the elementwise Matrix operators.
+* operator+, operator- and multiplication by a scalar do not compute anything;
+* they return a small node that refers to (or owns) its operands. The whole
+* tree is evaluated in one pass when it is assigned to or used to construct a
+* Matrix, so a chain like A + B - C * 2.0 reads each input once and writes the
+* result once, with no intermediate matrices.
+*
+* Operand lvalues are captured by reference and temporaries by value, so an
+* expression stored with auto must not outlive the named matrices it uses.
+*/
+
+template <class T>
+class BasicMatrix;
+
+/**
+* The default dense matrix of doubles.
+*/
+using Matrix = BasicMatrix<double>;
+
+/**
+* Common non-template base used to recognise expression types.
+*/
+struct MatExprBase {};
+
+/**
+* CRTP base of every expression node and of Matrix itself.
+* A node E provides value_type, rows(), cols() and operator()(i, j).
+*/
+template <class E>
+struct MatExpr : MatExprBase {
+    const E& self() const { return static_cast<const E&>(*this); }
+};
+
+template <class T>
+struct is_mat_expr : std::is_base_of<MatExprBase, std::decay_t<T>> {};
+
+/**
+* Element type of an expression.
+*/
+template <class E>
+using expr_value_t = typename std::decay_t<E>::value_type;
+
+/**
+* Marks dense types that own their elements; lvalues of these are captured by reference.
+*/
+template <class T>
+struct is_mat_leaf : std::false_type {};
+
+template <class T>
+struct is_mat_leaf<BasicMatrix<T>> : std::true_type {};
+
+/**
+* A non-owning reference to a leaf matrix inside an expression.
+*/
+template <class M>
+class MatRef : public MatExpr<MatRef<M>> {
+    const M* m;
+public:
+    using value_type = typename M::value_type;
+    explicit MatRef(const M& m) : m(&m) {}
+    size_t rows() const { return m->rows(); }
+    size_t cols() const { return m->cols(); }
+    value_type operator()(size_t i, size_t j) const { return (*m)(i, j); }
+    const M& get() const { return *m; }
+};
+
+/**
+* Storage type of an operand inside a node: lvalue leaves become a MatRef,
+* temporaries and nested nodes are held by value.
+*/
+template <class T, bool Leaf = is_mat_leaf<std::decay_t<T>>::value>
+struct expr_operand {
+    using type = std::decay_t<T>;
+};
+
+template <class T>
+struct expr_operand<T&, true> {
+    using type = MatRef<std::decay_t<T>>;
+};
+
+template <class T>
+using expr_operand_t = typename expr_operand<T>::type;
+
+/**
+* True for operands that are a dense matrix, either held or referenced.
+*/
+template <class T>
+struct is_leaf_operand : is_mat_leaf<T> {};
+
+template <class M>
+struct is_leaf_operand<MatRef<M>> : std::true_type {};
+
+/**
+* Marks non-owning block views (see mat_view.h); they are small and held by value.
+*/
+template <class T>
+struct is_mat_view : std::false_type {};
+
+/**
+* True for operands whose elements sit in a strided row-major buffer: leaves and views.
+*/
+template <class T>
+struct is_dense_operand : std::bool_constant<is_leaf_operand<T>::value || is_mat_view<T>::value> {};
+
+template <class M>
+const M& leaf_of(const MatRef<M>& r) { return r.get(); }
+
+template <class M, class = std::enable_if_t<is_mat_leaf<M>::value>>
+const M& leaf_of(const M& m) { return m; }
+
+struct AddOp {
+    template <class T>
+    static constexpr auto kernel = &mat_kernels::BasicElementwiseKernels<T>::add;
+    template <class T>
+    static T apply(T a, T b) { return a + b; }
+};
+
+struct SubOp {
+    template <class T>
+    static constexpr auto kernel = &mat_kernels::BasicElementwiseKernels<T>::sub;
+    template <class T>
+    static T apply(T a, T b) { return a - b; }
+};
+
+/**
+* Elementwise binary node; the operand shapes are checked when the node is built.
+*/
+template <class L, class R, class Op>
+class MatBinary : public MatExpr<MatBinary<L, R, Op>> {
+    static_assert(std::is_same<typename L::value_type, typename R::value_type>::value,
+                  "Operands of an elementwise operation must have the same element type.");
+    L l;
+    R r;
+public:
+    using op_type = Op;
+    using value_type = typename L::value_type;
+    /**
+    * \brief Builds the node.
+    * \throw std::invalid_argument if the dimensions do not match.
+    */
+    MatBinary(L lhs, R rhs) : l(std::move(lhs)), r(std::move(rhs)) {
+        if (l.rows() != r.rows() || l.cols() != r.cols()) {
+            throw std::invalid_argument("Matrix dimensions must agree.");
+        }
+    }
+    size_t rows() const { return l.rows(); }
+    size_t cols() const { return l.cols(); }
+    value_type operator()(size_t i, size_t j) const { return Op::template apply<value_type>(l(i, j), r(i, j)); }
+    const L& lhs() const { return l; }
+    const R& rhs() const { return r; }
+};
+
+/**
+* Multiplication of an expression by a scalar.
+*/
+template <class E>
+class MatScaled : public MatExpr<MatScaled<E>> {
+public:
+    using value_type = typename E::value_type;
+private:
+    E e;
+    value_type s;
+public:
+    MatScaled(E expr, value_type scalar) : e(std::move(expr)), s(scalar) {}
+    size_t rows() const { return e.rows(); }
+    size_t cols() const { return e.cols(); }
+    value_type operator()(size_t i, size_t j) const { return e(i, j) * s; }
+    const E& expr() const { return e; }
+    value_type scalar() const { return s; }
+};
+
+/**
+* A non-owning transposed view of a leaf matrix, returned by Matrix::transposed().
+* Element (i, j) of the view is element (j, i) of the matrix. Products read
+* the matrix in place through swapped strides, and only constructing or
+* assigning a Matrix from the view copies the data.
+*/
+template <class M>
+class MatTransposed : public MatExpr<MatTransposed<M>> {
+    const M* m;
+public:
+    using value_type = typename M::value_type;
+    explicit MatTransposed(const M& m) : m(&m) {}
+    size_t rows() const { return m->cols(); }
+    size_t cols() const { return m->rows(); }
+    value_type operator()(size_t i, size_t j) const { return (*m)(j, i); }
+    const M& get() const { return *m; }
+};
+
+template <class T>
+struct is_mat_transposed : std::false_type {};
+
+template <class M>
+struct is_mat_transposed<MatTransposed<M>> : std::true_type {};
+
+/**
+* Nodes that map onto a single dispatched kernel call when evaluated; only
+* element types with vectorized kernels (see mat_kernels.h) qualify.
+*/
+template <class E>
+struct is_kernel_binary : std::false_type {};
+
+template <class L, class R, class Op>
+struct is_kernel_binary<MatBinary<L, R, Op>>
+    : std::bool_constant<is_dense_operand<L>::value && is_dense_operand<R>::value &&
+                         mat_kernels::has_elementwise_kernels<typename L::value_type>> {};
+
+template <class E>
+struct is_kernel_scaled : std::false_type {};
+
+template <class E>
+struct is_kernel_scaled<MatScaled<E>>
+    : std::bool_constant<is_dense_operand<E>::value && mat_kernels::has_elementwise_kernels<typename E::value_type>> {};
+
+template <class L, class R>
+using enable_if_exprs_t = std::enable_if_t<is_mat_expr<L>::value && is_mat_expr<R>::value>;
+
+/**
+* \brief Adds two matrices or expressions lazily.
+* \return An expression node evaluated on assignment to a Matrix.
+* \throw std::invalid_argument if the dimensions do not match.
+*/
+template <class L, class R, class = enable_if_exprs_t<L, R>>
+MatBinary<expr_operand_t<L>, expr_operand_t<R>, AddOp> operator+(L&& l, R&& r) {
+    return {expr_operand_t<L>(std::forward<L>(l)), expr_operand_t<R>(std::forward<R>(r))};
+}
+
+/**
+* \brief Subtracts one matrix or expression from another lazily.
+* \return An expression node evaluated on assignment to a Matrix.
+* \throw std::invalid_argument if the dimensions do not match.
+*/
+template <class L, class R, class = enable_if_exprs_t<L, R>>
+MatBinary<expr_operand_t<L>, expr_operand_t<R>, SubOp> operator-(L&& l, R&& r) {
+    return {expr_operand_t<L>(std::forward<L>(l)), expr_operand_t<R>(std::forward<R>(r))};
+}
+
+/**
+* \brief Multiplies a matrix or expression by a scalar lazily.
+* The scalar is converted to the element type of the expression.
+* \return An expression node evaluated on assignment to a Matrix.
+*/
+template <class E, class = std::enable_if_t<is_mat_expr<E>::value>>
+MatScaled<expr_operand_t<E>> operator*(E&& e, expr_value_t<E> scalar) {
+    return {expr_operand_t<E>(std::forward<E>(e)), scalar};
+}
+
+template <class E, class = std::enable_if_t<is_mat_expr<E>::value>>
+MatScaled<expr_operand_t<E>> operator*(expr_value_t<E> scalar, E&& e) {
+    return {expr_operand_t<E>(std::forward<E>(e)), scalar};
+}
+
+#endif
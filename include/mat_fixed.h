@@ -0,0 +1,373 @@
+#ifndef MAT_FIXED_H
+#define MAT_FIXED_H
+
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "mat.h"
+#include "mat_kernels.h"
+
+/**
+* Matrices whose shape is part of the type.
+* FixedMatrix<R, C, T> keeps its R * C elements inline (no heap allocation),
+* all loops run over compile-time bounds and are unrolled, and operations on
+* operands of incompatible shapes do not compile instead of throwing. Every
+* operation is constexpr. Meant for small transforms such as 2x2 to 4x4;
+* determinants and inverses use closed forms up to order 4 and Gaussian
+* elimination with partial pivoting above that.
+*/
+
+namespace fixed_detail {
+
+    /**
+    * Calls f(std::integral_constant<size_t, I>) for I = 0..N-1 as an unrolled sequence.
+    */
+    template <class F, size_t... I>
+    constexpr void unroll(F&& f, std::index_sequence<I...>) {
+        (f(std::integral_constant<size_t, I>{}), ...);
+    }
+
+    template <size_t N, class F>
+    constexpr void unroll(F&& f) {
+        unroll(f, std::make_index_sequence<N>{});
+    }
+
+    /**
+    * Magnitude of an element as its real type; std::abs is not constexpr, so
+    * only complex elements go through it.
+    */
+    template <class T>
+    constexpr mat_kernels::real_type_t<T> abs(const T& x) {
+        if constexpr (std::is_same_v<T, mat_kernels::real_type_t<T>>) {
+            return x < T(0) ? -x : x;
+        } else {
+            return std::abs(x);
+        }
+    }
+
+    /**
+    * std::swap is not constexpr before C++20.
+    */
+    template <class T>
+    constexpr void swap(T& a, T& b) {
+        T t = a;
+        a = b;
+        b = t;
+    }
+
+}
+
+template <size_t R, size_t C, class T = double>
+class FixedMatrix {
+    static_assert(R > 0 && C > 0, "FixedMatrix dimensions must be positive.");
+    std::array<T, R * C> a{}; //< Row-major elements
+public:
+    using value_type = T;
+
+    /**
+    * \brief Constructs a zero matrix.
+    */
+    constexpr FixedMatrix() = default;
+    /**
+    * \brief Constructs a matrix from exactly R * C values given row by row.
+    */
+    template <class... Args, class = std::enable_if_t<sizeof...(Args) == R * C && (std::is_convertible_v<Args, T> && ...)>>
+    constexpr FixedMatrix(Args... values) : a{static_cast<T>(values)...} {}
+    /**
+    * \brief Copies a dynamic matrix or view of the same shape, converting the elements to T.
+    * \throw std::invalid_argument if the shape is not R x C.
+    */
+    template <class U>
+    explicit FixedMatrix(const BasicConstMatrixView<U>& m) {
+        if (m.rows() != R || m.cols() != C) {
+            throw std::invalid_argument("Matrix dimensions must agree.");
+        }
+        for (size_t i = 0; i < R; ++i) {
+            for (size_t j = 0; j < C; ++j) {
+                (*this)(i, j) = static_cast<T>(m(i, j));
+            }
+        }
+    }
+    template <class U>
+    explicit FixedMatrix(const BasicMatrixView<U>& m) : FixedMatrix(BasicConstMatrixView<U>(m)) {}
+    template <class U>
+    explicit FixedMatrix(const BasicMatrix<U>& m) : FixedMatrix(m.view()) {}
+
+    /**
+    * \brief Returns the identity matrix.
+    */
+    static constexpr FixedMatrix identity() {
+        static_assert(R == C, "Only square matrices have an identity.");
+        FixedMatrix r;
+        fixed_detail::unroll<R>([&](auto i) { r(i, i) = T(1); });
+        return r;
+    }
+
+    static constexpr size_t rows() { return R; }
+    static constexpr size_t cols() { return C; }
+    constexpr T& operator()(size_t i, size_t j) { return a[i * C + j]; }
+    constexpr const T& operator()(size_t i, size_t j) const { return a[i * C + j]; }
+    constexpr T* data() { return a.data(); }
+    constexpr const T* data() const { return a.data(); }
+
+    /**
+    * \brief Copies the elements into a heap-allocated dynamic matrix, a Matrix of doubles by default.
+    */
+    template <class U = double>
+    BasicMatrix<U> to_matrix() const {
+        BasicMatrix<U> m(R, C);
+        for (size_t i = 0; i < R; ++i) {
+            for (size_t j = 0; j < C; ++j) {
+                m(i, j) = static_cast<U>((*this)(i, j));
+            }
+        }
+        return m;
+    }
+
+    constexpr FixedMatrix& operator+=(const FixedMatrix& o) {
+        fixed_detail::unroll<R * C>([&](auto k) { a[k] += o.a[k]; });
+        return *this;
+    }
+    constexpr FixedMatrix& operator-=(const FixedMatrix& o) {
+        fixed_detail::unroll<R * C>([&](auto k) { a[k] -= o.a[k]; });
+        return *this;
+    }
+    constexpr FixedMatrix& operator*=(T s) {
+        fixed_detail::unroll<R * C>([&](auto k) { a[k] *= s; });
+        return *this;
+    }
+
+    friend constexpr FixedMatrix operator+(FixedMatrix l, const FixedMatrix& r) { return l += r; }
+    friend constexpr FixedMatrix operator-(FixedMatrix l, const FixedMatrix& r) { return l -= r; }
+    friend constexpr FixedMatrix operator*(FixedMatrix m, T s) { return m *= s; }
+    friend constexpr FixedMatrix operator*(T s, FixedMatrix m) { return m *= s; }
+    friend constexpr FixedMatrix operator-(FixedMatrix m) { return m *= T(-1); }
+
+    friend constexpr bool operator==(const FixedMatrix& l, const FixedMatrix& r) {
+        bool eq = true;
+        fixed_detail::unroll<R * C>([&](auto k) { eq = eq && l.a[k] == r.a[k]; });
+        return eq;
+    }
+    friend constexpr bool operator!=(const FixedMatrix& l, const FixedMatrix& r) { return !(l == r); }
+
+    friend std::ostream& operator<<(std::ostream& os, const FixedMatrix& m) {
+        for (size_t i = 0; i < R; ++i) {
+            for (size_t j = 0; j < C; ++j) {
+                os << m(i, j) << " ";
+            }
+            os << '\n';
+        }
+        return os;
+    }
+};
+
+/**
+* \brief Multiplies an R x K by a K x C matrix; other shapes do not compile.
+*/
+template <size_t R, size_t K, size_t C, class T>
+constexpr FixedMatrix<R, C, T> operator*(const FixedMatrix<R, K, T>& x, const FixedMatrix<K, C, T>& y) {
+    FixedMatrix<R, C, T> r;
+    fixed_detail::unroll<R * C>([&](auto ij) {
+        constexpr size_t i = decltype(ij)::value / C;
+        constexpr size_t j = decltype(ij)::value % C;
+        T sum{};
+        fixed_detail::unroll<K>([&](auto k) { sum += x(i, k) * y(k, j); });
+        r(i, j) = sum;
+    });
+    return r;
+}
+
+/**
+* \brief Returns the transpose.
+*/
+template <size_t R, size_t C, class T>
+constexpr FixedMatrix<C, R, T> operator!(const FixedMatrix<R, C, T>& m) {
+    FixedMatrix<C, R, T> r;
+    fixed_detail::unroll<R * C>([&](auto ij) {
+        constexpr size_t i = decltype(ij)::value / C;
+        constexpr size_t j = decltype(ij)::value % C;
+        r(j, i) = m(i, j);
+    });
+    return r;
+}
+
+namespace fixed_detail {
+
+    template <size_t N, class T>
+    constexpr mat_kernels::real_type_t<T> max_abs(const FixedMatrix<N, N, T>& m) {
+        mat_kernels::real_type_t<T> r{};
+        unroll<N * N>([&](auto k) {
+            const auto v = abs(m.data()[k]);
+            r = v > r ? v : r;
+        });
+        return r;
+    }
+
+    /**
+    * A closed-form determinant is treated as zero when it is not larger than
+    * N * epsilon * max|a_ij|^N, the same scale-free test as the LU pivots of Matrix.
+    */
+    template <size_t N, class T>
+    constexpr bool negligible_det(T det, const FixedMatrix<N, N, T>& m) {
+        using Real = mat_kernels::real_type_t<T>;
+        Real scale = static_cast<Real>(N) * std::numeric_limits<Real>::epsilon();
+        const Real mx = max_abs(m);
+        for (size_t i = 0; i < N; ++i) {
+            scale *= mx;
+        }
+        return !(abs(det) > scale);
+    }
+
+    /**
+    * Gauss-Jordan elimination with partial pivoting on [m | rhs]; rhs
+    * becomes m^-1 * rhs. Returns the determinant of m. Without rhs only the
+    * entries below the diagonal are eliminated and a zero pivot column gives
+    * 0; with rhs a pivot not above the singularity tolerance returns 0 and
+    * leaves rhs unspecified.
+    */
+    template <size_t N, size_t M, class T>
+    constexpr T gauss_jordan(FixedMatrix<N, N, T> m, FixedMatrix<N, M, T>* rhs) {
+        using Real = mat_kernels::real_type_t<T>;
+        const Real tol = static_cast<Real>(N) * std::numeric_limits<Real>::epsilon() * max_abs(m);
+        T det = T(1);
+        for (size_t k = 0; k < N; ++k) {
+            size_t p = k;
+            for (size_t i = k + 1; i < N; ++i) {
+                if (abs(m(i, k)) > abs(m(p, k))) {
+                    p = i;
+                }
+            }
+            if (m(p, k) == T(0) || (rhs != nullptr && !(abs(m(p, k)) > tol))) {
+                return T(0);
+            }
+            if (p != k) {
+                det = -det;
+                for (size_t j = 0; j < N; ++j) {
+                    fixed_detail::swap(m(k, j), m(p, j));
+                }
+                if (rhs != nullptr) {
+                    for (size_t j = 0; j < M; ++j) {
+                        fixed_detail::swap((*rhs)(k, j), (*rhs)(p, j));
+                    }
+                }
+            }
+            det *= m(k, k);
+            for (size_t i = 0; i < N; ++i) {
+                if (i == k || (rhs == nullptr && i < k)) {
+                    continue;
+                }
+                const T l = m(i, k) / m(k, k);
+                for (size_t j = k; j < N; ++j) {
+                    m(i, j) -= l * m(k, j);
+                }
+                if (rhs != nullptr) {
+                    for (size_t j = 0; j < M; ++j) {
+                        (*rhs)(i, j) -= l * (*rhs)(k, j);
+                    }
+                }
+            }
+        }
+        if (rhs != nullptr) {
+            for (size_t i = 0; i < N; ++i) {
+                for (size_t j = 0; j < M; ++j) {
+                    (*rhs)(i, j) /= m(i, i);
+                }
+            }
+        }
+        return det;
+    }
+
+}
+
+/**
+* \brief Returns the determinant of a square matrix.
+*/
+template <size_t N, class T>
+constexpr T operator*(const FixedMatrix<N, N, T>& m) {
+    if constexpr (N == 1) {
+        return m(0, 0);
+    } else if constexpr (N == 2) {
+        return m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0);
+    } else if constexpr (N == 3) {
+        return m(0, 0) * (m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1)) +
+               m(0, 1) * (m(1, 2) * m(2, 0) - m(1, 0) * m(2, 2)) +
+               m(0, 2) * (m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0));
+    } else if constexpr (N == 4) {
+        // Laplace expansion along the first two rows: 2x2 minors of the top and bottom halves.
+        const T s0 = m(0, 0) * m(1, 1) - m(1, 0) * m(0, 1);
+        const T s1 = m(0, 0) * m(1, 2) - m(1, 0) * m(0, 2);
+        const T s2 = m(0, 0) * m(1, 3) - m(1, 0) * m(0, 3);
+        const T s3 = m(0, 1) * m(1, 2) - m(1, 1) * m(0, 2);
+        const T s4 = m(0, 1) * m(1, 3) - m(1, 1) * m(0, 3);
+        const T s5 = m(0, 2) * m(1, 3) - m(1, 2) * m(0, 3);
+        const T c5 = m(2, 2) * m(3, 3) - m(3, 2) * m(2, 3);
+        const T c4 = m(2, 1) * m(3, 3) - m(3, 1) * m(2, 3);
+        const T c3 = m(2, 1) * m(3, 2) - m(3, 1) * m(2, 2);
+        const T c2 = m(2, 0) * m(3, 3) - m(3, 0) * m(2, 3);
+        const T c1 = m(2, 0) * m(3, 2) - m(3, 0) * m(2, 2);
+        const T c0 = m(2, 0) * m(3, 1) - m(3, 0) * m(2, 1);
+        return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    } else {
+        return fixed_detail::gauss_jordan<N, 1, T>(m, nullptr);
+    }
+}
+
+/**
+* \brief Returns the inverse of a square matrix.
+* \throw std::runtime_error if the matrix is singular to working precision.
+*/
+template <size_t N, class T>
+constexpr FixedMatrix<N, N, T> operator~(const FixedMatrix<N, N, T>& m) {
+    FixedMatrix<N, N, T> r;
+    if constexpr (N <= 4) {
+        const T det = *m;
+        if (fixed_detail::negligible_det(det, m)) {
+            throw std::runtime_error("Matrix is singular and cannot be inverted.");
+        }
+        const T inv = T(1) / det;
+        if constexpr (N == 1) {
+            r(0, 0) = inv;
+        } else if constexpr (N == 2) {
+            r = FixedMatrix<2, 2, T>(m(1, 1), -m(0, 1), -m(1, 0), m(0, 0)) * inv;
+        } else if constexpr (N == 3) {
+            r = FixedMatrix<3, 3, T>(
+                m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1), m(0, 2) * m(2, 1) - m(0, 1) * m(2, 2), m(0, 1) * m(1, 2) - m(0, 2) * m(1, 1),
+                m(1, 2) * m(2, 0) - m(1, 0) * m(2, 2), m(0, 0) * m(2, 2) - m(0, 2) * m(2, 0), m(0, 2) * m(1, 0) - m(0, 0) * m(1, 2),
+                m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0), m(0, 1) * m(2, 0) - m(0, 0) * m(2, 1), m(0, 0) * m(1, 1) - m(0, 1) * m(1, 0)) * inv;
+        } else {
+            const T s0 = m(0, 0) * m(1, 1) - m(1, 0) * m(0, 1);
+            const T s1 = m(0, 0) * m(1, 2) - m(1, 0) * m(0, 2);
+            const T s2 = m(0, 0) * m(1, 3) - m(1, 0) * m(0, 3);
+            const T s3 = m(0, 1) * m(1, 2) - m(1, 1) * m(0, 2);
+            const T s4 = m(0, 1) * m(1, 3) - m(1, 1) * m(0, 3);
+            const T s5 = m(0, 2) * m(1, 3) - m(1, 2) * m(0, 3);
+            const T c5 = m(2, 2) * m(3, 3) - m(3, 2) * m(2, 3);
+            const T c4 = m(2, 1) * m(3, 3) - m(3, 1) * m(2, 3);
+            const T c3 = m(2, 1) * m(3, 2) - m(3, 1) * m(2, 2);
+            const T c2 = m(2, 0) * m(3, 3) - m(3, 0) * m(2, 3);
+            const T c1 = m(2, 0) * m(3, 2) - m(3, 0) * m(2, 2);
+            const T c0 = m(2, 0) * m(3, 1) - m(3, 0) * m(2, 1);
+            r = FixedMatrix<4, 4, T>(
+                m(1, 1) * c5 - m(1, 2) * c4 + m(1, 3) * c3, -m(0, 1) * c5 + m(0, 2) * c4 - m(0, 3) * c3,
+                m(3, 1) * s5 - m(3, 2) * s4 + m(3, 3) * s3, -m(2, 1) * s5 + m(2, 2) * s4 - m(2, 3) * s3,
+                -m(1, 0) * c5 + m(1, 2) * c2 - m(1, 3) * c1, m(0, 0) * c5 - m(0, 2) * c2 + m(0, 3) * c1,
+                -m(3, 0) * s5 + m(3, 2) * s2 - m(3, 3) * s1, m(2, 0) * s5 - m(2, 2) * s2 + m(2, 3) * s1,
+                m(1, 0) * c4 - m(1, 1) * c2 + m(1, 3) * c0, -m(0, 0) * c4 + m(0, 1) * c2 - m(0, 3) * c0,
+                m(3, 0) * s4 - m(3, 1) * s2 + m(3, 3) * s0, -m(2, 0) * s4 + m(2, 1) * s2 - m(2, 3) * s0,
+                -m(1, 0) * c3 + m(1, 1) * c1 - m(1, 2) * c0, m(0, 0) * c3 - m(0, 1) * c1 + m(0, 2) * c0,
+                -m(3, 0) * s3 + m(3, 1) * s1 - m(3, 2) * s0, m(2, 0) * s3 - m(2, 1) * s1 + m(2, 2) * s0) * inv;
+        }
+    } else {
+        r = FixedMatrix<N, N, T>::identity();
+        if (fixed_detail::gauss_jordan(m, &r) == T(0)) {
+            throw std::runtime_error("Matrix is singular and cannot be inverted.");
+        }
+    }
+    return r;
+}
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef MAT_IO_H
+#define MAT_IO_H
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "mat.h"
+
+/**
+* Reading and writing matrices: a binary file format with zero-copy mapping,
+* and delimited text.
+*
+* Binary matrix files.
+*
+* Layout of version 1: a 64-byte header, then the elements row by row with
+* no padding, starting at data_offset. Header fields are little-endian:
+*
+*     offset  size  field
+*          0     8  magic "\x89MAT\r\n\x1a\n"
+*          8     2  version (1)
+*         10     1  dtype (Dtype)
+*         11     1  byte order of the elements: 0 little-endian, 1 big-endian
+*         12     4  alignment: data_offset is a multiple of it (64)
+*         16     8  rows
+*         24     8  cols
+*         32     8  data_offset
+*         40     8  checksum: XXH64 (seed 0) of the element bytes as stored
+*         48    16  reserved, zero
+*
+* Elements are written in the byte order of the machine that wrote them, so
+* a file written and read on the same kind of machine maps directly into
+* memory. Since mmap returns page-aligned memory, the elements of a mapped
+* file start on a cache line like those of a Matrix.
+*/
+
+/**
+* Element types a matrix file can hold.
+*/
+enum class Dtype : std::uint8_t { f32 = 1, f64 = 2, c128 = 3 };
+
+template <class T>
+struct dtype_of;
+
+template <>
+struct dtype_of<float> { static constexpr Dtype value = Dtype::f32; };
+
+template <>
+struct dtype_of<double> { static constexpr Dtype value = Dtype::f64; };
+
+template <>
+struct dtype_of<std::complex<double>> { static constexpr Dtype value = Dtype::c128; };
+
+/**
+* \brief Returns the printable name of a dtype: float32, float64 or complex128.
+*/
+const char* dtype_name(Dtype dtype);
+
+/**
+* Decoded header of a matrix file.
+*/
+struct BinaryHeader {
+    std::uint16_t version;
+    Dtype dtype;
+    bool little_endian; //< Byte order of the elements
+    std::uint32_t alignment;
+    std::uint64_t rows;
+    std::uint64_t cols;
+    std::uint64_t data_offset;
+    std::uint64_t checksum;
+};
+
+/**
+* Streaming XXH64 hash, the checksum of matrix files. It detects corruption,
+* not tampering; it hashes several GB/s, so verifying is cheap next to the read.
+*/
+class Checksum {
+private:
+    std::uint64_t v[4]; //< Lane accumulators
+    unsigned char buf[32]; //< Bytes of an incomplete stripe
+    std::size_t buffered;
+    std::uint64_t total; //< Bytes hashed so far
+public:
+    Checksum();
+    /**
+    * \brief Hashes n more bytes; the digest does not depend on how the input is split.
+    */
+    void update(const void* data, std::size_t n);
+    /**
+    * \brief Returns the hash of all bytes so far.
+    */
+    std::uint64_t digest() const;
+};
+
+/**
+* \brief Reads and validates the header of a matrix file.
+* \throw std::runtime_error if the file cannot be read or is not a version 1 matrix file.
+*/
+BinaryHeader read_binary_header(const std::string& path);
+
+/**
+* Writes a matrix file row by row, for results too large to hold in memory.
+* The header is written by close(); until then the file has no valid magic,
+* so a file whose writer was abandoned is rejected by the readers instead of
+* being read as a truncated matrix.
+*/
+template <class T>
+class BasicMatrixWriter {
+private:
+    std::ofstream out;
+    std::string path;
+    size_t nrows, ncols;
+    size_t written; //< Rows written so far
+    Checksum sum;
+    bool closed;
+public:
+    /**
+    * \brief Creates or truncates the file for a rows x cols matrix.
+    * \throw std::runtime_error if a dimension is 0 or the file cannot be opened.
+    */
+    BasicMatrixWriter(const std::string& path, size_t rows, size_t cols);
+    BasicMatrixWriter(const BasicMatrixWriter&) = delete;
+    BasicMatrixWriter& operator=(const BasicMatrixWriter&) = delete;
+    /**
+    * \brief Closes the file without a header if close() was not called.
+    */
+    ~BasicMatrixWriter();
+    /**
+    * \brief Appends one row of cols() elements.
+    * \throw std::out_of_range if all rows have already been written.
+    * \throw std::runtime_error on a write error.
+    */
+    void write_row(const T* row);
+    /**
+    * \brief Appends the rows of a matrix or view.
+    * \throw std::invalid_argument if the view does not have cols() columns.
+    * \throw std::out_of_range if it has more rows than remain.
+    */
+    void write(const BasicConstMatrixView<T>& rows);
+    size_t rows() const { return nrows; }
+    size_t cols() const { return ncols; }
+    size_t rows_written() const { return written; }
+    /**
+    * \brief Writes the header and closes the file.
+    * \throw std::runtime_error if fewer than rows() rows were written, or on a write error.
+    */
+    void close();
+};
+
+using MatrixWriter = BasicMatrixWriter<double>;
+
+/**
+* \brief Writes a matrix or view to a matrix file.
+* \throw std::runtime_error if the file cannot be written.
+*/
+template <class T>
+void save_binary(const std::string& path, const BasicConstMatrixView<T>& m);
+
+template <class T>
+void save_binary(const std::string& path, const BasicMatrixView<T>& m) { save_binary(path, BasicConstMatrixView<T>(m)); }
+
+template <class T>
+void save_binary(const std::string& path, const BasicMatrix<T>& m) { save_binary(path, m.view()); }
+
+/**
+* \brief Reads a matrix file into a new matrix, converting the byte order if needed.
+* \throw std::runtime_error if the file is invalid, holds another dtype or fails the checksum.
+*/
+template <class T = double>
+BasicMatrix<T> load_binary(const std::string& path);
+
+/**
+* A read-only memory mapping of a file; the whole file is read into memory
+* on platforms without mmap.
+*/
+class MappedFile {
+private:
+    const unsigned char* ptr;
+    std::size_t length;
+    bool mapped; //< False when ptr is an owned copy
+public:
+    /**
+    * \throw std::runtime_error if the file cannot be opened or mapped.
+    */
+    explicit MappedFile(const std::string& path);
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+    const unsigned char* data() const { return ptr; }
+    std::size_t size() const { return length; }
+};
+
+/**
+* A matrix file mapped into memory and used in place: opening it reads
+* nothing but the header (and, when verifying, the checksum pass), and pages
+* are loaded by the OS as they are touched. view() plugs the elements into
+* every operation that accepts a const view, including expressions such as
+* Matrix C = mapped.view() * 2.0, without copying them.
+*
+* The file must hold elements of type T in the byte order of this machine;
+* use load_binary otherwise.
+*/
+template <class T>
+class BasicMappedMatrix {
+private:
+    MappedFile file;
+    BinaryHeader hdr;
+public:
+    using value_type = T;
+    /**
+    * \brief Maps a matrix file.
+    * \param verify Hash the elements and compare with the header checksum.
+    * \throw std::runtime_error if the file is invalid, holds another dtype or
+    * byte order, is shorter than its header says, or fails the checksum.
+    */
+    explicit BasicMappedMatrix(const std::string& path, bool verify = true);
+    size_t rows() const { return hdr.rows; }
+    size_t cols() const { return hdr.cols; }
+    const BinaryHeader& header() const { return hdr; }
+    const T* data() const { return reinterpret_cast<const T*>(file.data() + hdr.data_offset); }
+    T operator()(size_t i, size_t j) const { return data()[i * hdr.cols + j]; }
+    BasicConstMatrixView<T> view() const { return {data(), rows(), cols(), cols()}; }
+    /**
+    * \brief Copies the elements into a Matrix.
+    */
+    BasicMatrix<T> to_matrix() const;
+};
+
+using MappedMatrix = BasicMappedMatrix<double>;
+
+/**
+* Options of the text reader and writer.
+* Text holds one row per line with the elements separated by delimiter.
+* A space delimiter is read as any run of spaces and tabs; other delimiters
+* (',' for CSV, ';', '\t') separate exactly one field each, and spaces around
+* a field are ignored. Blank lines and a trailing '\r' are skipped.
+*/
+struct TextFormat {
+    char delimiter = ' ';
+    /**
+    * Significant digits written; 0 writes the shortest text that reads back
+    * to the same value (round-trip exact). At most max_digits10 of the
+    * element type (9 for float, 17 for double), beyond which digits carry
+    * no information.
+    */
+    int precision = 0;
+};
+
+/**
+* \brief Parses a matrix from delimited text with std::from_chars.
+* The stream is read in large blocks, and numbers are parsed in the C locale
+* whatever the locale of the stream. The number of rows and columns is taken
+* from the text.
+* \throw std::invalid_argument on a malformed number (the message gives the line and column)
+* or if the rows do not all have the same number of columns.
+* \throw std::runtime_error if the text holds no numbers.
+*/
+template <class T = double>
+BasicMatrix<T> read_text(std::istream& in, const TextFormat& format = {});
+
+/**
+* \brief Writes a matrix or view as delimited text with std::to_chars.
+* Output is assembled in a local buffer and handed to the stream in large
+* blocks, with no flush per row.
+* \throw std::invalid_argument if format.precision is negative or above max_digits10 of T.
+*/
+template <class T>
+void write_text(std::ostream& out, const BasicConstMatrixView<T>& m, const TextFormat& format = {});
+
+template <class T>
+void write_text(std::ostream& out, const BasicMatrixView<T>& m, const TextFormat& format = {}) {
+    write_text(out, BasicConstMatrixView<T>(m), format);
+}
+
+template <class T>
+void write_text(std::ostream& out, const BasicMatrix<T>& m, const TextFormat& format = {}) { write_text(out, m.view(), format); }
+
+/**
+* \brief Reads a text file with read_text.
+* \throw std::runtime_error if the file cannot be opened.
+*/
+template <class T = double>
+BasicMatrix<T> load_text(const std::string& path, const TextFormat& format = {});
+
+/**
+* \brief Writes a text file with write_text.
+* \throw std::runtime_error if the file cannot be written.
+*/
+template <class T>
+void save_text(const std::string& path, const BasicConstMatrixView<T>& m, const TextFormat& format = {});
+
+template <class T>
+void save_text(const std::string& path, const BasicMatrixView<T>& m, const TextFormat& format = {}) {
+    save_text(path, BasicConstMatrixView<T>(m), format);
+}
+
+template <class T>
+void save_text(const std::string& path, const BasicMatrix<T>& m, const TextFormat& format = {}) { save_text(path, m.view(), format); }
+
+extern template class BasicMatrixWriter<float>;
+extern template class BasicMatrixWriter<double>;
+extern template class BasicMatrixWriter<std::complex<double>>;
+extern template class BasicMappedMatrix<float>;
+extern template class BasicMappedMatrix<double>;
+extern template class BasicMappedMatrix<std::complex<double>>;
+
+#endif
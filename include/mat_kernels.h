@@ -0,0 +1,246 @@
+#ifndef MAT_KERNELS_H
+#define MAT_KERNELS_H
+
+#include <complex>
+#include <cstddef>
+#include <type_traits>
+
+/**
+* Low-level kernels behind the Matrix operators.
+* All routines work on raw row-major buffers described by a pointer and a
+* leading dimension, so they can be reused by any dense storage.
+*
+* The templates are instantiated for float, double, long double and
+* std::complex<double>, the element types of BasicMatrix.
+*/
+namespace mat_kernels {
+
+/**
+* The real type underlying an element type: T itself, or V for std::complex<V>.
+*/
+template <class T>
+struct real_type {
+    using type = T;
+};
+
+template <class T>
+struct real_type<std::complex<T>> {
+    using type = T;
+};
+
+template <class T>
+using real_type_t = typename real_type<T>::type;
+
+/**
+* Instruction set levels for which vectorized kernels exist, in increasing order.
+* The avx2 and avx512 levels include FMA.
+*/
+enum class Isa { scalar, sse2, avx2, avx512 };
+
+/**
+* Table of elementwise kernels over n contiguous elements of type T, all built for one Isa.
+* Tables exist for double and float.
+*/
+template <class T>
+struct BasicElementwiseKernels {
+    void (*add)(const T* a, const T* b, T* out, std::size_t n);
+    void (*sub)(const T* a, const T* b, T* out, std::size_t n);
+    void (*scale)(const T* a, T s, T* out, std::size_t n);
+    bool (*equal)(const T* a, const T* b, std::size_t n);
+};
+
+using ElementwiseKernels = BasicElementwiseKernels<double>;
+
+/**
+* True for element types that have vectorized elementwise kernels.
+*/
+template <class T>
+constexpr bool has_elementwise_kernels = std::is_same<T, double>::value || std::is_same<T, float>::value;
+
+/**
+* \brief Returns the instruction set selected for this process.
+* The best level supported by the CPU is picked on first use. Setting the
+* MAT_ISA environment variable to scalar, sse2, avx2 or avx512 caps the
+* selection at that level, which is meant for A/B benchmarking.
+*/
+Isa active_isa();
+
+/**
+* \brief Returns the printable name of an instruction set level.
+*/
+const char* isa_name(Isa isa);
+
+/**
+* \brief Returns the elementwise kernels for active_isa().
+* The template is defined for double and float.
+*/
+template <class T = double>
+const BasicElementwiseKernels<T>& elementwise();
+
+/**
+* \brief Returns the elementwise kernels for a given level, or nullptr when it was not compiled in.
+* Does not check that the CPU supports the level.
+*/
+template <class T = double>
+const BasicElementwiseKernels<T>* elementwise_for(Isa isa);
+
+/**
+* \brief Factors a square matrix in place as P * A = L * U with partial pivoting.
+* L is unit lower triangular and stored below the diagonal, U on and above it.
+* A zero pivot column is skipped, so singular input still factors completely
+* and shows up as a zero on the diagonal of U.
+* \param n Order of the matrix.
+* \param A Row-major n x n matrix with leading dimension lda, overwritten by L and U.
+* \param piv Receives n entries: row k was swapped with row piv[k] at step k.
+* \return The sign of the permutation P, +1 or -1.
+*/
+template <class T>
+int lu_factor(std::size_t n, T* A, std::size_t lda, std::size_t* piv);
+
+/**
+* Rows per block of the substitutions in lu_solve; the update of the
+* remaining rows by each solved block is one gemm call.
+*/
+constexpr std::size_t lu_solve_block = 64;
+
+/**
+* \brief Solves A * X = B in place using a factorization from lu_factor.
+* \param n Order of A.
+* \param nrhs Number of right-hand sides (columns of B).
+* \param LU Factored matrix with leading dimension lda.
+* \param piv Pivot indices from lu_factor.
+* \param B Row-major n x nrhs right-hand sides with leading dimension ldb, overwritten by X.
+*/
+template <class T>
+void lu_solve(std::size_t n, std::size_t nrhs, const T* LU, std::size_t lda,
+              const std::size_t* piv, T* B, std::size_t ldb);
+
+/**
+* \brief Returns the pivot magnitude below which a factored matrix is treated as singular.
+* Scales the machine epsilon of R by the order and by the largest entry of
+* the original matrix, so the test is independent of the units the matrix is
+* expressed in.
+* \param n Order of the matrix.
+* \param max_abs Largest absolute entry of the matrix before factoring.
+*/
+template <class R>
+R singular_tolerance(std::size_t n, R max_abs);
+
+/**
+* Order of the diagonal blocks of cholesky_factor; the trailing update of
+* each block column is a set of gemm calls on blocks of this size.
+*/
+constexpr std::size_t cholesky_block = 64;
+
+/**
+* \brief Factors a symmetric positive-definite matrix in place as A = L * L^T.
+* Only the lower triangle of A is read. Right-looking blocked algorithm: each
+* block column is factored unblocked, then the lower triangle of the trailing
+* matrix is updated with gemm, which takes n^3 / 3 flops, half those of lu_factor.
+* Stops at the first pivot that is not positive.
+* \param n Order of the matrix.
+* \param A Row-major n x n matrix with leading dimension lda; its lower triangle is overwritten by L.
+* \return n on success, otherwise the index of the first pivot that is not positive.
+*/
+template <class T>
+std::size_t cholesky_factor(std::size_t n, T* A, std::size_t lda);
+
+/**
+* \brief Solves A * X = B in place using a factorization from cholesky_factor.
+* \param n Order of A.
+* \param nrhs Number of right-hand sides (columns of B).
+* \param L Factored matrix with leading dimension lda; only the lower triangle is read.
+* \param B Row-major n x nrhs right-hand sides with leading dimension ldb, overwritten by X.
+*/
+template <class T>
+void cholesky_solve(std::size_t n, std::size_t nrhs, const T* L, std::size_t lda, T* B, std::size_t ldb);
+
+/**
+* Products with fewer multiply-adds than this run through the simple
+* row-oriented loop; packing overhead would dominate below it.
+*/
+constexpr std::size_t gemm_blocked_threshold = 64 * 64 * 64;
+
+/**
+* Products with at least this many multiply-adds are split over the thread
+* pool (see mat_parallel.h); smaller ones stay on the calling thread.
+*/
+constexpr std::size_t gemm_parallel_threshold = 128 * 128 * 128;
+
+/**
+* \brief Computes C = alpha * A * B + beta * C with a cache-blocked, packed kernel.
+* Follows the GotoBLAS/BLIS layering: B is packed into KC x NC panels that
+* stay in L3, A into MC x KC blocks that stay in L2, and an MR x NR register
+* micro-kernel streams both from L1. For double the micro-kernel and its
+* blocking follow active_isa(): 6 x 8 with AVX2, 8 x 24 with AVX-512, and a
+* portable 4 x 8 otherwise. Large products are partitioned into output tiles
+* that run in parallel.
+* \param m Rows of A and C.
+* \param n Columns of B and C.
+* \param k Columns of A and rows of B.
+* \param alpha Scale applied to the product.
+* \param A Row-major m x k operand with leading dimension lda.
+* \param B Row-major k x n operand with leading dimension ldb.
+* \param beta Scale applied to C before accumulation; 0 ignores the previous contents of C.
+* \param C Row-major m x n result with leading dimension ldc.
+*/
+void gemm(std::size_t m, std::size_t n, std::size_t k, double alpha,
+          const double* A, std::size_t lda, const double* B, std::size_t ldb,
+          double beta, double* C, std::size_t ldc);
+
+/**
+* Whether a gemm operand is used as stored or transposed.
+*/
+enum class Transpose { no, yes };
+
+/**
+* \brief Computes C = alpha * op(A) * op(B) + beta * C, where op transposes an
+* operand marked Transpose::yes.
+* A transposed operand is read in place through swapped strides while it is
+* packed, so it is never copied. op(A) is m x k and op(B) is k x n; lda and
+* ldb are the leading dimensions of A and B as stored.
+*/
+template <class T>
+void gemm(Transpose ta, Transpose tb, std::size_t m, std::size_t n, std::size_t k, T alpha,
+          const T* A, std::size_t lda, const T* B, std::size_t ldb,
+          T beta, T* C, std::size_t ldc);
+
+/**
+* \brief Computes C = A * B with a plain i-k-j loop; used for small products.
+* Same operand conventions as gemm; C is overwritten.
+*/
+void gemm_small(std::size_t m, std::size_t n, std::size_t k,
+                const double* A, std::size_t lda, const double* B, std::size_t ldb,
+                double* C, std::size_t ldc);
+
+/**
+* \brief Computes C = op(A) * op(B) with the simple loop; same conventions as the transposing gemm.
+*/
+template <class T>
+void gemm_small(Transpose ta, Transpose tb, std::size_t m, std::size_t n, std::size_t k,
+                const T* A, std::size_t lda, const T* B, std::size_t ldb,
+                T* C, std::size_t ldc);
+
+/**
+* \brief Writes the transpose of A into B with a cache-oblivious recursive blocking.
+* The longer side is halved until a block fits in L1; blocks are then moved
+* in 4 x 4 tiles that are transposed in registers (AVX2 when available).
+* \param m Rows of A and columns of B.
+* \param n Columns of A and rows of B.
+* \param A Row-major m x n source with leading dimension lda.
+* \param B Row-major n x m destination with leading dimension ldb; must not overlap A.
+*/
+template <class T>
+void transpose(std::size_t m, std::size_t n, const T* A, std::size_t lda, T* B, std::size_t ldb);
+
+/**
+* \brief Transposes a square matrix in place with the same blocking as transpose.
+* \param n Order of the matrix.
+* \param A Row-major n x n matrix with leading dimension lda.
+*/
+template <class T>
+void transpose_inplace(std::size_t n, T* A, std::size_t lda);
+
+}
+
+#endif
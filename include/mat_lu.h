@@ -0,0 +1,105 @@
+#ifndef MAT_LU_H
+#define MAT_LU_H
+
+#include <cstddef>
+#include <vector>
+
+#include "mat.h"
+
+/**
+* LU factorization P * A = L * U with partial pivoting, kept for solving
+* linear systems without forming the inverse. Factoring costs 2n^3 / 3 flops
+* once; every solve then costs 2n^2 flops per right-hand side, against the
+* 2n^3 flops of ~A followed by a full product for ~A * B.
+*
+* Solves can optionally run steps of iterative refinement: the residual
+* B - A * X is accumulated in a wider type (double for float, long double for
+* double) and the correction is solved with the same factors, which recovers
+* accuracy lost to rounding on ill-conditioned systems. The factorization
+* keeps only L, U and the pivots, so the refining solves take the original
+* matrix as an argument; solving without refinement needs no copy of A.
+*
+* The templates are instantiated for float, double, long double and
+* std::complex<double>; LU is BasicLU<double>.
+*/
+template <class T>
+class BasicLU {
+private:
+    BasicMatrix<T> lu; //< L below the diagonal (unit diagonal implied), U on and above it
+    std::vector<size_t> piv; //< Row k was swapped with row piv[k] at step k
+    int sign; //< Sign of the permutation
+public:
+    using value_type = T;
+    /**
+    * \brief Factors a square matrix or view.
+    * \throw std::invalid_argument if the matrix is not square.
+    * \throw std::runtime_error if the matrix is singular to working precision (see Matrix::operator~).
+    */
+    explicit BasicLU(const BasicConstMatrixView<T>& m);
+    explicit BasicLU(const BasicMatrix<T>& m) : BasicLU(m.view()) {}
+    /**
+    * \brief Returns the order of the factored matrix.
+    */
+    size_t size() const { return lu.rows(); }
+    /**
+    * \brief Returns the packed L and U factors.
+    */
+    const BasicMatrix<T>& factors() const { return lu; }
+    /**
+    * \brief Solves A * X = B for all columns of B by forward and back substitution.
+    * \throw std::invalid_argument if B does not have size() rows.
+    */
+    BasicMatrix<T> solve(const BasicConstMatrixView<T>& b) const;
+    BasicMatrix<T> solve(const BasicMatrix<T>& b) const { return solve(b.view()); }
+    std::vector<T> solve(const std::vector<T>& b) const;
+    /**
+    * \brief Solves A * X = B, then runs iterative refinement.
+    * \param a The matrix that was factored, for the residuals.
+    * \param refine Number of refinement steps; stops early once the residual is zero.
+    * \throw std::invalid_argument if A is not size() x size() or B does not have size() rows.
+    */
+    BasicMatrix<T> solve(const BasicConstMatrixView<T>& a, const BasicConstMatrixView<T>& b, size_t refine) const;
+    BasicMatrix<T> solve(const BasicMatrix<T>& a, const BasicMatrix<T>& b, size_t refine) const {
+        return solve(a.view(), b.view(), refine);
+    }
+    std::vector<T> solve(const BasicConstMatrixView<T>& a, const std::vector<T>& b, size_t refine) const;
+    std::vector<T> solve(const BasicMatrix<T>& a, const std::vector<T>& b, size_t refine) const {
+        return solve(a.view(), b, refine);
+    }
+    /**
+    * \brief Returns det(A) from the diagonal of U.
+    */
+    T determinant() const;
+    /**
+    * \brief Returns A^-1.
+    */
+    BasicMatrix<T> inverse() const;
+};
+
+using LU = BasicLU<double>;
+
+extern template class BasicLU<float>;
+extern template class BasicLU<double>;
+extern template class BasicLU<long double>;
+extern template class BasicLU<std::complex<double>>;
+
+/**
+* \brief Solves A * X = B with a one-off LU factorization; use BasicLU directly
+* to apply the same A to several batches of right-hand sides.
+* \param refine Number of iterative refinement steps.
+* \throw std::invalid_argument if A is not square or B does not have as many rows as A.
+* \throw std::runtime_error if A is singular to working precision.
+*/
+template <class T>
+BasicMatrix<T> solve(const BasicMatrix<T>& a, const BasicMatrix<T>& b, size_t refine = 0) {
+    const BasicLU<T> f(a);
+    return refine == 0 ? f.solve(b) : f.solve(a, b, refine);
+}
+
+template <class T>
+std::vector<T> solve(const BasicMatrix<T>& a, const std::vector<T>& b, size_t refine = 0) {
+    const BasicLU<T> f(a);
+    return refine == 0 ? f.solve(b) : f.solve(a, b, refine);
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef MAT_PARALLEL_H
+#define MAT_PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/**
+* The library-owned thread pool used by the parallel kernels.
+* The pool is created on first use with MAT_NUM_THREADS threads when that
+* environment variable is set, and with one thread per hardware thread
+* otherwise. The calling thread always takes part in the work, so a pool of
+* size 1 runs everything inline.
+*/
+namespace mat_parallel {
+
+/**
+* \brief Returns the number of threads work is spread over, including the caller.
+*/
+std::size_t num_threads();
+
+/**
+* \brief Resizes the pool.
+* Must not be called while parallel work is running.
+* \param n Number of threads including the caller; 0 selects the hardware concurrency.
+*/
+void set_num_threads(std::size_t n);
+
+/**
+* \brief Calls body(i) for every i in [0, n) on the pool and waits for all calls.
+* Indices are handed out dynamically, so uneven work balances itself. A call
+* made from inside a body runs serially on the calling thread. If a body
+* throws, the remaining indices are still drained and the first exception is
+* rethrown to the caller.
+* \param n Number of work items.
+* \param body Function invoked once per item.
+*/
+void parallel_for(std::size_t n, const std::function<void(std::size_t)>& body);
+
+/**
+* \brief Runs a graph of tasks on the pool: body(i) is called once for every
+* task i, after the calls of all tasks it depends on have returned.
+* Each thread keeps a deque of ready tasks. A thread pushes the tasks its
+* work made ready onto its own deque and runs the newest first, so a result
+* is consumed while still in cache; a thread whose deque is empty steals the
+* oldest task of another. Bodies run with nested parallelism disabled, as in
+* parallel_for. If a body throws, tasks not yet started are skipped and the
+* first exception is rethrown to the caller.
+* \param dependents dependents[i] lists the tasks that depend on task i; the graph must be acyclic.
+* \param body Function invoked once per task.
+*/
+void run_graph(const std::vector<std::vector<std::size_t>>& dependents, const std::function<void(std::size_t)>& body);
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef MAT_SCRIPT_H
+#define MAT_SCRIPT_H
+
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "mat_eval.h"
+
+/**
+* Batch scripts: declare matrices, evaluate many named expressions over
+* them, and write every result and its timing to files, with no prompts.
+*
+* One statement per line; '#' starts a comment:
+*
+*     matrix A = [1 2; 3 4]                 inline, rows separated by ';'
+*     matrix B = text "b.csv" delimiter ,   text file read with read_text (see mat_io.h)
+*     matrix C = binary c.mat               binary matrix file
+*     let X = A * B + C                     evaluates an expression (see mat_eval.h)
+*     output results                        directory for result files (default: the script's)
+*     format csv                            result files: text (default), csv or binary
+*
+* Relative paths are resolved against the script's directory, and output and
+* format may each appear once. Names are identifiers and are defined once; a
+* let may use the matrices and matrix-valued lets declared above it. Every
+* expression is parsed and its names resolved before anything is loaded or
+* evaluated, so a syntax error or unknown name anywhere stops the script
+* before any work.
+* Each input is loaded once and shared by all expressions that name it, and
+* a subexpression common to several lets is computed once: all expressions
+* are interned in one ExprCache (see mat_eval.h) whose results persist
+* across the lets, within cache_budget bytes.
+*
+* For each let, the result is written to <output>/<name>.txt, .csv or .mat
+* (scalars always as text). The evaluation times go to <output>/timings.csv
+* with the columns name, seconds, gemm_flops, products, reused; the name
+* timings is therefore reserved. A script whose result or timings file would
+* replace one of its input files is rejected before anything runs.
+*/
+
+struct ScriptOptions {
+    std::string base_dir = "."; //< Directory relative input paths are resolved against
+    std::string output_dir; //< Overrides the script's output statement when not empty
+    bool write_files = true; //< False only evaluates, e.g. for tests
+    size_t cache_budget = ExprCache::default_budget; //< Bytes of subexpression results kept between lets
+};
+
+/**
+* Timing of one let statement; seconds covers evaluation only, not loading or writing.
+*/
+struct ScriptTiming {
+    std::string name;
+    double seconds;
+    EvalStats stats;
+};
+
+struct ScriptRun {
+    std::map<std::string, ExprValue> values; //< Every declared matrix and let result, by name
+    std::vector<ScriptTiming> timings; //< One entry per let, in script order
+};
+
+/**
+* \brief Runs a batch script.
+* \throw std::invalid_argument on a syntax error, an unknown or repeated name, or
+* mismatched operands; the message starts with "line N:".
+* \throw std::runtime_error if an input cannot be read, an output cannot be written,
+* a singular matrix is inverted or any other error occurs; the message starts with "line N:".
+*/
+ScriptRun run_script(std::istream& script, const ScriptOptions& options = {});
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef MAT_SPARSE_H
+#define MAT_SPARSE_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "mat.h"
+
+/**
+* Compressed sparse row and column matrices of doubles.
+* Only the nonzero entries are stored, so memory and the cost of every
+* operation grow with the number of nonzeros (nnz) and the number of rows,
+* never with rows * cols: a 1M x 1M graph adjacency matrix with a few
+* million edges takes a few tens of megabytes.
+*
+* Indices inside a row (CSR) or column (CSC) are kept sorted and unique, and
+* operations do not store entries whose value is exactly zero.
+*/
+
+/**
+* One entry (row, col, value) used to assemble a sparse matrix.
+*/
+struct Triplet {
+    size_t row;
+    size_t col;
+    double value;
+};
+
+class CscMatrix;
+
+/**
+* Compressed sparse row storage: the entries of row i are
+* values[row_ptr[i] .. row_ptr[i + 1]) at columns col_idx[same range].
+*/
+class CsrMatrix {
+private:
+    size_t nrows, ncols;
+    std::vector<size_t> ptr; //< rows + 1 offsets into idx and vals
+    std::vector<size_t> idx; //< Column of every entry, sorted within a row
+    std::vector<double> vals; //< Value of every entry
+public:
+    /**
+    * \brief Constructs a rows x cols matrix with no entries.
+    * \throw std::runtime_error if a dimension is 0.
+    */
+    CsrMatrix(size_t rows, size_t cols);
+    /**
+    * \brief Takes ownership of existing CSR arrays.
+    * \throw std::invalid_argument if the arrays are inconsistent, or a row has unsorted or repeated columns.
+    */
+    CsrMatrix(size_t rows, size_t cols, std::vector<size_t> row_ptr, std::vector<size_t> col_idx, std::vector<double> values);
+    /**
+    * \brief Assembles a matrix from entries in any order; repeated positions are summed.
+    * Runs in O(rows + cols + nnz) with two counting sorts.
+    * \throw std::out_of_range if an entry lies outside the matrix.
+    */
+    static CsrMatrix from_triplets(size_t rows, size_t cols, const std::vector<Triplet>& entries);
+    /**
+    * \brief Keeps the nonzero elements of a dense matrix or view.
+    */
+    explicit CsrMatrix(const ConstMatrixView& m);
+    explicit CsrMatrix(const Matrix& m) : CsrMatrix(m.view()) {}
+    explicit CsrMatrix(const CscMatrix& m);
+
+    size_t rows() const { return nrows; }
+    size_t cols() const { return ncols; }
+    /**
+    * \brief Returns the number of stored entries.
+    */
+    size_t nnz() const { return vals.size(); }
+    const std::vector<size_t>& row_ptr() const { return ptr; }
+    const std::vector<size_t>& col_idx() const { return idx; }
+    const std::vector<double>& values() const { return vals; }
+    /**
+    * \brief Returns element (i, j), or 0 when it is not stored; O(log nnz of row i).
+    * \throw std::out_of_range if (i, j) lies outside the matrix.
+    */
+    double operator()(size_t i, size_t j) const;
+    /**
+    * \brief Expands into a dense Matrix.
+    */
+    Matrix to_dense() const;
+
+    /**
+    * \brief Computes y = A * x (SpMV).
+    * Rows are split into chunks of about equal nnz over the thread pool (see
+    * mat_parallel.h) once the matrix has enough entries to pay for it.
+    * \param x cols() values.
+    * \param y Receives rows() values; must not overlap x.
+    */
+    void multiply(const double* x, double* y) const;
+    /**
+    * \brief Returns A * x.
+    * \throw std::invalid_argument if x does not have cols() elements.
+    */
+    std::vector<double> operator*(const std::vector<double>& x) const;
+    /**
+    * \brief Multiplies by a dense matrix (SpMM); each stored entry scales one row of other.
+    * \throw std::invalid_argument if the dimensions do not match for multiplication.
+    */
+    Matrix operator*(const Matrix& other) const;
+    /**
+    * \brief Multiplies two sparse matrices with Gustavson's row-by-row algorithm.
+    * Work is proportional to the number of multiply-adds, not to the matrix size.
+    * \throw std::invalid_argument if the dimensions do not match for multiplication.
+    */
+    CsrMatrix operator*(const CsrMatrix& other) const;
+    /**
+    * \brief Adds or subtracts two sparse matrices by merging their rows.
+    * \throw std::invalid_argument if the dimensions do not match.
+    */
+    CsrMatrix operator+(const CsrMatrix& other) const;
+    CsrMatrix operator-(const CsrMatrix& other) const;
+    /**
+    * \brief Multiplies every entry by a scalar.
+    */
+    CsrMatrix operator*(double scalar) const;
+    /**
+    * \brief Returns the transpose in O(rows + cols + nnz).
+    */
+    CsrMatrix operator!() const;
+    /**
+    * \brief Checks that both matrices have the same shape and the same stored entries.
+    */
+    bool operator==(const CsrMatrix& other) const;
+    bool operator!=(const CsrMatrix& other) const { return !(*this == other); }
+};
+
+/**
+* Compressed sparse column storage: the entries of column j are
+* values[col_ptr[j] .. col_ptr[j + 1]) at rows row_idx[same range].
+* The arrays are exactly the CSR arrays of the transpose, which is how the
+* operations are implemented.
+*/
+class CscMatrix {
+private:
+    CsrMatrix t; //< CSR storage of the transpose: row j of t is column j of this matrix
+
+    struct transposed_t {};
+    /**
+    * \brief Adopts the CSR storage of the transpose.
+    */
+    CscMatrix(CsrMatrix transposed, transposed_t) : t(std::move(transposed)) {}
+public:
+    /**
+    * \brief Constructs a rows x cols matrix with no entries.
+    */
+    CscMatrix(size_t rows, size_t cols) : t(cols, rows) {}
+    /**
+    * \brief Takes ownership of existing CSC arrays.
+    * \throw std::invalid_argument if the arrays are inconsistent, or a column has unsorted or repeated rows.
+    */
+    CscMatrix(size_t rows, size_t cols, std::vector<size_t> col_ptr, std::vector<size_t> row_idx, std::vector<double> values)
+        : t(cols, rows, std::move(col_ptr), std::move(row_idx), std::move(values)) {}
+    /**
+    * \brief Assembles a matrix from entries in any order; repeated positions are summed.
+    * \throw std::out_of_range if an entry lies outside the matrix.
+    */
+    static CscMatrix from_triplets(size_t rows, size_t cols, const std::vector<Triplet>& entries);
+    explicit CscMatrix(const ConstMatrixView& m);
+    explicit CscMatrix(const Matrix& m) : CscMatrix(m.view()) {}
+    explicit CscMatrix(const CsrMatrix& m) : t(!m) {}
+
+    size_t rows() const { return t.cols(); }
+    size_t cols() const { return t.rows(); }
+    size_t nnz() const { return t.nnz(); }
+    const std::vector<size_t>& col_ptr() const { return t.row_ptr(); }
+    const std::vector<size_t>& row_idx() const { return t.col_idx(); }
+    const std::vector<double>& values() const { return t.values(); }
+    double operator()(size_t i, size_t j) const { return t(j, i); }
+    Matrix to_dense() const { return !t.to_dense(); }
+
+    /**
+    * \brief Computes y = A * x by scattering each column into y; runs on the calling thread.
+    * \param x cols() values.
+    * \param y Receives rows() values; must not overlap x.
+    */
+    void multiply(const double* x, double* y) const;
+    /**
+    * \brief Returns A * x.
+    * \throw std::invalid_argument if x does not have cols() elements.
+    */
+    std::vector<double> operator*(const std::vector<double>& x) const;
+    /**
+    * \brief Multiplies by a dense matrix.
+    * \throw std::invalid_argument if the dimensions do not match for multiplication.
+    */
+    Matrix operator*(const Matrix& other) const;
+    /**
+    * \brief Multiplies two sparse matrices; computed as (B^T * A^T)^T on the stored transposes.
+    * \throw std::invalid_argument if the dimensions do not match for multiplication.
+    */
+    CscMatrix operator*(const CscMatrix& other) const { return CscMatrix(other.t * t, transposed_t{}); }
+    CscMatrix operator+(const CscMatrix& other) const { return CscMatrix(t + other.t, transposed_t{}); }
+    CscMatrix operator-(const CscMatrix& other) const { return CscMatrix(t - other.t, transposed_t{}); }
+    CscMatrix operator*(double scalar) const { return CscMatrix(t * scalar, transposed_t{}); }
+    /**
+    * \brief Returns the transpose in O(rows + cols + nnz).
+    */
+    CscMatrix operator!() const { return CscMatrix(!t, transposed_t{}); }
+    bool operator==(const CscMatrix& other) const { return t == other.t; }
+    bool operator!=(const CscMatrix& other) const { return !(*this == other); }
+
+    friend class CsrMatrix;
+};
+
+#endif
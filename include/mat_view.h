@@ -0,0 +1,130 @@
+#ifndef MAT_VIEW_H
+#define MAT_VIEW_H
+
+#include <cstddef>
+#include <stdexcept>
+
+#include "mat_expr.h"
+
+/**
+* Non-owning views of a rectangular block of a dense row-major buffer.
+* A view is a pointer to its first element, a shape and the leading
+* dimension of the storage it lives in, so blocks, rows and columns of a
+* Matrix (and blocks of blocks) are addressed without copying. Views are
+* expression nodes: they can be used anywhere a Matrix is accepted by the
+* arithmetic operators. A view must not outlive the matrix it refers to.
+*/
+
+/**
+* \brief Checks that the block [r, r + h) x [c, c + w) lies inside a rows x cols matrix.
+* \throw std::out_of_range if it does not, or if the block is empty.
+*/
+inline void check_block(size_t rows, size_t cols, size_t r, size_t c, size_t h, size_t w) {
+    if (h == 0 || w == 0 || r > rows || c > cols || h > rows - r || w > cols - c) {
+        throw std::out_of_range("Block exceeds matrix bounds.");
+    }
+}
+
+/**
+* A read-only view.
+*/
+template <class T>
+class BasicConstMatrixView : public MatExpr<BasicConstMatrixView<T>> {
+    const T* ptr;
+    size_t nrows, ncols, ld;
+public:
+    using value_type = T;
+    /**
+    * \brief Wraps an existing buffer.
+    * \param data Pointer to element (0, 0).
+    * \param rows Number of rows.
+    * \param cols Number of columns.
+    * \param ld Distance in elements between the starts of two consecutive rows.
+    */
+    BasicConstMatrixView(const T* data, size_t rows, size_t cols, size_t ld) : ptr(data), nrows(rows), ncols(cols), ld(ld) {}
+    size_t rows() const { return nrows; }
+    size_t cols() const { return ncols; }
+    size_t stride() const { return ld; }
+    const T* data() const { return ptr; }
+    const T* row(size_t i) const { return ptr + i * ld; }
+    T operator()(size_t i, size_t j) const { return ptr[i * ld + j]; }
+    /**
+    * \brief Returns the h x w sub-block starting at (r, c).
+    * \throw std::out_of_range if the block does not fit.
+    */
+    BasicConstMatrixView block(size_t r, size_t c, size_t h, size_t w) const {
+        check_block(nrows, ncols, r, c, h, w);
+        return {ptr + r * ld + c, h, w, ld};
+    }
+    BasicConstMatrixView row_view(size_t i) const { return block(i, 0, 1, ncols); }
+    BasicConstMatrixView col_view(size_t j) const { return block(0, j, nrows, 1); }
+};
+
+/**
+* A view through which the elements can be modified.
+* Assigning an expression writes into the block in place; the shape must match.
+*/
+template <class T>
+class BasicMatrixView : public MatExpr<BasicMatrixView<T>> {
+    T* ptr;
+    size_t nrows, ncols, ld;
+public:
+    using value_type = T;
+    BasicMatrixView(T* data, size_t rows, size_t cols, size_t ld) : ptr(data), nrows(rows), ncols(cols), ld(ld) {}
+    BasicMatrixView(const BasicMatrixView&) = default;
+    size_t rows() const { return nrows; }
+    size_t cols() const { return ncols; }
+    size_t stride() const { return ld; }
+    T* data() const { return ptr; }
+    T* row(size_t i) const { return ptr + i * ld; }
+    T& operator()(size_t i, size_t j) const { return ptr[i * ld + j]; }
+    operator BasicConstMatrixView<T>() const { return {ptr, nrows, ncols, ld}; }
+    /**
+    * \brief Returns the h x w sub-block starting at (r, c).
+    * \throw std::out_of_range if the block does not fit.
+    */
+    BasicMatrixView block(size_t r, size_t c, size_t h, size_t w) const {
+        check_block(nrows, ncols, r, c, h, w);
+        return {ptr + r * ld + c, h, w, ld};
+    }
+    BasicMatrixView row_view(size_t i) const { return block(i, 0, 1, ncols); }
+    BasicMatrixView col_view(size_t j) const { return block(0, j, nrows, 1); }
+
+    /**
+    * \brief Copies the elements of another view or evaluates an expression into this block.
+    * Operands that overlap the block at a different position are evaluated
+    * into a temporary first.
+    * \throw std::invalid_argument if the dimensions do not match.
+    */
+    BasicMatrixView& operator=(const BasicMatrixView& other);
+    template <class E>
+    BasicMatrixView& operator=(const MatExpr<E>& expr);
+    /**
+    * \brief Adds or subtracts a matrix or expression in place.
+    * \throw std::invalid_argument if the dimensions do not match.
+    */
+    template <class E>
+    BasicMatrixView& operator+=(const MatExpr<E>& other);
+    template <class E>
+    BasicMatrixView& operator-=(const MatExpr<E>& other);
+    /**
+    * \brief Multiplies the block by a scalar in place.
+    */
+    BasicMatrixView& operator*=(T scalar);
+};
+
+using ConstMatrixView = BasicConstMatrixView<double>;
+using MatrixView = BasicMatrixView<double>;
+
+template <class T>
+struct is_mat_view<BasicConstMatrixView<T>> : std::true_type {};
+
+template <class T>
+struct is_mat_view<BasicMatrixView<T>> : std::true_type {};
+
+template <class T>
+BasicConstMatrixView<T> dense_view(const BasicConstMatrixView<T>& v) { return v; }
+template <class T>
+BasicConstMatrixView<T> dense_view(const BasicMatrixView<T>& v) { return v; }
+
+#endif
@@ -2,8 +2,14 @@
 #include <map>
 #include <memory>
 #include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <string>
 #include <vector>
+#include <utility>
 #include "mat.h"
+#include "mat_eval.h"
+#include "mat_script.h"
 
 
 /**
@@ -40,77 +46,111 @@ void getMatricesFromUser(std::map<char, std::unique_ptr<Matrix>>& matrices) {
 * \brief Requests the operation chain from the user.
 * This function prompts the user to enter a chain of operations to be performed on the matrices.
 * The operations should be in the format of a mathematical expression involving matrix names, 
-* such as "A*B+C".
+* such as "(A + B) * ~C - 2 * !D". The whole line is read, so spaces are allowed.
 * \return A string representing the chain of operations.
 */
 std::string getOperationChain() {
     std::string operations;
     std::cout << "Enter the chain of operations (e.g., A*B+C): ";
-    std::cin >> operations;
+    std::cin >> std::ws;
+    std::getline(std::cin, operations);
     return operations;
 }
 
 /**
 * \brief Evaluates a chain of matrix operations.
+* The chain is parsed with the usual precedence (see mat_eval.h): prefix
+* !, ~, * and - bind tightest, then *, then + and -. Each run of products is
+* evaluated as one matrix chain in the parenthesization with the fewest FLOPs.
 * \param chain A string representing the chain of operations.
 * \param matrices A,B,C...
-* \return A Matrix object representing the result of the operations.
-* \throw std::invalid_argument if an invalid operation is encountered.
+* \param flops If not null, receives the FLOP estimate of all matrix products performed.
+* \return The resulting matrix, or a scalar for expressions such as *A.
+* \throw std::invalid_argument on a syntax error, an unknown matrix name or mismatched operands.
 */
-Matrix evaluateOperationChain(const std::string& chain, const std::map<char, std::unique_ptr<Matrix>>& matrices) {
-    std::vector<Matrix> operands;
-    std::vector<char> operators;
-
-    for (char ch : chain) {
-        if (isalpha(ch)) {
-            operands.push_back(*matrices.at(ch));
-        } else {
-            operators.push_back(ch);
+ExprValue evaluateOperationChain(const std::string& chain, const std::map<char, std::unique_ptr<Matrix>>& matrices,
+                                 double* flops = nullptr) {
+    MatrixLookup lookup = [&](const std::string& name) -> const Matrix& {
+        auto it = name.size() == 1 ? matrices.find(name[0]) : matrices.end();
+        if (it == matrices.end()) {
+            throw std::invalid_argument("Unknown matrix: " + name);
         }
+        return *it->second;
+    };
+    EvalStats stats;
+    ExprValue result = evaluate(parse_expression(chain), lookup, &stats);
+    if (flops != nullptr) {
+        *flops = stats.gemm_flops;
     }
+    return result;
+}
 
-    while (!operators.empty()) {
-        char op = operators.back();
-        operators.pop_back();
+/**
+* \brief Runs a batch script (see mat_script.h) and prints the time of each expression.
+* \param scriptPath The script; its relative paths are resolved against its directory.
+* \param outputDir Directory for results and timings.csv; empty uses the script's output statement.
+* \return 0 on success, 1 if the script failed.
+*/
+int runBatch(const std::string& scriptPath, const std::string& outputDir) {
+    try {
+        std::ifstream script(scriptPath);
+        if (!script) {
+            throw std::runtime_error("Cannot open " + scriptPath);
+        }
+        ScriptOptions options;
+        const std::filesystem::path dir = std::filesystem::path(scriptPath).parent_path();
+        options.base_dir = dir.empty() ? "." : dir.string();
+        options.output_dir = outputDir;
 
-        if (op == '*') {
-            Matrix right = operands.back();
-            operands.pop_back();
-            Matrix left = operands.back();
-            operands.pop_back();
-            auto result = left * right;
-            operands.push_back(result);
-        } else if (op == '+') {
-            Matrix right = operands.back();
-            operands.pop_back();
-            Matrix left = operands.back();
-            operands.pop_back();
-            auto result = left + right;
-            operands.push_back(result);
-        } else if (op == '-') {
-            Matrix right = operands.back();
-            operands.pop_back();
-            Matrix left = operands.back();
-            operands.pop_back();
-            auto result = left - right;
-            operands.push_back(result);
+        const ScriptRun run = run_script(script, options);
+        for (const ScriptTiming& timing : run.timings) {
+            std::cout << timing.name << ": " << timing.seconds * 1e3 << " ms, "
+                      << timing.stats.products << " products\n";
         }
-        
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
     }
-
-    return operands.back();
+    return 0;
 }
 
-int main() {
+/**
+* \brief Interactive by default; "main --batch script [--output dir]" runs a script without prompts.
+*/
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        std::string scriptPath, outputDir;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--batch" && i + 1 < argc) {
+                scriptPath = argv[++i];
+            } else if (arg == "--output" && i + 1 < argc) {
+                outputDir = argv[++i];
+            } else {
+                scriptPath.clear();
+                break;
+            }
+        }
+        if (scriptPath.empty()) {
+            std::cerr << "Usage: " << argv[0] << " [--batch script [--output dir]]" << std::endl;
+            return 2;
+        }
+        return runBatch(scriptPath, outputDir);
+    }
+
     try {
         std::map<char, std::unique_ptr<Matrix>> matrices;
         getMatricesFromUser(matrices);
 
         std::string operations = getOperationChain();
 
-        Matrix result = evaluateOperationChain(operations, matrices);
+        ExprValue result = evaluateOperationChain(operations, matrices);
 
-        std::cout << "Result:\n" << result;
+        if (const double* scalar = std::get_if<double>(&result)) {
+            std::cout << "Result: " << *scalar << std::endl;
+        } else {
+            std::cout << "Result:\n" << std::get<Matrix>(result);
+        }
     } catch (const std::exception& ex) {
         std::cerr << "Error: " << ex.what() << std::endl;
     }
@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mat_batch.h"
+#include "mat_kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MAT_X86_DISPATCH 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MAT_ALWAYS_INLINE inline __attribute__((always_inline))
+#define MAT_RESTRICT __restrict__
+#else
+#define MAT_ALWAYS_INLINE inline
+#define MAT_RESTRICT
+#endif
+
+namespace {
+
+    // Lanes accumulated per pass of the product; three 4 x 4 operands of
+    // this many lanes stay in L2 however large the batch is.
+    constexpr size_t CHUNK = 256;
+
+    /**
+    * Kernels over count lanes of planes that are s elements apart. The same
+    * source is compiled once per instruction set; the loops over lanes carry
+    * no dependencies and are left to the auto-vectorizer.
+    */
+    template <class T>
+    struct BatchKernels {
+        void (*multiply)(size_t m, size_t n, size_t k, const T* A, const T* B, T* C, size_t s, size_t count);
+        /** Orders 1 to 4 only. */
+        void (*determinant)(size_t n, const T* A, T* det, size_t s, size_t count);
+        /** Orders 1 to 4 only; returns false if a matrix is singular. */
+        bool (*inverse)(size_t n, const T* A, T* R, size_t s, size_t count);
+    };
+
+    template <class T>
+    MAT_ALWAYS_INLINE T abs_max(T m, T v) {
+        v = v < T(0) ? -v : v;
+        return v > m ? v : m;
+    }
+
+    /**
+    * The closed-form singularity test of FixedMatrix: |det| <= N * epsilon * max|a_ij|^N.
+    */
+    template <size_t N, class T>
+    MAT_ALWAYS_INLINE bool negligible(T det, T max_abs) {
+        T scale = static_cast<T>(N) * std::numeric_limits<T>::epsilon();
+        for (size_t i = 0; i < N; ++i) {
+            scale *= max_abs;
+        }
+        return !((det < T(0) ? -det : det) > scale);
+    }
+
+    template <class T>
+    MAT_ALWAYS_INLINE void multiply_lanes(size_t m, size_t n, size_t k, const T* MAT_RESTRICT A, const T* MAT_RESTRICT B,
+                                          T* MAT_RESTRICT C, size_t s, size_t count) {
+        alignas(64) T acc[CHUNK];
+        for (size_t b0 = 0; b0 < count; b0 += CHUNK) {
+            const size_t len = std::min(CHUNK, count - b0);
+            for (size_t i = 0; i < m; ++i) {
+                for (size_t j = 0; j < n; ++j) {
+                    for (size_t b = 0; b < len; ++b) {
+                        acc[b] = T(0);
+                    }
+                    for (size_t p = 0; p < k; ++p) {
+                        const T* a = A + (i * k + p) * s + b0;
+                        const T* x = B + (p * n + j) * s + b0;
+                        for (size_t b = 0; b < len; ++b) {
+                            acc[b] += a[b] * x[b];
+                        }
+                    }
+                    T* c = C + (i * n + j) * s + b0;
+                    for (size_t b = 0; b < len; ++b) {
+                        c[b] = acc[b];
+                    }
+                }
+            }
+        }
+    }
+
+    // Lanes handled per pass of the closed forms; the planes of a pass are
+    // copied into local arrays, which the vectorizer knows do not alias.
+    constexpr size_t LANES = 64;
+
+    template <size_t E, class T>
+    MAT_ALWAYS_INLINE void load_lanes(const T* A, size_t s, size_t b0, size_t len, T (&in)[E][LANES]) {
+        for (size_t e = 0; e < E; ++e) {
+            std::copy(A + e * s + b0, A + e * s + b0 + len, in[e]);
+        }
+    }
+
+    template <size_t E, class T>
+    MAT_ALWAYS_INLINE void store_lanes(const T (&out)[E][LANES], size_t len, T* R, size_t s, size_t b0) {
+        for (size_t e = 0; e < E; ++e) {
+            std::copy(out[e], out[e] + len, R + e * s + b0);
+        }
+    }
+
+    /**
+    * Computes det (and, with R, the inverse) of N x N lanes from their
+    * cofactors. Returns the number of lanes that are singular, kept in T so
+    * that the flag has the lane width of the data.
+    */
+    template <size_t N, class T>
+    MAT_ALWAYS_INLINE T closed_form_lanes(const T* A, T* det, T* R, size_t s, size_t count) {
+        alignas(64) T in[N * N][LANES];
+        alignas(64) T out[N * N][LANES];
+        alignas(64) T d[LANES];
+        T singular = T(0);
+        for (size_t b0 = 0; b0 < count; b0 += LANES) {
+            const size_t len = std::min(LANES, count - b0);
+            load_lanes(A, s, b0, len, in);
+            for (size_t b = 0; b < len; ++b) {
+                auto a = [&](size_t i, size_t j) { return in[i * N + j][b]; };
+                auto r = [&](size_t i, size_t j) -> T& { return out[i * N + j][b]; };
+                if constexpr (N == 1) {
+                    d[b] = a(0, 0);
+                    r(0, 0) = T(1);
+                } else if constexpr (N == 2) {
+                    d[b] = a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0);
+                    r(0, 0) = a(1, 1);
+                    r(0, 1) = -a(0, 1);
+                    r(1, 0) = -a(1, 0);
+                    r(1, 1) = a(0, 0);
+                } else if constexpr (N == 3) {
+                    r(0, 0) = a(1, 1) * a(2, 2) - a(1, 2) * a(2, 1);
+                    r(1, 0) = a(1, 2) * a(2, 0) - a(1, 0) * a(2, 2);
+                    r(2, 0) = a(1, 0) * a(2, 1) - a(1, 1) * a(2, 0);
+                    d[b] = a(0, 0) * r(0, 0) + a(0, 1) * r(1, 0) + a(0, 2) * r(2, 0);
+                    r(0, 1) = a(0, 2) * a(2, 1) - a(0, 1) * a(2, 2);
+                    r(0, 2) = a(0, 1) * a(1, 2) - a(0, 2) * a(1, 1);
+                    r(1, 1) = a(0, 0) * a(2, 2) - a(0, 2) * a(2, 0);
+                    r(1, 2) = a(0, 2) * a(1, 0) - a(0, 0) * a(1, 2);
+                    r(2, 1) = a(0, 1) * a(2, 0) - a(0, 0) * a(2, 1);
+                    r(2, 2) = a(0, 0) * a(1, 1) - a(0, 1) * a(1, 0);
+                } else {
+                    // Laplace expansion over the 2 x 2 minors of the top and bottom row pairs.
+                    const T s0 = a(0, 0) * a(1, 1) - a(1, 0) * a(0, 1);
+                    const T s1 = a(0, 0) * a(1, 2) - a(1, 0) * a(0, 2);
+                    const T s2 = a(0, 0) * a(1, 3) - a(1, 0) * a(0, 3);
+                    const T s3 = a(0, 1) * a(1, 2) - a(1, 1) * a(0, 2);
+                    const T s4 = a(0, 1) * a(1, 3) - a(1, 1) * a(0, 3);
+                    const T s5 = a(0, 2) * a(1, 3) - a(1, 2) * a(0, 3);
+                    const T c5 = a(2, 2) * a(3, 3) - a(3, 2) * a(2, 3);
+                    const T c4 = a(2, 1) * a(3, 3) - a(3, 1) * a(2, 3);
+                    const T c3 = a(2, 1) * a(3, 2) - a(3, 1) * a(2, 2);
+                    const T c2 = a(2, 0) * a(3, 3) - a(3, 0) * a(2, 3);
+                    const T c1 = a(2, 0) * a(3, 2) - a(3, 0) * a(2, 2);
+                    const T c0 = a(2, 0) * a(3, 1) - a(3, 0) * a(2, 1);
+                    d[b] = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+                    if (R != nullptr) {
+                        r(0, 0) =  a(1, 1) * c5 - a(1, 2) * c4 + a(1, 3) * c3;
+                        r(0, 1) = -a(0, 1) * c5 + a(0, 2) * c4 - a(0, 3) * c3;
+                        r(0, 2) =  a(3, 1) * s5 - a(3, 2) * s4 + a(3, 3) * s3;
+                        r(0, 3) = -a(2, 1) * s5 + a(2, 2) * s4 - a(2, 3) * s3;
+                        r(1, 0) = -a(1, 0) * c5 + a(1, 2) * c2 - a(1, 3) * c1;
+                        r(1, 1) =  a(0, 0) * c5 - a(0, 2) * c2 + a(0, 3) * c1;
+                        r(1, 2) = -a(3, 0) * s5 + a(3, 2) * s2 - a(3, 3) * s1;
+                        r(1, 3) =  a(2, 0) * s5 - a(2, 2) * s2 + a(2, 3) * s1;
+                        r(2, 0) =  a(1, 0) * c4 - a(1, 1) * c2 + a(1, 3) * c0;
+                        r(2, 1) = -a(0, 0) * c4 + a(0, 1) * c2 - a(0, 3) * c0;
+                        r(2, 2) =  a(3, 0) * s4 - a(3, 1) * s2 + a(3, 3) * s0;
+                        r(2, 3) = -a(2, 0) * s4 + a(2, 1) * s2 - a(2, 3) * s0;
+                        r(3, 0) = -a(1, 0) * c3 + a(1, 1) * c1 - a(1, 2) * c0;
+                        r(3, 1) =  a(0, 0) * c3 - a(0, 1) * c1 + a(0, 2) * c0;
+                        r(3, 2) = -a(3, 0) * s3 + a(3, 1) * s1 - a(3, 2) * s0;
+                        r(3, 3) =  a(2, 0) * s3 - a(2, 1) * s1 + a(2, 2) * s0;
+                    }
+                }
+            }
+            if (det != nullptr) {
+                std::copy(d, d + len, det + b0);
+            }
+            if (R == nullptr) {
+                continue;
+            }
+            // Singular lanes still produce (non-finite) output; the caller throws.
+            for (size_t b = 0; b < len; ++b) {
+                T mx = T(0);
+                for (size_t e = 0; e < N * N; ++e) {
+                    mx = abs_max(mx, in[e][b]);
+                }
+                singular += negligible<N>(d[b], mx) ? T(1) : T(0);
+                const T inv = T(1) / d[b];
+                for (size_t e = 0; e < N * N; ++e) {
+                    out[e][b] *= inv;
+                }
+            }
+            store_lanes(out, len, R, s, b0);
+        }
+        return singular;
+    }
+
+    template <class T>
+    MAT_ALWAYS_INLINE void determinant_lanes(size_t n, const T* A, T* det, size_t s, size_t count) {
+        switch (n) {
+            case 1: closed_form_lanes<1>(A, det, static_cast<T*>(nullptr), s, count); break;
+            case 2: closed_form_lanes<2>(A, det, static_cast<T*>(nullptr), s, count); break;
+            case 3: closed_form_lanes<3>(A, det, static_cast<T*>(nullptr), s, count); break;
+            case 4: closed_form_lanes<4>(A, det, static_cast<T*>(nullptr), s, count); break;
+        }
+    }
+
+    template <class T>
+    MAT_ALWAYS_INLINE bool inverse_lanes(size_t n, const T* A, T* R, size_t s, size_t count) {
+        T singular = T(0);
+        switch (n) {
+            case 1: singular = closed_form_lanes<1>(A, static_cast<T*>(nullptr), R, s, count); break;
+            case 2: singular = closed_form_lanes<2>(A, static_cast<T*>(nullptr), R, s, count); break;
+            case 3: singular = closed_form_lanes<3>(A, static_cast<T*>(nullptr), R, s, count); break;
+            case 4: singular = closed_form_lanes<4>(A, static_cast<T*>(nullptr), R, s, count); break;
+        }
+        return singular == T(0);
+    }
+
+#define MAT_BATCH_ISA(name, target)                                                                          \
+    template <class T>                                                                                       \
+    target void multiply_##name(size_t m, size_t n, size_t k, const T* A, const T* B, T* C, size_t s,        \
+                                size_t count) {                                                              \
+        multiply_lanes(m, n, k, A, B, C, s, count);                                                          \
+    }                                                                                                        \
+    template <class T>                                                                                       \
+    target void determinant_##name(size_t n, const T* A, T* det, size_t s, size_t count) {                  \
+        determinant_lanes(n, A, det, s, count);                                                              \
+    }                                                                                                        \
+    template <class T>                                                                                       \
+    target bool inverse_##name(size_t n, const T* A, T* R, size_t s, size_t count) {                        \
+        return inverse_lanes(n, A, R, s, count);                                                             \
+    }                                                                                                        \
+    template <class T>                                                                                       \
+    const BatchKernels<T> name##_kernels{multiply_##name<T>, determinant_##name<T>, inverse_##name<T>};
+
+    MAT_BATCH_ISA(scalar, )
+#ifdef MAT_X86_DISPATCH
+    MAT_BATCH_ISA(avx2, __attribute__((target("avx2,fma"))))
+    MAT_BATCH_ISA(avx512, __attribute__((target("avx512f"))))
+#endif
+
+#undef MAT_BATCH_ISA
+
+    /**
+    * Returns the kernels for mat_kernels::active_isa(); SSE2 is the x86-64
+    * baseline, so the scalar build already uses it.
+    */
+    template <class T>
+    const BatchKernels<T>& batch_kernels() {
+#ifdef MAT_X86_DISPATCH
+        using mat_kernels::Isa;
+        static const BatchKernels<T>& kernels = mat_kernels::active_isa() >= Isa::avx512 ? avx512_kernels<T>
+                                              : mat_kernels::active_isa() >= Isa::avx2   ? avx2_kernels<T>
+                                                                                         : scalar_kernels<T>;
+        return kernels;
+#else
+        return scalar_kernels<T>;
+#endif
+    }
+
+    void check_square(size_t rows, size_t cols, const char* what) {
+        if (rows != cols) {
+            throw std::invalid_argument(std::string("Matrix must be square to compute ") + what + ".");
+        }
+    }
+
+    const char* const singular_message = "Matrix is singular and cannot be inverted.";
+
+}
+
+    template <class T>
+    BasicMatrixBatch<T>::BasicMatrixBatch(size_t count, size_t rows, size_t cols)
+        : count(count), nrows(rows), ncols(cols) {
+        if ((rows == 0) || (cols == 0))
+            throw std::runtime_error{"rows or cols cannot be 0"};
+        constexpr size_t line = 64 / sizeof(T);
+        plane_stride = (count + line - 1) / line * line;
+        storage.assign(rows * cols * plane_stride, T(0));
+    }
+
+    template <class T>
+    BasicMatrix<T> BasicMatrixBatch<T>::get(size_t b) const {
+        if (b >= count) {
+            throw std::out_of_range("Batch index out of range.");
+        }
+        BasicMatrix<T> m(nrows, ncols);
+        for (size_t i = 0; i < nrows; ++i) {
+            for (size_t j = 0; j < ncols; ++j) {
+                m(i, j) = (*this)(b, i, j);
+            }
+        }
+        return m;
+    }
+
+    template <class T>
+    void BasicMatrixBatch<T>::set(size_t b, const BasicConstMatrixView<T>& m) {
+        if (b >= count) {
+            throw std::out_of_range("Batch index out of range.");
+        }
+        if (m.rows() != nrows || m.cols() != ncols) {
+            throw std::invalid_argument("Matrix dimensions must agree.");
+        }
+        for (size_t i = 0; i < nrows; ++i) {
+            for (size_t j = 0; j < ncols; ++j) {
+                (*this)(b, i, j) = m(i, j);
+            }
+        }
+    }
+
+    template <class T>
+    BasicMatrixBatch<T> BasicMatrixBatch<T>::operator*(const BasicMatrixBatch& other) const {
+        if (count != other.count) {
+            throw std::invalid_argument("Batch sizes must agree.");
+        }
+        if (ncols != other.nrows) {
+            throw std::invalid_argument("Matrix multiplication dimensions must agree.");
+        }
+        BasicMatrixBatch result(count, nrows, other.ncols);
+        batch_kernels<T>().multiply(nrows, other.ncols, ncols, storage.data(), other.storage.data(),
+                                    result.storage.data(), plane_stride, count);
+        return result;
+    }
+
+    template <class T>
+    BasicMatrixBatch<T> BasicMatrixBatch<T>::operator!() const {
+        BasicMatrixBatch result(count, ncols, nrows);
+        for (size_t i = 0; i < nrows; ++i) {
+            for (size_t j = 0; j < ncols; ++j) {
+                std::copy(plane(i, j), plane(i, j) + count, result.plane(j, i));
+            }
+        }
+        return result;
+    }
+
+    template <class T>
+    std::vector<T> BasicMatrixBatch<T>::operator*() const {
+        check_square(nrows, ncols, "determinant");
+        std::vector<T> det(count);
+        if (nrows <= 4) {
+            batch_kernels<T>().determinant(nrows, storage.data(), det.data(), plane_stride, count);
+            return det;
+        }
+        std::vector<T> lu(nrows * nrows);
+        std::vector<size_t> piv(nrows);
+        for (size_t b = 0; b < count; ++b) {
+            for (size_t e = 0; e < lu.size(); ++e) {
+                lu[e] = storage[e * plane_stride + b];
+            }
+            T d = static_cast<T>(mat_kernels::lu_factor(nrows, lu.data(), nrows, piv.data()));
+            for (size_t i = 0; i < nrows; ++i) {
+                d *= lu[i * nrows + i];
+            }
+            det[b] = d;
+        }
+        return det;
+    }
+
+    template <class T>
+    BasicMatrixBatch<T> BasicMatrixBatch<T>::operator~() const {
+        check_square(nrows, ncols, "inverse");
+        BasicMatrixBatch result(count, nrows, ncols);
+        if (nrows <= 4) {
+            if (!batch_kernels<T>().inverse(nrows, storage.data(), result.storage.data(), plane_stride, count)) {
+                throw std::runtime_error(singular_message);
+            }
+            return result;
+        }
+        std::vector<T> lu(nrows * nrows), inv(nrows * nrows);
+        std::vector<size_t> piv(nrows);
+        for (size_t b = 0; b < count; ++b) {
+            T max_abs = 0;
+            for (size_t e = 0; e < lu.size(); ++e) {
+                lu[e] = storage[e * plane_stride + b];
+                max_abs = std::max(max_abs, std::abs(lu[e]));
+            }
+            const T tol = mat_kernels::singular_tolerance(nrows, max_abs);
+            mat_kernels::lu_factor(nrows, lu.data(), nrows, piv.data());
+            for (size_t i = 0; i < nrows; ++i) {
+                if (!(std::abs(lu[i * nrows + i]) > tol)) {
+                    throw std::runtime_error(singular_message);
+                }
+            }
+            std::fill(inv.begin(), inv.end(), T(0));
+            for (size_t i = 0; i < nrows; ++i) {
+                inv[i * nrows + i] = T(1);
+            }
+            mat_kernels::lu_solve(nrows, nrows, lu.data(), nrows, piv.data(), inv.data(), nrows);
+            for (size_t e = 0; e < inv.size(); ++e) {
+                result.storage[e * plane_stride + b] = inv[e];
+            }
+        }
+        return result;
+    }
+
+    template class BasicMatrixBatch<float>;
+    template class BasicMatrixBatch<double>;
@@ -0,0 +1,80 @@
+#include <limits>
+#include <stdexcept>
+
+#include "mat_chain.h"
+
+namespace {
+
+    /**
+    * Multiplies factors i..j following the split table; leaves are returned
+    * as copies only when the whole chain is a single matrix.
+    */
+    Matrix multiply_range(const std::vector<const Matrix*>& factors, const ChainOrder& order, size_t i, size_t j) {
+        if (i == j) {
+            return *factors[i];
+        }
+        const size_t k = order.split[i * order.count + j];
+        if (i == k && k + 1 == j) {
+            return *factors[i] * *factors[j];
+        }
+        if (i == k) {
+            return *factors[i] * multiply_range(factors, order, k + 1, j);
+        }
+        if (k + 1 == j) {
+            return multiply_range(factors, order, i, k) * *factors[j];
+        }
+        return multiply_range(factors, order, i, k) * multiply_range(factors, order, k + 1, j);
+    }
+
+}
+
+    ChainOrder plan_chain(const std::vector<std::pair<size_t, size_t>>& shapes) {
+        const size_t n = shapes.size();
+        if (n == 0) {
+            throw std::invalid_argument("Matrix chain cannot be empty.");
+        }
+        for (size_t i = 1; i < n; ++i) {
+            if (shapes[i - 1].second != shapes[i].first) {
+                throw std::invalid_argument("Matrix multiplication dimensions must agree.");
+            }
+        }
+
+        // p[i] x p[i + 1] is the shape of factor i.
+        std::vector<double> p(n + 1);
+        p[0] = static_cast<double>(shapes[0].first);
+        for (size_t i = 0; i < n; ++i) {
+            p[i + 1] = static_cast<double>(shapes[i].second);
+        }
+
+        ChainOrder order{n, std::vector<size_t>(n * n, 0), 0.0};
+        std::vector<double> cost(n * n, 0.0);
+        for (size_t len = 2; len <= n; ++len) {
+            for (size_t i = 0; i + len <= n; ++i) {
+                const size_t j = i + len - 1;
+                double best = std::numeric_limits<double>::infinity();
+                for (size_t k = i; k < j; ++k) {
+                    double c = cost[i * n + k] + cost[(k + 1) * n + j] + 2.0 * p[i] * p[k + 1] * p[j + 1];
+                    if (c < best) {
+                        best = c;
+                        order.split[i * n + j] = k;
+                    }
+                }
+                cost[i * n + j] = best;
+            }
+        }
+        order.flops = cost[n - 1];
+        return order;
+    }
+
+    Matrix multiply_chain(const std::vector<const Matrix*>& factors, double* flops) {
+        std::vector<std::pair<size_t, size_t>> shapes;
+        shapes.reserve(factors.size());
+        for (const Matrix* m : factors) {
+            shapes.emplace_back(m->rows(), m->cols());
+        }
+        ChainOrder order = plan_chain(shapes);
+        if (flops != nullptr) {
+            *flops += order.flops;
+        }
+        return multiply_range(factors, order, 0, factors.size() - 1);
+    }
@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "mat_cholesky.h"
+#include "mat_kernels.h"
+#include "mat_parallel.h"
+
+namespace mat_kernels {
+
+    namespace {
+
+        /**
+        * Four independent partial sums, so the loop is not serialized on one
+        * addition chain and the compiler can vectorize it without reassociating.
+        */
+        template <class T>
+        T dot(const T* a, const T* b, std::size_t n) {
+            T s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            std::size_t p = 0;
+            for (; p + 4 <= n; p += 4) {
+                s0 += a[p] * b[p];
+                s1 += a[p + 1] * b[p + 1];
+                s2 += a[p + 2] * b[p + 2];
+                s3 += a[p + 3] * b[p + 3];
+            }
+            for (; p < n; ++p) {
+                s0 += a[p] * b[p];
+            }
+            return (s0 + s1) + (s2 + s3);
+        }
+
+    }
+
+    template <class T>
+    std::size_t cholesky_factor(std::size_t n, T* A, std::size_t lda) {
+        for (std::size_t k0 = 0; k0 < n; k0 += cholesky_block) {
+            const std::size_t k1 = std::min(n, k0 + cholesky_block);
+            // Earlier block columns have already been subtracted by the
+            // trailing updates, so every dot product below only spans
+            // columns k0..j of the current block and reads along rows.
+            for (std::size_t i = k0; i < k1; ++i) {
+                T* ri = A + i * lda;
+                for (std::size_t j = k0; j < i; ++j) {
+                    const T* rj = A + j * lda;
+                    ri[j] = (ri[j] - dot(ri + k0, rj + k0, j - k0)) / rj[j];
+                }
+                const T d = ri[i] - dot(ri + k0, ri + k0, i - k0);
+                if (!(d > T(0))) {
+                    return i;
+                }
+                ri[i] = std::sqrt(d);
+            }
+            for (std::size_t i = k1; i < n; ++i) {
+                T* ri = A + i * lda;
+                for (std::size_t j = k0; j < k1; ++j) {
+                    const T* rj = A + j * lda;
+                    ri[j] = (ri[j] - dot(ri + k0, rj + k0, j - k0)) / rj[j];
+                }
+            }
+            if (k1 == n) {
+                break;
+            }
+
+            // A22 -= L21 * L21^T on the lower triangle only, one gemm per
+            // block of rows, each ending at the diagonal.
+            const std::size_t kb = k1 - k0;
+            const std::size_t m = n - k1;
+            const std::size_t blocks = (m + cholesky_block - 1) / cholesky_block;
+            auto update = [&](std::size_t b) {
+                const std::size_t i0 = k1 + b * cholesky_block;
+                const std::size_t mi = std::min(cholesky_block, n - i0);
+                gemm(Transpose::no, Transpose::yes, mi, i0 + mi - k1, kb, T(-1),
+                     A + i0 * lda + k0, lda, A + k1 * lda + k0, lda, T(1), A + i0 * lda + k1, lda);
+            };
+            if (mat_parallel::num_threads() == 1 || m * m * kb / 2 < gemm_parallel_threshold) {
+                for (std::size_t b = 0; b < blocks; ++b) {
+                    update(b);
+                }
+            } else {
+                mat_parallel::parallel_for(blocks, update);
+            }
+        }
+        return n;
+    }
+
+    template <class T>
+    void cholesky_solve(std::size_t n, std::size_t nrhs, const T* L, std::size_t lda, T* B, std::size_t ldb) {
+        // L * Y = B, then L^T * X = Y; both sweeps update whole rows of B.
+        for (std::size_t i = 0; i < n; ++i) {
+            T* bi = B + i * ldb;
+            const T* li = L + i * lda;
+            for (std::size_t k = 0; k < i; ++k) {
+                const T l = li[k];
+                const T* bk = B + k * ldb;
+                for (std::size_t j = 0; j < nrhs; ++j) {
+                    bi[j] -= l * bk[j];
+                }
+            }
+            const T inv = T(1) / li[i];
+            for (std::size_t j = 0; j < nrhs; ++j) {
+                bi[j] *= inv;
+            }
+        }
+        for (std::size_t i = n; i-- > 0;) {
+            T* bi = B + i * ldb;
+            const T* li = L + i * lda;
+            const T inv = T(1) / li[i];
+            for (std::size_t j = 0; j < nrhs; ++j) {
+                bi[j] *= inv;
+            }
+            for (std::size_t k = 0; k < i; ++k) {
+                const T l = li[k];
+                T* bk = B + k * ldb;
+                for (std::size_t j = 0; j < nrhs; ++j) {
+                    bk[j] -= l * bi[j];
+                }
+            }
+        }
+    }
+
+#define MAT_INSTANTIATE_CHOLESKY(T) \
+    template std::size_t cholesky_factor<T>(std::size_t, T*, std::size_t); \
+    template void cholesky_solve<T>(std::size_t, std::size_t, const T*, std::size_t, T*, std::size_t);
+
+    MAT_INSTANTIATE_CHOLESKY(float)
+    MAT_INSTANTIATE_CHOLESKY(double)
+    MAT_INSTANTIATE_CHOLESKY(long double)
+
+#undef MAT_INSTANTIATE_CHOLESKY
+
+}
+
+namespace {
+
+    /**
+    * Rewrites L so that L * L^T becomes L * L^T + sign * w * w^T, one column
+    * at a time. Returns false, leaving L partly modified, if a pivot of a
+    * downdate is not positive.
+    */
+    template <class T>
+    bool rank_one(BasicMatrix<T>& l, std::vector<T> w, T sign) {
+        const size_t n = l.rows();
+        for (size_t k = 0; k < n; ++k) {
+            const T lkk = l(k, k);
+            const T r2 = lkk * lkk + sign * w[k] * w[k];
+            if (!(r2 > T(0))) {
+                return false;
+            }
+            const T r = std::sqrt(r2);
+            const T c = r / lkk;
+            const T s = w[k] / lkk;
+            l(k, k) = r;
+            for (size_t i = k + 1; i < n; ++i) {
+                const T lik = (l(i, k) + sign * s * w[i]) / c;
+                l(i, k) = lik;
+                w[i] = c * w[i] - s * lik;
+            }
+        }
+        return true;
+    }
+
+}
+
+template <class T>
+BasicCholesky<T>::BasicCholesky(const BasicConstMatrixView<T>& a) : l(a.rows(), a.cols()) {
+    if (a.rows() != a.cols()) {
+        throw std::invalid_argument("Matrix must be square to compute Cholesky factorization.");
+    }
+    const size_t n = a.rows();
+    for (size_t i = 0; i < n; ++i) {
+        std::copy(a.row(i), a.row(i) + i + 1, l.row(i));
+    }
+    const size_t k = mat_kernels::cholesky_factor(n, l.data(), l.stride());
+    if (k != n) {
+        throw std::runtime_error("Matrix is not positive definite: pivot " + std::to_string(k) + " is not positive.");
+    }
+    // The trailing updates also write above the diagonal of the diagonal blocks.
+    for (size_t i = 0; i < n; ++i) {
+        std::fill(l.row(i) + i + 1, l.row(i) + n, T(0));
+    }
+}
+
+template <class T>
+BasicMatrix<T> BasicCholesky<T>::solve(const BasicConstMatrixView<T>& b) const {
+    if (b.rows() != size()) {
+        throw std::invalid_argument("Matrix dimensions must agree.");
+    }
+    BasicMatrix<T> x(b.rows(), b.cols());
+    for (size_t i = 0; i < b.rows(); ++i) {
+        std::copy(b.row(i), b.row(i) + b.cols(), x.row(i));
+    }
+    mat_kernels::cholesky_solve(size(), x.cols(), l.data(), l.stride(), x.data(), x.stride());
+    return x;
+}
+
+template <class T>
+std::vector<T> BasicCholesky<T>::solve(const std::vector<T>& b) const {
+    if (b.size() != size()) {
+        throw std::invalid_argument("Matrix dimensions must agree.");
+    }
+    std::vector<T> x(b);
+    mat_kernels::cholesky_solve(size(), 1, l.data(), l.stride(), x.data(), 1);
+    return x;
+}
+
+template <class T>
+BasicMatrix<T> BasicCholesky<T>::inverse() const {
+    const size_t n = size();
+    BasicMatrix<T> inv(n, n);
+    for (size_t i = 0; i < n; ++i) {
+        inv(i, i) = T(1);
+    }
+    mat_kernels::cholesky_solve(n, n, l.data(), l.stride(), inv.data(), inv.stride());
+    return inv;
+}
+
+template <class T>
+T BasicCholesky<T>::logdet() const {
+    T sum = 0;
+    for (size_t i = 0; i < size(); ++i) {
+        sum += std::log(l(i, i));
+    }
+    return 2 * sum;
+}
+
+template <class T>
+void BasicCholesky<T>::update(const std::vector<T>& x) {
+    if (x.size() != size()) {
+        throw std::invalid_argument("Matrix dimensions must agree.");
+    }
+    rank_one(l, x, T(1));
+}
+
+template <class T>
+void BasicCholesky<T>::downdate(const std::vector<T>& x) {
+    if (x.size() != size()) {
+        throw std::invalid_argument("Matrix dimensions must agree.");
+    }
+    BasicMatrix<T> next(l);
+    if (!rank_one(next, x, T(-1))) {
+        throw std::runtime_error("Matrix is not positive definite after the downdate.");
+    }
+    l = std::move(next);
+}
+
+template class BasicCholesky<float>;
+template class BasicCholesky<double>;
+template class BasicCholesky<long double>;
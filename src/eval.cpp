@@ -0,0 +1,753 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "mat_eval.h"
+#include "mat_chain.h"
+#include "mat_kernels.h"
+#include "mat_parallel.h"
+
+namespace {
+
+    /**
+    * Binding powers of the Pratt parser; 0 means the character is not a binary operator.
+    */
+    constexpr int additive_power = 10;
+    constexpr int multiplicative_power = 20;
+    constexpr int prefix_power = 30;
+
+    int binary_power(char c) {
+        switch (c) {
+            case '+':
+            case '-':
+                return additive_power;
+            case '*':
+                return multiplicative_power;
+            default:
+                return 0;
+        }
+    }
+
+    /**
+    * Deepest nesting of parentheses and operators accepted. Evaluating,
+    * interning and releasing a tree recurse once per level, so a deeper one
+    * could overflow the stack.
+    */
+    constexpr size_t max_expression_depth = 1000;
+
+    /**
+    * A parsed subtree and its height, the number of nodes on its longest path to a leaf.
+    */
+    struct Parsed {
+        ExprPtr node;
+        size_t height;
+    };
+
+    class Parser {
+        const std::string& text;
+        size_t pos = 0;
+        size_t nesting = 0; //< Calls of parse in progress
+
+        [[noreturn]] void fail(const std::string& what) const {
+            throw std::invalid_argument(what + " at position " + std::to_string(pos) + ".");
+        }
+
+        char peek() {
+            while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) {
+                ++pos;
+            }
+            return pos < text.size() ? text[pos] : '\0';
+        }
+
+        Parsed make_node(ExprNode::Op op, std::vector<Parsed> args) {
+            auto node = std::make_shared<ExprNode>();
+            node->op = op;
+            size_t height = 0;
+            for (Parsed& arg : args) {
+                height = std::max(height, arg.height);
+                node->args.push_back(std::move(arg.node));
+            }
+            if (height + 1 > max_expression_depth) {
+                fail("Expression nested too deeply");
+            }
+            return {std::move(node), height + 1};
+        }
+
+        Parsed parse_primary() {
+            const char c = peek();
+            if (c == '(') {
+                ++pos;
+                Parsed inner = parse(0);
+                if (peek() != ')') {
+                    fail("Expected ')'");
+                }
+                ++pos;
+                return inner;
+            }
+            if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+                const size_t start = pos;
+                while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_')) {
+                    ++pos;
+                }
+                auto node = std::make_shared<ExprNode>();
+                node->op = ExprNode::Op::matrix;
+                node->name = text.substr(start, pos - start);
+                return {std::move(node), 1};
+            }
+            if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+                // from_chars ignores the locale and accepts only decimal notation, no hex, inf or nan.
+                const char* first = text.data() + pos;
+                double value = 0;
+                const std::from_chars_result r = std::from_chars(first, text.data() + text.size(), value,
+                                                                 std::chars_format::general);
+                if (r.ec != std::errc()) {
+                    fail("Malformed number");
+                }
+                pos += static_cast<size_t>(r.ptr - first);
+                auto node = std::make_shared<ExprNode>();
+                node->op = ExprNode::Op::number;
+                node->value = value;
+                return {std::move(node), 1};
+            }
+            ExprNode::Op op;
+            switch (c) {
+                case '!': op = ExprNode::Op::transpose; break;
+                case '~': op = ExprNode::Op::inverse; break;
+                case '*': op = ExprNode::Op::determinant; break;
+                case '-': op = ExprNode::Op::neg; break;
+                case '\0': fail("Unexpected end of expression");
+                default: fail(std::string("Unexpected '") + c + "'");
+            }
+            ++pos;
+            return make_node(op, {parse(prefix_power)});
+        }
+
+    public:
+        explicit Parser(const std::string& text) : text(text) {}
+
+        /**
+        * Parses operators that bind tighter than min_power; binary operators are left associative.
+        */
+        Parsed parse(int min_power) {
+            if (++nesting > max_expression_depth) {
+                fail("Expression nested too deeply");
+            }
+            Parsed lhs = parse_primary();
+            for (;;) {
+                const char c = peek();
+                const int power = binary_power(c);
+                if (power == 0 || power <= min_power) {
+                    --nesting;
+                    return lhs;
+                }
+                ++pos;
+                Parsed rhs = parse(power);
+                const ExprNode::Op op = c == '+' ? ExprNode::Op::add : c == '-' ? ExprNode::Op::sub : ExprNode::Op::mul;
+                lhs = make_node(op, {std::move(lhs), std::move(rhs)});
+            }
+        }
+
+        ExprPtr parse_all() {
+            Parsed root = parse(0);
+            const char c = peek();
+            if (c != '\0') {
+                fail(std::string("Unexpected '") + c + "'");
+            }
+            return std::move(root.node);
+        }
+    };
+
+    /**
+    * An intermediate result: a scalar, a borrowed matrix from the lookup, a
+    * matrix shared with the cache, or a matrix owned by the evaluation whose
+    * buffer may be reused.
+    */
+    struct Value {
+        double scalar = 0;
+        const Matrix* borrowed = nullptr; //< Points into shared when that is set
+        std::shared_ptr<const Matrix> shared;
+        std::optional<Matrix> owned;
+
+        bool is_matrix() const { return borrowed != nullptr || owned.has_value(); }
+        const Matrix& matrix() const { return owned ? *owned : *borrowed; }
+        Matrix take() { return owned ? std::move(*owned) : Matrix(*borrowed); }
+    };
+
+    Value make_scalar(double v) {
+        Value r;
+        r.scalar = v;
+        return r;
+    }
+
+    Value make_owned(Matrix m) {
+        Value r;
+        r.owned.emplace(std::move(m));
+        return r;
+    }
+
+    /**
+    * Moves an owned matrix into shared storage, so the value can be copied cheaply.
+    */
+    Value make_shared_value(Value v) {
+        if (v.owned) {
+            v.shared = std::make_shared<const Matrix>(std::move(*v.owned));
+            v.borrowed = v.shared.get();
+            v.owned.reset();
+        }
+        return v;
+    }
+
+    Value from_cached(const ExprCache::Result& r) {
+        if (const double* scalar = std::get_if<double>(&r)) {
+            return make_scalar(*scalar);
+        }
+        Value v;
+        v.shared = std::get<std::shared_ptr<const Matrix>>(r);
+        v.borrowed = v.shared.get();
+        return v;
+    }
+
+    ExprCache::Result to_cached(const Value& v) {
+        if (!v.is_matrix()) {
+            return v.scalar;
+        }
+        return v.shared;
+    }
+
+    /**
+    * Nodes worth caching across evaluations even when they occur once: those costing O(n^3).
+    */
+    bool is_expensive(ExprNode::Op op) {
+        return op == ExprNode::Op::mul || op == ExprNode::Op::inverse || op == ExprNode::Op::determinant;
+    }
+
+    const Matrix& require_matrix(const Value& v, const char* what) {
+        if (!v.is_matrix()) {
+            throw std::invalid_argument(std::string(what) + " needs a matrix operand.");
+        }
+        return v.matrix();
+    }
+
+    /**
+    * Shape of a value, as far as it is known before evaluation.
+    */
+    struct Shape {
+        bool scalar = true;
+        size_t rows = 0;
+        size_t cols = 0;
+    };
+
+    Shape shape_of(const Value& v) {
+        if (!v.is_matrix()) {
+            return {};
+        }
+        return {false, v.matrix().rows(), v.matrix().cols()};
+    }
+
+    /**
+    * Evaluates a hash-consed tree in two steps.
+    *
+    * plan() walks the tree once and gives every distinct leaf and every node
+    * computed as a whole (a slot) its place: leaves and cache hits are
+    * resolved on the spot, the other nodes become tasks that depend on the
+    * tasks of their operands. Products are flattened into one chain as far as
+    * the nested products are not reused, so each chain is one task.
+    *
+    * The tasks then run either in order on the calling thread, where each
+    * product may use the whole pool, or as a graph on the pool with one
+    * thread per task (see choose_parallel).
+    */
+    class Evaluator {
+        struct Task {
+            ExprPtr node;
+            size_t slot;
+            std::vector<size_t> deps; //< Tasks computing operands
+            double flops; //< Cost estimate
+        };
+
+        static constexpr size_t no_task = static_cast<size_t>(-1);
+
+        const MatrixLookup& lookup;
+        EvalStats* stats;
+        ExprCache& table;
+        bool persistent; //< Whether table keeps results beyond this evaluation
+        const ExprNode* root = nullptr;
+        std::mutex mutex; //< Guards table and stats while tasks run concurrently
+
+        std::unordered_map<const ExprNode*, size_t> slot_of;
+        std::vector<Value> slots;
+        std::vector<Shape> shapes;
+        std::vector<size_t> task_of; //< Task of each slot, or no_task when resolved while planning
+        std::vector<Task> tasks; //< In dependency order: operands come first
+
+        bool reusable(const ExprNode& node) const {
+            return table.shared(node) || (persistent && table.contains(node));
+        }
+
+        bool cacheable(const ExprNode& node) const {
+            return persistent && (table.shared(node) || (is_expensive(node.op) && &node != root));
+        }
+
+        void count_reuse() {
+            if (stats != nullptr) {
+                ++stats->reused;
+            }
+        }
+
+        size_t add_slot(const ExprPtr& node, Value v, Shape shape) {
+            slot_of.emplace(node.get(), slots.size());
+            slots.push_back(std::move(v));
+            shapes.push_back(shape);
+            task_of.push_back(no_task);
+            return slots.size() - 1;
+        }
+
+        void plan_factors(const ExprPtr& node, std::vector<size_t>& factors) {
+            if (node->op == ExprNode::Op::mul && !reusable(*node)) {
+                plan_factors(node->args[0], factors);
+                plan_factors(node->args[1], factors);
+            } else {
+                factors.push_back(plan(node));
+            }
+        }
+
+        /**
+        * Estimates the result shape and the flops of a node from its operand slots.
+        * Operands that do not fit are left for the task to report.
+        */
+        std::pair<Shape, double> estimate(ExprNode::Op op, const std::vector<size_t>& operands) const {
+            const Shape& a = shapes[operands[0]];
+            const double n = static_cast<double>(a.rows);
+            const double elements = static_cast<double>(a.rows * a.cols);
+            switch (op) {
+                case ExprNode::Op::add:
+                case ExprNode::Op::sub:
+                    return {a.scalar ? shapes[operands[1]] : a, elements};
+                case ExprNode::Op::neg:
+                    return {a, elements};
+                case ExprNode::Op::transpose:
+                    return {Shape{a.scalar, a.cols, a.rows}, elements};
+                case ExprNode::Op::inverse:
+                    return {a, 2 * n * n * n};
+                case ExprNode::Op::determinant:
+                    return {Shape{}, 2.0 / 3.0 * n * n * n};
+                case ExprNode::Op::mul: {
+                    std::vector<std::pair<size_t, size_t>> chain;
+                    for (size_t i : operands) {
+                        if (!shapes[i].scalar) {
+                            chain.emplace_back(shapes[i].rows, shapes[i].cols);
+                        }
+                    }
+                    if (chain.empty()) {
+                        return {Shape{}, 0};
+                    }
+                    const Shape result{false, chain.front().first, chain.back().second};
+                    if (chain.size() == 1) {
+                        return {result, static_cast<double>(result.rows * result.cols)};
+                    }
+                    try {
+                        return {result, plan_chain(chain).flops};
+                    } catch (const std::invalid_argument&) {
+                        return {result, 0};
+                    }
+                }
+                default:
+                    return {Shape{}, 0};
+            }
+        }
+
+        size_t plan(const ExprPtr& node) {
+            auto it = slot_of.find(node.get());
+            if (it != slot_of.end()) {
+                if (node->op != ExprNode::Op::matrix && node->op != ExprNode::Op::number) {
+                    count_reuse();
+                }
+                return it->second;
+            }
+            if (node->op == ExprNode::Op::matrix) {
+                Value v;
+                v.borrowed = &lookup(node->name);
+                const Shape shape = shape_of(v);
+                return add_slot(node, std::move(v), shape);
+            }
+            if (node->op == ExprNode::Op::number) {
+                return add_slot(node, make_scalar(node->value), Shape{});
+            }
+            if (cacheable(*node)) {
+                if (const ExprCache::Result* hit = table.find(*node)) {
+                    count_reuse();
+                    Value v = from_cached(*hit);
+                    const Shape shape = shape_of(v);
+                    return add_slot(node, std::move(v), shape);
+                }
+            }
+
+            std::vector<size_t> operands;
+            if (node->op == ExprNode::Op::mul) {
+                plan_factors(node->args[0], operands);
+                plan_factors(node->args[1], operands);
+            } else {
+                for (const ExprPtr& arg : node->args) {
+                    operands.push_back(plan(arg));
+                }
+            }
+            Task task{node, 0, {}, 0};
+            for (size_t i : operands) {
+                if (task_of[i] != no_task) {
+                    task.deps.push_back(task_of[i]);
+                }
+            }
+            std::sort(task.deps.begin(), task.deps.end());
+            task.deps.erase(std::unique(task.deps.begin(), task.deps.end()), task.deps.end());
+            const auto [shape, flops] = estimate(node->op, operands);
+            task.flops = flops;
+            task.slot = add_slot(node, Value(), shape);
+            task_of[task.slot] = tasks.size();
+            tasks.push_back(std::move(task));
+            return tasks.back().slot;
+        }
+
+        /**
+        * Takes the value of an operand; a matrix only this node uses is moved out so its buffer can be reused.
+        */
+        Value operand(const ExprPtr& node) {
+            Value& slot = slots[slot_of.at(node.get())];
+            if (slot.owned) {
+                Value v = std::move(slot);
+                slot = Value();
+                return v;
+            }
+            return slot;
+        }
+
+        /**
+        * Appends the factors of a product; nested products without a slot of their own were flattened while planning.
+        */
+        void collect_factors(const ExprPtr& node, std::vector<Value>& factors) {
+            if (node->op == ExprNode::Op::mul && slot_of.count(node.get()) == 0) {
+                collect_factors(node->args[0], factors);
+                collect_factors(node->args[1], factors);
+            } else {
+                factors.push_back(operand(node));
+            }
+        }
+
+        void record_products(size_t products, double flops) {
+            if (stats != nullptr) {
+                std::lock_guard<std::mutex> lock(mutex);
+                stats->products += products;
+                stats->gemm_flops += flops;
+            }
+        }
+
+        Value eval_product(const ExprPtr& node) {
+            std::vector<Value> factors;
+            collect_factors(node->args[0], factors);
+            collect_factors(node->args[1], factors);
+
+            double coefficient = 1.0;
+            std::vector<size_t> matrices;
+            for (size_t i = 0; i < factors.size(); ++i) {
+                if (factors[i].is_matrix()) {
+                    matrices.push_back(i);
+                } else {
+                    coefficient *= factors[i].scalar;
+                }
+            }
+            if (matrices.empty()) {
+                return make_scalar(coefficient);
+            }
+
+            Matrix result = matrices.size() == 1 ? factors[matrices[0]].take() : [&] {
+                std::vector<const Matrix*> chain;
+                chain.reserve(matrices.size());
+                for (size_t i : matrices) {
+                    chain.push_back(&factors[i].matrix());
+                }
+                double flops = 0;
+                Matrix product = multiply_chain(chain, &flops);
+                record_products(matrices.size() - 1, flops);
+                return product;
+            }();
+            if (coefficient != 1.0) {
+                result *= coefficient;
+            }
+            return make_owned(std::move(result));
+        }
+
+        Value eval_additive(const ExprPtr& node) {
+            const bool subtract = node->op == ExprNode::Op::sub;
+            Value l = operand(node->args[0]);
+            Value r = operand(node->args[1]);
+            if (!l.is_matrix() && !r.is_matrix()) {
+                return make_scalar(subtract ? l.scalar - r.scalar : l.scalar + r.scalar);
+            }
+            if (!l.is_matrix() || !r.is_matrix()) {
+                throw std::invalid_argument("Cannot add or subtract a scalar and a matrix.");
+            }
+            if (l.owned) {
+                return make_owned(subtract ? std::move(*l.owned) - r.matrix() : std::move(*l.owned) + r.matrix());
+            }
+            if (r.owned) {
+                return make_owned(subtract ? l.matrix() - std::move(*r.owned) : l.matrix() + std::move(*r.owned));
+            }
+            return make_owned(subtract ? Matrix(l.matrix() - r.matrix()) : Matrix(l.matrix() + r.matrix()));
+        }
+
+        Value compute(const ExprPtr& node) {
+            switch (node->op) {
+                case ExprNode::Op::matrix:
+                case ExprNode::Op::number:
+                    return operand(node);
+                case ExprNode::Op::add:
+                case ExprNode::Op::sub:
+                    return eval_additive(node);
+                case ExprNode::Op::mul:
+                    return eval_product(node);
+                case ExprNode::Op::neg: {
+                    Value v = operand(node->args[0]);
+                    if (!v.is_matrix()) {
+                        return make_scalar(-v.scalar);
+                    }
+                    return make_owned(v.take() * -1.0);
+                }
+                case ExprNode::Op::transpose:
+                    return make_owned(!require_matrix(operand(node->args[0]), "Transposition"));
+                case ExprNode::Op::inverse:
+                    return make_owned(~require_matrix(operand(node->args[0]), "Inversion"));
+                case ExprNode::Op::determinant:
+                    return make_scalar(*require_matrix(operand(node->args[0]), "The determinant"));
+            }
+            throw std::invalid_argument("Unknown expression node.");
+        }
+
+        void run_task(size_t t) {
+            const Task& task = tasks[t];
+            Value v = compute(task.node);
+            const bool keep = cacheable(*task.node);
+            if (keep || table.shared(*task.node)) {
+                v = make_shared_value(std::move(v));
+            }
+            if (keep) {
+                std::lock_guard<std::mutex> lock(mutex);
+                table.insert(*task.node, to_cached(v));
+            }
+            slots[task.slot] = std::move(v);
+        }
+
+        /**
+        * Decides between running the tasks as a graph, one thread per task
+        * with serial products inside, and running them in order with each
+        * product spread over the pool. The graph pays off when the work is
+        * large enough to amortize waking the pool and there are at least two
+        * independent branches (work / span >= 2), as long as the tasks are
+        * too small for a threaded product or there are enough branches to
+        * occupy every thread; otherwise threading inside each product wins.
+        */
+        bool choose_parallel() const {
+            const size_t threads = mat_parallel::num_threads();
+            if (threads < 2 || tasks.size() < 2) {
+                return false;
+            }
+            std::vector<double> finish(tasks.size());
+            double work = 0, span = 0, largest = 0;
+            for (size_t t = 0; t < tasks.size(); ++t) {
+                double start = 0;
+                for (size_t d : tasks[t].deps) {
+                    start = std::max(start, finish[d]);
+                }
+                finish[t] = start + tasks[t].flops;
+                work += tasks[t].flops;
+                span = std::max(span, finish[t]);
+                largest = std::max(largest, tasks[t].flops);
+            }
+            const double threaded_product = 2.0 * static_cast<double>(mat_kernels::gemm_parallel_threshold);
+            return work >= eval_parallel_flops && work >= 2 * span &&
+                   (largest < threaded_product || work >= span * static_cast<double>(threads));
+        }
+
+    public:
+        Evaluator(const MatrixLookup& lookup, EvalStats* stats, ExprCache& table, bool persistent)
+            : lookup(lookup), stats(stats), table(table), persistent(persistent) {}
+
+        Value run(const ExprPtr& expr) {
+            root = expr.get();
+            const size_t result = plan(expr);
+            if (choose_parallel()) {
+                std::vector<std::vector<size_t>> dependents(tasks.size());
+                for (size_t t = 0; t < tasks.size(); ++t) {
+                    for (size_t d : tasks[t].deps) {
+                        dependents[d].push_back(t);
+                    }
+                }
+                if (stats != nullptr) {
+                    stats->parallel = true;
+                }
+                mat_parallel::run_graph(dependents, [&](size_t t) { run_task(t); });
+            } else {
+                for (size_t t = 0; t < tasks.size(); ++t) {
+                    run_task(t);
+                }
+            }
+            return std::move(slots[result]);
+        }
+    };
+
+    size_t result_bytes(const ExprCache::Result& r) {
+        if (const auto* m = std::get_if<std::shared_ptr<const Matrix>>(&r)) {
+            return sizeof(Matrix) + (*m)->rows() * (*m)->cols() * sizeof(double);
+        }
+        return sizeof(double);
+    }
+
+}
+
+    ExprPtr parse_expression(const std::string& text) {
+        return Parser(text).parse_all();
+    }
+
+    std::string to_string(const ExprNode& node) {
+        switch (node.op) {
+            case ExprNode::Op::matrix:
+                return node.name;
+            case ExprNode::Op::number: {
+                char buf[32];
+                auto res = std::to_chars(buf, buf + sizeof(buf), node.value);
+                return std::string(buf, res.ptr);
+            }
+            case ExprNode::Op::add:
+                return "(" + to_string(*node.args[0]) + " + " + to_string(*node.args[1]) + ")";
+            case ExprNode::Op::sub:
+                return "(" + to_string(*node.args[0]) + " - " + to_string(*node.args[1]) + ")";
+            case ExprNode::Op::mul:
+                return "(" + to_string(*node.args[0]) + " * " + to_string(*node.args[1]) + ")";
+            case ExprNode::Op::neg:
+                return "-(" + to_string(*node.args[0]) + ")";
+            case ExprNode::Op::transpose:
+                return "!(" + to_string(*node.args[0]) + ")";
+            case ExprNode::Op::inverse:
+                return "~(" + to_string(*node.args[0]) + ")";
+            case ExprNode::Op::determinant:
+                return "*(" + to_string(*node.args[0]) + ")";
+        }
+        return {};
+    }
+
+    bool ExprCache::Key::operator==(const Key& other) const {
+        return op == other.op && name == other.name && std::memcmp(&value, &other.value, sizeof(value)) == 0 &&
+               lhs == other.lhs && rhs == other.rhs;
+    }
+
+    size_t ExprCache::KeyHash::operator()(const Key& key) const {
+        std::uint64_t bits;
+        std::memcpy(&bits, &key.value, sizeof(bits));
+        size_t h = std::hash<std::string>()(key.name);
+        for (size_t part : {static_cast<size_t>(key.op), static_cast<size_t>(bits),
+                            reinterpret_cast<size_t>(key.lhs), reinterpret_cast<size_t>(key.rhs)}) {
+            h ^= part + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+        }
+        return h;
+    }
+
+    ExprCache::ExprCache(size_t budget) : limit(budget) {}
+
+    ExprPtr ExprCache::intern_node(const ExprPtr& node) {
+        std::vector<ExprPtr> args;
+        args.reserve(node->args.size());
+        for (const ExprPtr& arg : node->args) {
+            args.push_back(intern_node(arg));
+        }
+        Key key{node->op, node->name, node->value, args.size() > 0 ? args[0].get() : nullptr,
+                args.size() > 1 ? args[1].get() : nullptr};
+        auto it = nodes.find(key);
+        if (it != nodes.end()) {
+            return it->second;
+        }
+        auto canonical = std::make_shared<ExprNode>();
+        canonical->op = node->op;
+        canonical->name = node->name;
+        canonical->value = node->value;
+        canonical->args = std::move(args);
+        for (const ExprPtr& arg : canonical->args) {
+            ++uses[arg.get()];
+        }
+        nodes.emplace(std::move(key), canonical);
+        return canonical;
+    }
+
+    ExprPtr ExprCache::intern(const ExprPtr& expr) {
+        ExprPtr canonical = intern_node(expr);
+        if (roots.insert(canonical.get()).second) {
+            ++uses[canonical.get()];
+        }
+        return canonical;
+    }
+
+    bool ExprCache::shared(const ExprNode& node) const {
+        auto it = uses.find(&node);
+        return it != uses.end() && it->second > 1;
+    }
+
+    const ExprCache::Result* ExprCache::find(const ExprNode& node) {
+        auto it = entries.find(&node);
+        if (it == entries.end()) {
+            ++miss_count;
+            return nullptr;
+        }
+        ++hit_count;
+        recency.splice(recency.begin(), recency, it->second.pos);
+        return &it->second.value;
+    }
+
+    void ExprCache::insert(const ExprNode& node, Result value) {
+        const size_t bytes = result_bytes(value);
+        if (bytes > limit || entries.count(&node) != 0) {
+            return;
+        }
+        while (used + bytes > limit) {
+            auto victim = entries.find(recency.back());
+            used -= victim->second.bytes;
+            entries.erase(victim);
+            recency.pop_back();
+        }
+        recency.push_front(&node);
+        entries.emplace(&node, Entry{std::move(value), bytes, recency.begin()});
+        used += bytes;
+    }
+
+    void ExprCache::clear() {
+        entries.clear();
+        recency.clear();
+        used = 0;
+    }
+
+    void ExprCache::reset() {
+        clear();
+        nodes.clear();
+        uses.clear();
+        roots.clear();
+    }
+
+    ExprValue evaluate(const ExprPtr& expr, const MatrixLookup& lookup, EvalStats* stats) {
+        ExprCache table(0);
+        Value v = Evaluator(lookup, stats, table, false).run(table.intern(expr));
+        if (!v.is_matrix()) {
+            return v.scalar;
+        }
+        return v.take();
+    }
+
+    ExprValue evaluate(const ExprPtr& expr, const MatrixLookup& lookup, ExprCache& cache, EvalStats* stats) {
+        Value v = Evaluator(lookup, stats, cache, true).run(cache.intern(expr));
+        if (!v.is_matrix()) {
+            return v.scalar;
+        }
+        return v.take();
+    }
@@ -0,0 +1,417 @@
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+#include "mat_alloc.h"
+#include "mat_kernels.h"
+#include "mat_parallel.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MAT_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace mat_kernels {
+
+namespace {
+
+    template <class T>
+    using PackBuffer = std::vector<T, AlignedAllocator<T>>;
+
+    /**
+    * Element (i, j) of an operand lives at ptr[i * rs + j * cs]; a transposed
+    * operand simply swaps the two strides, so it is never copied.
+    */
+    struct Strides {
+        std::size_t rs, cs;
+    };
+
+    Strides strides_of(Transpose t, std::size_t ld) {
+        return t == Transpose::no ? Strides{ld, 1} : Strides{1, ld};
+    }
+
+    /**
+    * Packs an mc x kc block of A into MR-row slivers stored column by column,
+    * zero-padding the last sliver to a full MR rows.
+    */
+    template <std::size_t MR, class T>
+    void pack_a(std::size_t mc, std::size_t kc, const T* A, Strides sa, T* buf) {
+        for (std::size_t i = 0; i < mc; i += MR) {
+            std::size_t mr = std::min(MR, mc - i);
+            const T* a = A + i * sa.rs;
+            for (std::size_t p = 0; p < kc; ++p) {
+                std::size_t r = 0;
+                for (; r < mr; ++r) {
+                    buf[r] = a[r * sa.rs + p * sa.cs];
+                }
+                for (; r < MR; ++r) {
+                    buf[r] = T(0);
+                }
+                buf += MR;
+            }
+        }
+    }
+
+    /**
+    * Packs a kc x nc panel of B into NR-column slivers stored row by row,
+    * zero-padding the last sliver to a full NR columns.
+    */
+    template <std::size_t NR, class T>
+    void pack_b(std::size_t kc, std::size_t nc, const T* B, Strides sb, T* buf) {
+        for (std::size_t j = 0; j < nc; j += NR) {
+            std::size_t nr = std::min(NR, nc - j);
+            for (std::size_t p = 0; p < kc; ++p) {
+                const T* b = B + p * sb.rs + j * sb.cs;
+                std::size_t c = 0;
+                for (; c < nr; ++c) {
+                    buf[c] = b[c * sb.cs];
+                }
+                for (; c < NR; ++c) {
+                    buf[c] = T(0);
+                }
+                buf += NR;
+            }
+        }
+    }
+
+    /**
+    * A micro-kernel and the blocking built around it. The register tile is
+    * MR rows of A times NR columns of B kept in accumulators; the cache tiles
+    * are an MC x KC block of A for L2 and a KC x NC panel of B for L3, with
+    * one KC x NR sliver of B plus an MR x KC sliver of A in L1. run multiplies
+    * one packed MR x kc sliver of A by one packed kc x NR sliver of B and
+    * adds alpha times the result to the mr x nr corner of C.
+    */
+    template <class T>
+    struct GenericKernel {
+        static constexpr std::size_t MR = 4;
+        static constexpr std::size_t NR = 8;
+        static constexpr std::size_t KC = 256;
+        static constexpr std::size_t MC = 128;
+        static constexpr std::size_t NC = 2048;
+
+        static void run(std::size_t kc, T alpha, const T* a, const T* b,
+                        T* C, std::size_t ldc, std::size_t mr, std::size_t nr) {
+            alignas(64) T acc[MR * NR] = {};
+            for (std::size_t p = 0; p < kc; ++p) {
+                for (std::size_t r = 0; r < MR; ++r) {
+                    const T ar = a[r];
+                    for (std::size_t c = 0; c < NR; ++c) {
+                        acc[r * NR + c] += ar * b[c];
+                    }
+                }
+                a += MR;
+                b += NR;
+            }
+            for (std::size_t r = 0; r < mr; ++r) {
+                T* crow = C + r * ldc;
+                for (std::size_t c = 0; c < nr; ++c) {
+                    crow[c] += alpha * acc[r * NR + c];
+                }
+            }
+        }
+    };
+
+#ifdef MAT_X86_DISPATCH
+
+    // The vector kernels hold an MR x NR tile of C in MR * NR / W registers
+    // of W doubles, broadcast one element of A per row and load NR / W
+    // vectors of B per step of k. A partial tile is accumulated in full
+    // (the packed operands are zero-padded) and only its corner is stored.
+    // The accumulators are spilled to a tile in one fully unrolled loop; if
+    // any access to them keeps a variable index, GCC keeps the whole array in
+    // memory and stores it on every step of k.
+
+    /**
+    * AVX2 has 16 ymm registers: a 6 x 8 tile takes 12 accumulators, leaving
+    * two for B and one for the broadcast of A.
+    */
+    struct Avx2Kernel {
+        static constexpr std::size_t MR = 6;
+        static constexpr std::size_t NR = 8;
+        static constexpr std::size_t KC = 256;
+        static constexpr std::size_t MC = 120;
+        static constexpr std::size_t NC = 2048;
+
+        __attribute__((target("avx2,fma")))
+        static void run(std::size_t kc, double alpha, const double* a, const double* b,
+                        double* C, std::size_t ldc, std::size_t mr, std::size_t nr) {
+            constexpr std::size_t NV = NR / 4;
+            __m256d acc[MR][NV] = {};
+            for (std::size_t p = 0; p < kc; ++p) {
+                __m256d bv[NV];
+                for (std::size_t v = 0; v < NV; ++v) {
+                    bv[v] = _mm256_load_pd(b + 4 * v);
+                }
+                for (std::size_t r = 0; r < MR; ++r) {
+                    const __m256d ar = _mm256_broadcast_sd(a + r);
+                    for (std::size_t v = 0; v < NV; ++v) {
+                        acc[r][v] = _mm256_fmadd_pd(ar, bv[v], acc[r][v]);
+                    }
+                }
+                a += MR;
+                b += NR;
+            }
+            alignas(32) double tile[MR * NR];
+            #pragma GCC unroll 16
+            for (std::size_t r = 0; r < MR; ++r) {
+                #pragma GCC unroll 16
+                for (std::size_t v = 0; v < NV; ++v) {
+                    _mm256_store_pd(tile + r * NR + 4 * v, acc[r][v]);
+                }
+            }
+            if (mr == MR && nr == NR) {
+                const __m256d va = _mm256_set1_pd(alpha);
+                for (std::size_t r = 0; r < MR; ++r) {
+                    double* crow = C + r * ldc;
+                    for (std::size_t v = 0; v < NV; ++v) {
+                        _mm256_storeu_pd(crow + 4 * v, _mm256_fmadd_pd(va, _mm256_load_pd(tile + r * NR + 4 * v),
+                                                                _mm256_loadu_pd(crow + 4 * v)));
+                    }
+                }
+                return;
+            }
+            for (std::size_t r = 0; r < mr; ++r) {
+                double* crow = C + r * ldc;
+                for (std::size_t c = 0; c < nr; ++c) {
+                    crow[c] += alpha * tile[r * NR + c];
+                }
+            }
+        }
+    };
+
+    /**
+    * AVX-512 has 32 zmm registers: an 8 x 24 tile takes 24 accumulators,
+    * leaving three for B and one for the broadcast of A.
+    */
+    struct Avx512Kernel {
+        static constexpr std::size_t MR = 8;
+        static constexpr std::size_t NR = 24;
+        static constexpr std::size_t KC = 256;
+        static constexpr std::size_t MC = 128;
+        static constexpr std::size_t NC = 2016;
+
+        __attribute__((target("avx512f")))
+        static void run(std::size_t kc, double alpha, const double* a, const double* b,
+                        double* C, std::size_t ldc, std::size_t mr, std::size_t nr) {
+            constexpr std::size_t NV = NR / 8;
+            __m512d acc[MR][NV] = {};
+            for (std::size_t p = 0; p < kc; ++p) {
+                __m512d bv[NV];
+                for (std::size_t v = 0; v < NV; ++v) {
+                    bv[v] = _mm512_load_pd(b + 8 * v);
+                }
+                for (std::size_t r = 0; r < MR; ++r) {
+                    const __m512d ar = _mm512_set1_pd(a[r]);
+                    for (std::size_t v = 0; v < NV; ++v) {
+                        acc[r][v] = _mm512_fmadd_pd(ar, bv[v], acc[r][v]);
+                    }
+                }
+                a += MR;
+                b += NR;
+            }
+            alignas(64) double tile[MR * NR];
+            #pragma GCC unroll 16
+            for (std::size_t r = 0; r < MR; ++r) {
+                #pragma GCC unroll 16
+                for (std::size_t v = 0; v < NV; ++v) {
+                    _mm512_store_pd(tile + r * NR + 8 * v, acc[r][v]);
+                }
+            }
+            if (mr == MR && nr == NR) {
+                const __m512d va = _mm512_set1_pd(alpha);
+                for (std::size_t r = 0; r < MR; ++r) {
+                    double* crow = C + r * ldc;
+                    for (std::size_t v = 0; v < NV; ++v) {
+                        _mm512_storeu_pd(crow + 8 * v, _mm512_fmadd_pd(va, _mm512_load_pd(tile + r * NR + 8 * v),
+                                                                _mm512_loadu_pd(crow + 8 * v)));
+                    }
+                }
+                return;
+            }
+            for (std::size_t r = 0; r < mr; ++r) {
+                double* crow = C + r * ldc;
+                for (std::size_t c = 0; c < nr; ++c) {
+                    crow[c] += alpha * tile[r * NR + c];
+                }
+            }
+        }
+    };
+
+#endif
+
+    template <class T>
+    void scale(std::size_t m, std::size_t n, T beta, T* C, std::size_t ldc) {
+        for (std::size_t i = 0; i < m; ++i) {
+            T* c = C + i * ldc;
+            if (beta == T(0)) {
+                std::fill(c, c + n, T(0));
+            } else {
+                for (std::size_t j = 0; j < n; ++j) {
+                    c[j] *= beta;
+                }
+            }
+        }
+    }
+
+    /**
+    * Single-threaded blocked product; each thread in a parallel product runs
+    * this on its own output tile with its own packing buffers.
+    */
+    template <class K, class T>
+    void gemm_serial(std::size_t m, std::size_t n, std::size_t k, T alpha,
+                     const T* A, Strides sa, const T* B, Strides sb,
+                     T beta, T* C, std::size_t ldc) {
+        constexpr std::size_t MR = K::MR, NR = K::NR, KC = K::KC, MC = K::MC, NC = K::NC;
+        static_assert(MC % MR == 0 && NC % NR == 0, "cache tiles must hold whole slivers");
+        if (beta != T(1)) {
+            scale(m, n, beta, C, ldc);
+        }
+        if (m == 0 || n == 0 || k == 0 || alpha == T(0)) {
+            return;
+        }
+
+        thread_local PackBuffer<T> packed_a(MC * KC);
+        thread_local PackBuffer<T> packed_b(KC * NC);
+
+        for (std::size_t jc = 0; jc < n; jc += NC) {
+            std::size_t nc = std::min(NC, n - jc);
+            for (std::size_t pc = 0; pc < k; pc += KC) {
+                std::size_t kc = std::min(KC, k - pc);
+                pack_b<NR>(kc, nc, B + pc * sb.rs + jc * sb.cs, sb, packed_b.data());
+                for (std::size_t ic = 0; ic < m; ic += MC) {
+                    std::size_t mc = std::min(MC, m - ic);
+                    pack_a<MR>(mc, kc, A + ic * sa.rs + pc * sa.cs, sa, packed_a.data());
+                    for (std::size_t jr = 0; jr < nc; jr += NR) {
+                        std::size_t nr = std::min(NR, nc - jr);
+                        for (std::size_t ir = 0; ir < mc; ir += MR) {
+                            std::size_t mr = std::min(MR, mc - ir);
+                            K::run(kc, alpha,
+                                   packed_a.data() + ir * kc,
+                                   packed_b.data() + jr * kc,
+                                   C + (ic + ir) * ldc + jc + jr, ldc, mr, nr);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    template <class K, class T>
+    void gemm_blocked(std::size_t m, std::size_t n, std::size_t k, T alpha,
+                      const T* A, Strides sa, const T* B, Strides sb,
+                      T beta, T* C, std::size_t ldc) {
+        const std::size_t threads = mat_parallel::num_threads();
+        if (threads == 1 || m * n * k < gemm_parallel_threshold) {
+            gemm_serial<K>(m, n, k, alpha, A, sa, B, sb, beta, C, ldc);
+            return;
+        }
+
+        // Split C into independent tiles, shrinking them until there are a
+        // few per thread so that dynamic scheduling can even out the load.
+        // Tiles stay whole multiples of MR x NR, so that only the edges of C
+        // end in zero-padded slivers.
+        constexpr std::size_t MR = K::MR, NR = K::NR;
+        auto halve = [](std::size_t tile, std::size_t unit) { return tile / 2 / unit * unit; };
+        std::size_t tile_m = K::MC;
+        std::size_t tile_n = 4 * K::MC / NR * NR;
+        auto tile_count = [&] { return ((m + tile_m - 1) / tile_m) * ((n + tile_n - 1) / tile_n); };
+        while (tile_count() < 4 * threads && (tile_n > 4 * NR || tile_m > 4 * MR)) {
+            if (tile_n >= tile_m && tile_n > 4 * NR) {
+                tile_n = halve(tile_n, NR);
+            } else {
+                tile_m = halve(tile_m, MR);
+            }
+        }
+        const std::size_t tiles_n = (n + tile_n - 1) / tile_n;
+        mat_parallel::parallel_for(tile_count(), [&](std::size_t t) {
+            const std::size_t i0 = (t / tiles_n) * tile_m;
+            const std::size_t j0 = (t % tiles_n) * tile_n;
+            gemm_serial<K>(std::min(tile_m, m - i0), std::min(tile_n, n - j0), k, alpha,
+                           A + i0 * sa.rs, sa, B + j0 * sb.cs, sb, beta, C + i0 * ldc + j0, ldc);
+        });
+    }
+
+}
+
+    void gemm(std::size_t m, std::size_t n, std::size_t k, double alpha,
+              const double* A, std::size_t lda, const double* B, std::size_t ldb,
+              double beta, double* C, std::size_t ldc) {
+        gemm(Transpose::no, Transpose::no, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+    }
+
+    template <class T>
+    void gemm(Transpose ta, Transpose tb, std::size_t m, std::size_t n, std::size_t k, T alpha,
+              const T* A, std::size_t lda, const T* B, std::size_t ldb,
+              T beta, T* C, std::size_t ldc) {
+        const Strides sa = strides_of(ta, lda);
+        const Strides sb = strides_of(tb, ldb);
+#ifdef MAT_X86_DISPATCH
+        if constexpr (std::is_same_v<T, double>) {
+            if (active_isa() >= Isa::avx512) {
+                gemm_blocked<Avx512Kernel>(m, n, k, alpha, A, sa, B, sb, beta, C, ldc);
+                return;
+            }
+            if (active_isa() >= Isa::avx2) {
+                gemm_blocked<Avx2Kernel>(m, n, k, alpha, A, sa, B, sb, beta, C, ldc);
+                return;
+            }
+        }
+#endif
+        gemm_blocked<GenericKernel<T>>(m, n, k, alpha, A, sa, B, sb, beta, C, ldc);
+    }
+
+    void gemm_small(std::size_t m, std::size_t n, std::size_t k,
+                    const double* A, std::size_t lda, const double* B, std::size_t ldb,
+                    double* C, std::size_t ldc) {
+        gemm_small(Transpose::no, Transpose::no, m, n, k, A, lda, B, ldb, C, ldc);
+    }
+
+    template <class T>
+    void gemm_small(Transpose ta, Transpose tb, std::size_t m, std::size_t n, std::size_t k,
+                    const T* A, std::size_t lda, const T* B, std::size_t ldb,
+                    T* C, std::size_t ldc) {
+        if (ta != Transpose::no || tb != Transpose::no) {
+            const Strides sa = strides_of(ta, lda);
+            const Strides sb = strides_of(tb, ldb);
+            for (std::size_t i = 0; i < m; ++i) {
+                T* c = C + i * ldc;
+                std::fill(c, c + n, T(0));
+                for (std::size_t p = 0; p < k; ++p) {
+                    const T ap = A[i * sa.rs + p * sa.cs];
+                    const T* b = B + p * sb.rs;
+                    for (std::size_t j = 0; j < n; ++j) {
+                        c[j] += ap * b[j * sb.cs];
+                    }
+                }
+            }
+            return;
+        }
+        for (std::size_t i = 0; i < m; ++i) {
+            T* c = C + i * ldc;
+            std::fill(c, c + n, T(0));
+            const T* a = A + i * lda;
+            for (std::size_t p = 0; p < k; ++p) {
+                const T ap = a[p];
+                const T* b = B + p * ldb;
+                for (std::size_t j = 0; j < n; ++j) {
+                    c[j] += ap * b[j];
+                }
+            }
+        }
+    }
+
+#define MAT_INSTANTIATE_GEMM(T) \
+    template void gemm<T>(Transpose, Transpose, std::size_t, std::size_t, std::size_t, T, \
+                          const T*, std::size_t, const T*, std::size_t, T, T*, std::size_t); \
+    template void gemm_small<T>(Transpose, Transpose, std::size_t, std::size_t, std::size_t, \
+                                const T*, std::size_t, const T*, std::size_t, T*, std::size_t);
+
+    MAT_INSTANTIATE_GEMM(float)
+    MAT_INSTANTIATE_GEMM(double)
+    MAT_INSTANTIATE_GEMM(long double)
+    MAT_INSTANTIATE_GEMM(std::complex<double>)
+
+#undef MAT_INSTANTIATE_GEMM
+
+}
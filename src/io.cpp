@@ -0,0 +1,426 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#include "mat_io.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAT_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    constexpr unsigned char magic[8] = {0x89, 'M', 'A', 'T', '\r', '\n', 0x1a, '\n'};
+    constexpr std::size_t header_size = 64;
+    constexpr std::uint32_t data_alignment = 64;
+
+    constexpr std::uint64_t P1 = 11400714785074694791ULL;
+    constexpr std::uint64_t P2 = 14029467366897019727ULL;
+    constexpr std::uint64_t P3 = 1609587929392839161ULL;
+    constexpr std::uint64_t P4 = 9650029242287828579ULL;
+    constexpr std::uint64_t P5 = 2870177450012600261ULL;
+
+    bool host_little_endian() {
+        const std::uint16_t one = 1;
+        unsigned char first;
+        std::memcpy(&first, &one, 1);
+        return first == 1;
+    }
+
+    std::uint64_t get_le(const unsigned char* p, std::size_t bytes) {
+        std::uint64_t v = 0;
+        for (std::size_t i = bytes; i-- > 0;) {
+            v = (v << 8) | p[i];
+        }
+        return v;
+    }
+
+    void put_le(unsigned char* p, std::uint64_t v, std::size_t bytes) {
+        for (std::size_t i = 0; i < bytes; ++i) {
+            p[i] = static_cast<unsigned char>(v >> (8 * i));
+        }
+    }
+
+    std::uint64_t rotl(std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    std::uint64_t xxh_round(std::uint64_t acc, std::uint64_t input) { return rotl(acc + input * P2, 31) * P1; }
+
+    std::uint64_t merge_round(std::uint64_t acc, std::uint64_t v) { return (acc ^ xxh_round(0, v)) * P1 + P4; }
+
+    std::size_t element_size(Dtype dtype) {
+        switch (dtype) {
+            case Dtype::f32: return 4;
+            case Dtype::f64: return 8;
+            case Dtype::c128: return 16;
+        }
+        return 0;
+    }
+
+    [[noreturn]] void invalid_file(const std::string& path, const std::string& what) {
+        throw std::runtime_error("Invalid matrix file " + path + ": " + what);
+    }
+
+    BinaryHeader decode_header(const unsigned char* h, std::size_t available, const std::string& path) {
+        if (available < header_size || std::memcmp(h, magic, sizeof(magic)) != 0) {
+            invalid_file(path, "bad magic (not a matrix file, or its writer was not closed).");
+        }
+        BinaryHeader hdr;
+        hdr.version = static_cast<std::uint16_t>(get_le(h + 8, 2));
+        hdr.dtype = static_cast<Dtype>(h[10]);
+        hdr.little_endian = h[11] == 0;
+        hdr.alignment = static_cast<std::uint32_t>(get_le(h + 12, 4));
+        hdr.rows = get_le(h + 16, 8);
+        hdr.cols = get_le(h + 24, 8);
+        hdr.data_offset = get_le(h + 32, 8);
+        hdr.checksum = get_le(h + 40, 8);
+        if (hdr.version != 1) {
+            invalid_file(path, "unsupported version " + std::to_string(hdr.version) + ".");
+        }
+        if (element_size(hdr.dtype) == 0 || h[11] > 1) {
+            invalid_file(path, "unknown dtype or byte order.");
+        }
+        if (hdr.alignment == 0 || (hdr.alignment & (hdr.alignment - 1)) != 0 ||
+            hdr.data_offset < header_size || hdr.data_offset % hdr.alignment != 0) {
+            invalid_file(path, "bad alignment or data offset.");
+        }
+        if (hdr.rows == 0 || hdr.cols == 0 ||
+            hdr.rows > std::numeric_limits<std::uint64_t>::max() / hdr.cols / element_size(hdr.dtype)) {
+            invalid_file(path, "bad shape.");
+        }
+        return hdr;
+    }
+
+    template <class T>
+    void check_dtype(const BinaryHeader& hdr, const std::string& path) {
+        if (hdr.dtype != dtype_of<T>::value) {
+            throw std::runtime_error("Matrix file " + path + " holds " + dtype_name(hdr.dtype) + " elements, not " +
+                                     dtype_name(dtype_of<T>::value) + ".");
+        }
+    }
+
+    void check_sum(const BinaryHeader& hdr, const void* data, std::size_t bytes, const std::string& path) {
+        Checksum sum;
+        sum.update(data, bytes);
+        if (sum.digest() != hdr.checksum) {
+            invalid_file(path, "checksum mismatch.");
+        }
+    }
+
+    /**
+    * Reverses the bytes of every real component of n elements.
+    */
+    template <class T>
+    void swap_bytes(T* data, std::size_t n) {
+        constexpr std::size_t width = sizeof(mat_kernels::real_type_t<T>);
+        unsigned char* bytes = reinterpret_cast<unsigned char*>(data);
+        for (std::size_t p = 0; p < n * sizeof(T); p += width) {
+            std::reverse(bytes + p, bytes + p + width);
+        }
+    }
+
+}
+
+const char* dtype_name(Dtype dtype) {
+    switch (dtype) {
+        case Dtype::f32: return "float32";
+        case Dtype::f64: return "float64";
+        case Dtype::c128: return "complex128";
+    }
+    return "unknown";
+}
+
+Checksum::Checksum() : v{P1 + P2, P2, 0, 0 - P1}, buf{}, buffered(0), total(0) {}
+
+void Checksum::update(const void* data, std::size_t n) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    total += n;
+    if (buffered > 0) {
+        const std::size_t take = std::min(n, sizeof(buf) - buffered);
+        std::memcpy(buf + buffered, p, take);
+        buffered += take;
+        p += take;
+        n -= take;
+        if (buffered < sizeof(buf)) {
+            return;
+        }
+        for (int lane = 0; lane < 4; ++lane) {
+            v[lane] = xxh_round(v[lane], get_le(buf + 8 * lane, 8));
+        }
+        buffered = 0;
+    }
+    // Four independent lanes keep four multiplies in flight per stripe.
+    std::uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+    for (; n >= 32; p += 32, n -= 32) {
+        std::uint64_t w[4];
+        std::memcpy(w, p, 32);
+        if (!host_little_endian()) {
+            for (std::uint64_t& x : w) {
+                x = get_le(reinterpret_cast<const unsigned char*>(&x), 8);
+            }
+        }
+        v0 = xxh_round(v0, w[0]);
+        v1 = xxh_round(v1, w[1]);
+        v2 = xxh_round(v2, w[2]);
+        v3 = xxh_round(v3, w[3]);
+    }
+    v[0] = v0;
+    v[1] = v1;
+    v[2] = v2;
+    v[3] = v3;
+    std::memcpy(buf, p, n);
+    buffered = n;
+}
+
+std::uint64_t Checksum::digest() const {
+    std::uint64_t h;
+    if (total >= 32) {
+        h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+        for (int lane = 0; lane < 4; ++lane) {
+            h = merge_round(h, v[lane]);
+        }
+    } else {
+        h = v[2] + P5;
+    }
+    h += total;
+    const unsigned char* p = buf;
+    std::size_t n = buffered;
+    for (; n >= 8; p += 8, n -= 8) {
+        h = rotl(h ^ xxh_round(0, get_le(p, 8)), 27) * P1 + P4;
+    }
+    if (n >= 4) {
+        h = rotl(h ^ (get_le(p, 4) * P1), 23) * P2 + P3;
+        p += 4;
+        n -= 4;
+    }
+    for (; n > 0; ++p, --n) {
+        h = rotl(h ^ (*p * P5), 11) * P1;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+BinaryHeader read_binary_header(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + path + " for reading.");
+    }
+    unsigned char h[header_size];
+    in.read(reinterpret_cast<char*>(h), header_size);
+    return decode_header(h, static_cast<std::size_t>(in.gcount()), path);
+}
+
+template <class T>
+BasicMatrixWriter<T>::BasicMatrixWriter(const std::string& path, size_t rows, size_t cols)
+    : path(path), nrows(rows), ncols(cols), written(0), closed(false) {
+    if (rows == 0 || cols == 0) {
+        throw std::runtime_error{"rows or cols cannot be 0"};
+    }
+    out.open(path, std::ios::binary | std::ios::trunc);
+    const char placeholder[header_size] = {};
+    out.write(placeholder, header_size);
+    if (!out) {
+        throw std::runtime_error("Cannot open " + path + " for writing.");
+    }
+}
+
+template <class T>
+BasicMatrixWriter<T>::~BasicMatrixWriter() = default;
+
+template <class T>
+void BasicMatrixWriter<T>::write_row(const T* row) {
+    write(BasicConstMatrixView<T>(row, 1, ncols, ncols));
+}
+
+template <class T>
+void BasicMatrixWriter<T>::write(const BasicConstMatrixView<T>& rows) {
+    if (rows.cols() != ncols) {
+        throw std::invalid_argument("Matrix dimensions must agree.");
+    }
+    if (rows.rows() > nrows - written) {
+        throw std::out_of_range("More rows than the matrix file was created for.");
+    }
+    // Contiguous views go out in one call; the stream buffers the rest.
+    const size_t count = rows.stride() == ncols ? 1 : rows.rows();
+    const size_t bytes = (rows.stride() == ncols ? rows.rows() : 1) * ncols * sizeof(T);
+    for (size_t i = 0; i < count; ++i) {
+        out.write(reinterpret_cast<const char*>(rows.row(i)), static_cast<std::streamsize>(bytes));
+        sum.update(rows.row(i), bytes);
+    }
+    if (!out) {
+        throw std::runtime_error("Write to " + path + " failed.");
+    }
+    written += rows.rows();
+}
+
+template <class T>
+void BasicMatrixWriter<T>::close() {
+    if (closed) {
+        return;
+    }
+    if (written != nrows) {
+        throw std::runtime_error("Matrix file " + path + " has " + std::to_string(written) + " of " +
+                                 std::to_string(nrows) + " rows.");
+    }
+    unsigned char h[header_size] = {};
+    std::memcpy(h, magic, sizeof(magic));
+    put_le(h + 8, 1, 2);
+    h[10] = static_cast<unsigned char>(dtype_of<T>::value);
+    h[11] = host_little_endian() ? 0 : 1;
+    put_le(h + 12, data_alignment, 4);
+    put_le(h + 16, nrows, 8);
+    put_le(h + 24, ncols, 8);
+    put_le(h + 32, header_size, 8);
+    put_le(h + 40, sum.digest(), 8);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(h), header_size);
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Write to " + path + " failed.");
+    }
+    closed = true;
+}
+
+template <class T>
+void save_binary(const std::string& path, const BasicConstMatrixView<T>& m) {
+    BasicMatrixWriter<T> writer(path, m.rows(), m.cols());
+    writer.write(m);
+    writer.close();
+}
+
+template <class T>
+BasicMatrix<T> load_binary(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + path + " for reading.");
+    }
+    unsigned char h[header_size];
+    in.read(reinterpret_cast<char*>(h), header_size);
+    const BinaryHeader hdr = decode_header(h, static_cast<std::size_t>(in.gcount()), path);
+    check_dtype<T>(hdr, path);
+
+    // Check the size before allocating, so a corrupt shape in the header
+    // cannot request more memory than the file could ever fill.
+    const std::size_t bytes = hdr.rows * hdr.cols * sizeof(T);
+    in.seekg(0, std::ios::end);
+    const std::streamoff size = in.tellg();
+    if (size < 0 || static_cast<std::uint64_t>(size) < hdr.data_offset ||
+        static_cast<std::uint64_t>(size) - hdr.data_offset < bytes) {
+        invalid_file(path, "truncated data.");
+    }
+
+    BasicMatrix<T> m(hdr.rows, hdr.cols);
+    in.seekg(static_cast<std::streamoff>(hdr.data_offset));
+    in.read(reinterpret_cast<char*>(m.data()), static_cast<std::streamsize>(bytes));
+    if (static_cast<std::size_t>(in.gcount()) != bytes) {
+        invalid_file(path, "truncated data.");
+    }
+    check_sum(hdr, m.data(), bytes, path);
+    if (hdr.little_endian != host_little_endian()) {
+        swap_bytes(m.data(), hdr.rows * hdr.cols);
+    }
+    return m;
+}
+
+MappedFile::MappedFile(const std::string& path) : ptr(nullptr), length(0), mapped(false) {
+#ifdef MAT_HAVE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path + " for reading.");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot map " + path + ": empty or unreadable file.");
+    }
+    length = static_cast<std::size_t>(st.st_size);
+    void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("Cannot map " + path + ".");
+    }
+    ptr = static_cast<const unsigned char*>(p);
+    mapped = true;
+#else
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + path + " for reading.");
+    }
+    length = static_cast<std::size_t>(in.tellg());
+    unsigned char* copy = static_cast<unsigned char*>(::operator new(length, std::align_val_t{data_alignment}));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(copy), static_cast<std::streamsize>(length));
+    ptr = copy;
+#endif
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : ptr(other.ptr), length(other.length), mapped(other.mapped) {
+    other.ptr = nullptr;
+    other.length = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    // other releases the previous mapping when it is destroyed.
+    std::swap(ptr, other.ptr);
+    std::swap(length, other.length);
+    std::swap(mapped, other.mapped);
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    if (ptr == nullptr) {
+        return;
+    }
+#ifdef MAT_HAVE_MMAP
+    if (mapped) {
+        ::munmap(const_cast<unsigned char*>(ptr), length);
+        return;
+    }
+#endif
+    ::operator delete(const_cast<unsigned char*>(ptr), std::align_val_t{data_alignment});
+}
+
+template <class T>
+BasicMappedMatrix<T>::BasicMappedMatrix(const std::string& path, bool verify)
+    : file(path), hdr(decode_header(file.data(), file.size(), path)) {
+    check_dtype<T>(hdr, path);
+    if (hdr.little_endian != host_little_endian()) {
+        throw std::runtime_error("Matrix file " + path + " has the other byte order and cannot be mapped; use load_binary.");
+    }
+    const std::size_t bytes = hdr.rows * hdr.cols * sizeof(T);
+    if (file.size() < hdr.data_offset || file.size() - hdr.data_offset < bytes) {
+        invalid_file(path, "truncated data.");
+    }
+    if (verify) {
+        check_sum(hdr, data(), bytes, path);
+    }
+}
+
+template <class T>
+BasicMatrix<T> BasicMappedMatrix<T>::to_matrix() const {
+    BasicMatrix<T> m(rows(), cols());
+    std::copy(data(), data() + rows() * cols(), m.data());
+    return m;
+}
+
+#define MAT_INSTANTIATE_IO(T) \
+    template class BasicMatrixWriter<T>; \
+    template class BasicMappedMatrix<T>; \
+    template void save_binary<T>(const std::string&, const BasicConstMatrixView<T>&); \
+    template BasicMatrix<T> load_binary<T>(const std::string&);
+
+MAT_INSTANTIATE_IO(float)
+MAT_INSTANTIATE_IO(double)
+MAT_INSTANTIATE_IO(std::complex<double>)
+
+#undef MAT_INSTANTIATE_IO
@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "mat_kernels.h"
+#include "mat_lu.h"
+
+namespace mat_kernels {
+
+    template <class T>
+    int lu_factor(std::size_t n, T* A, std::size_t lda, std::size_t* piv) {
+        int sign = 1;
+        for (std::size_t k = 0; k < n; ++k) {
+            std::size_t p = k;
+            real_type_t<T> max = std::abs(A[k * lda + k]);
+            for (std::size_t i = k + 1; i < n; ++i) {
+                real_type_t<T> v = std::abs(A[i * lda + k]);
+                if (v > max) {
+                    max = v;
+                    p = i;
+                }
+            }
+            piv[k] = p;
+            if (max == 0.0) {
+                continue;
+            }
+            T* rk = A + k * lda;
+            if (p != k) {
+                std::swap_ranges(rk, rk + n, A + p * lda);
+                sign = -sign;
+            }
+            const T inv = T(1) / rk[k];
+            for (std::size_t i = k + 1; i < n; ++i) {
+                T* ri = A + i * lda;
+                const T l = ri[k] * inv;
+                ri[k] = l;
+                for (std::size_t j = k + 1; j < n; ++j) {
+                    ri[j] -= l * rk[j];
+                }
+            }
+        }
+        return sign;
+    }
+
+    template <class T>
+    void lu_solve(std::size_t n, std::size_t nrhs, const T* LU, std::size_t lda,
+                  const std::size_t* piv, T* B, std::size_t ldb) {
+        for (std::size_t k = 0; k < n; ++k) {
+            if (piv[k] != k) {
+                std::swap_ranges(B + k * ldb, B + k * ldb + nrhs, B + piv[k] * ldb);
+            }
+        }
+        // Both substitutions go by blocks of lu_solve_block rows: the rows of
+        // a block are solved with row updates, then the block's effect on the
+        // rows still to be solved is removed with one gemm, so with many
+        // right-hand sides most of the work runs in the packed kernel.
+        for (std::size_t k0 = 0; k0 < n; k0 += lu_solve_block) {
+            const std::size_t k1 = std::min(n, k0 + lu_solve_block);
+            for (std::size_t i = k0 + 1; i < k1; ++i) {
+                T* bi = B + i * ldb;
+                const T* li = LU + i * lda;
+                for (std::size_t k = k0; k < i; ++k) {
+                    const T l = li[k];
+                    const T* bk = B + k * ldb;
+                    for (std::size_t j = 0; j < nrhs; ++j) {
+                        bi[j] -= l * bk[j];
+                    }
+                }
+            }
+            if (k1 < n) {
+                gemm(Transpose::no, Transpose::no, n - k1, nrhs, k1 - k0, T(-1),
+                     LU + k1 * lda + k0, lda, B + k0 * ldb, ldb, T(1), B + k1 * ldb, ldb);
+            }
+        }
+        const std::size_t blocks = (n + lu_solve_block - 1) / lu_solve_block;
+        for (std::size_t b = blocks; b-- > 0;) {
+            const std::size_t k0 = b * lu_solve_block;
+            const std::size_t k1 = std::min(n, k0 + lu_solve_block);
+            for (std::size_t i = k1; i-- > k0;) {
+                T* bi = B + i * ldb;
+                const T* ui = LU + i * lda;
+                for (std::size_t k = i + 1; k < k1; ++k) {
+                    const T u = ui[k];
+                    const T* bk = B + k * ldb;
+                    for (std::size_t j = 0; j < nrhs; ++j) {
+                        bi[j] -= u * bk[j];
+                    }
+                }
+                const T inv = T(1) / ui[i];
+                for (std::size_t j = 0; j < nrhs; ++j) {
+                    bi[j] *= inv;
+                }
+            }
+            if (k0 > 0) {
+                gemm(Transpose::no, Transpose::no, k0, nrhs, k1 - k0, T(-1),
+                     LU + k0, lda, B + k0 * ldb, ldb, T(1), B, ldb);
+            }
+        }
+    }
+
+    template <class R>
+    R singular_tolerance(std::size_t n, R max_abs) {
+        return static_cast<R>(n) * std::numeric_limits<R>::epsilon() * max_abs;
+    }
+
+#define MAT_INSTANTIATE_LU(T) \
+    template int lu_factor<T>(std::size_t, T*, std::size_t, std::size_t*); \
+    template void lu_solve<T>(std::size_t, std::size_t, const T*, std::size_t, const std::size_t*, T*, std::size_t);
+
+    MAT_INSTANTIATE_LU(float)
+    MAT_INSTANTIATE_LU(double)
+    MAT_INSTANTIATE_LU(long double)
+    MAT_INSTANTIATE_LU(std::complex<double>)
+
+#undef MAT_INSTANTIATE_LU
+
+    template float singular_tolerance<float>(std::size_t, float);
+    template double singular_tolerance<double>(std::size_t, double);
+    template long double singular_tolerance<long double>(std::size_t, long double);
+
+}
+
+namespace {
+
+    /**
+    * Type the refinement residual is accumulated in.
+    */
+    template <class T>
+    struct wider { using type = long double; };
+
+    template <>
+    struct wider<float> { using type = double; };
+
+    template <class R>
+    struct wider<std::complex<R>> { using type = std::complex<long double>; };
+
+    /**
+    * Solves into x (n x nrhs, leading dimension ldx) from b with the factors
+    * of a, then applies up to refine refinement steps; a is only read when
+    * refine is not 0.
+    */
+    template <class T>
+    void solve_refined(const BasicConstMatrixView<T>* a, const BasicMatrix<T>& lu, const std::vector<size_t>& piv,
+                       const T* b, size_t ldb, size_t nrhs, T* x, size_t ldx, size_t refine) {
+        using W = typename wider<T>::type;
+        const size_t n = lu.rows();
+        for (size_t i = 0; i < n; ++i) {
+            std::copy(b + i * ldb, b + i * ldb + nrhs, x + i * ldx);
+        }
+        mat_kernels::lu_solve(n, nrhs, lu.data(), lu.stride(), piv.data(), x, ldx);
+        if (refine == 0) {
+            return;
+        }
+
+        std::vector<T> r(n * nrhs);
+        std::vector<W> acc(nrhs);
+        for (size_t step = 0; step < refine; ++step) {
+            // r = b - A * x, row by row in the wider type.
+            bool zero = true;
+            for (size_t i = 0; i < n; ++i) {
+                const T* bi = b + i * ldb;
+                for (size_t j = 0; j < nrhs; ++j) {
+                    acc[j] = W(bi[j]);
+                }
+                const T* ai = a->row(i);
+                for (size_t k = 0; k < n; ++k) {
+                    const W aik = W(ai[k]);
+                    const T* xk = x + k * ldx;
+                    for (size_t j = 0; j < nrhs; ++j) {
+                        acc[j] -= aik * W(xk[j]);
+                    }
+                }
+                for (size_t j = 0; j < nrhs; ++j) {
+                    r[i * nrhs + j] = T(acc[j]);
+                    zero = zero && r[i * nrhs + j] == T(0);
+                }
+            }
+            if (zero) {
+                return;
+            }
+            mat_kernels::lu_solve(n, nrhs, lu.data(), lu.stride(), piv.data(), r.data(), nrhs);
+            for (size_t i = 0; i < n; ++i) {
+                T* xi = x + i * ldx;
+                for (size_t j = 0; j < nrhs; ++j) {
+                    xi[j] += r[i * nrhs + j];
+                }
+            }
+        }
+    }
+
+}
+
+template <class T>
+BasicLU<T>::BasicLU(const BasicConstMatrixView<T>& m) : lu(m.rows(), m.cols()), piv(m.rows()) {
+    if (m.rows() != m.cols()) {
+        throw std::invalid_argument("Matrix must be square to compute LU factorization.");
+    }
+    using Real = mat_kernels::real_type_t<T>;
+    const size_t n = m.rows();
+    Real max_abs = 0;
+    for (size_t i = 0; i < n; ++i) {
+        std::copy(m.row(i), m.row(i) + n, lu.row(i));
+        for (size_t j = 0; j < n; ++j) {
+            max_abs = std::max(max_abs, Real(std::abs(m(i, j))));
+        }
+    }
+    sign = mat_kernels::lu_factor(n, lu.data(), lu.stride(), piv.data());
+    const Real tol = mat_kernels::singular_tolerance(n, max_abs);
+    for (size_t i = 0; i < n; ++i) {
+        if (!(std::abs(lu(i, i)) > tol)) {
+            throw std::runtime_error("Matrix is singular and the system cannot be solved.");
+        }
+    }
+}
+
+template <class T>
+BasicMatrix<T> BasicLU<T>::solve(const BasicConstMatrixView<T>& b) const {
+    if (b.rows() != size()) {
+        throw std::invalid_argument("Matrix dimensions must agree.");
+    }
+    BasicMatrix<T> x(b.rows(), b.cols());
+    solve_refined<T>(nullptr, lu, piv, b.data(), b.stride(), b.cols(), x.data(), x.stride(), 0);
+    return x;
+}
+
+template <class T>
+std::vector<T> BasicLU<T>::solve(const std::vector<T>& b) const {
+    if (b.size() != size()) {
+        throw std::invalid_argument("Matrix dimensions must agree.");
+    }
+    std::vector<T> x(b.size());
+    solve_refined<T>(nullptr, lu, piv, b.data(), 1, 1, x.data(), 1, 0);
+    return x;
+}
+
+template <class T>
+BasicMatrix<T> BasicLU<T>::solve(const BasicConstMatrixView<T>& a, const BasicConstMatrixView<T>& b, size_t refine) const {
+    if (a.rows() != size() || a.cols() != size() || b.rows() != size()) {
+        throw std::invalid_argument("Matrix dimensions must agree.");
+    }
+    BasicMatrix<T> x(b.rows(), b.cols());
+    solve_refined(&a, lu, piv, b.data(), b.stride(), b.cols(), x.data(), x.stride(), refine);
+    return x;
+}
+
+template <class T>
+std::vector<T> BasicLU<T>::solve(const BasicConstMatrixView<T>& a, const std::vector<T>& b, size_t refine) const {
+    if (a.rows() != size() || a.cols() != size() || b.size() != size()) {
+        throw std::invalid_argument("Matrix dimensions must agree.");
+    }
+    std::vector<T> x(b.size());
+    solve_refined(&a, lu, piv, b.data(), 1, 1, x.data(), 1, refine);
+    return x;
+}
+
+template <class T>
+T BasicLU<T>::determinant() const {
+    T det = T(sign);
+    for (size_t i = 0; i < size(); ++i) {
+        det *= lu(i, i);
+    }
+    return det;
+}
+
+template <class T>
+BasicMatrix<T> BasicLU<T>::inverse() const {
+    const size_t n = size();
+    BasicMatrix<T> inv(n, n);
+    for (size_t i = 0; i < n; ++i) {
+        inv(i, i) = T(1);
+    }
+    mat_kernels::lu_solve(n, n, lu.data(), lu.stride(), piv.data(), inv.data(), inv.stride());
+    return inv;
+}
+
+template class BasicLU<float>;
+template class BasicLU<double>;
+template class BasicLU<long double>;
+template class BasicLU<std::complex<double>>;
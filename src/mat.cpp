@@ -1,26 +1,22 @@
 #include <iostream>
 #include <vector>
 #include <stdexcept>
+#include <algorithm>
+#include <cmath>
 
 #include "mat.h"
+#include "mat_kernels.h"
 
 
-
-
-    void Matrix::check_dimensions(const Matrix& other) const {
-        if (rows != other.rows || cols != other.cols) {
-            throw std::invalid_argument("Matrix dimensions must agree.");
-        }
-    }
-
-    Matrix Matrix::get_cofactor(size_t p, size_t q) const {
-        Matrix cofactor(rows - 1, cols - 1);
+    template <class T>
+    BasicMatrix<T> BasicMatrix<T>::get_cofactor(size_t p, size_t q) const {
+        BasicMatrix cofactor(nrows - 1, ncols - 1, uninitialized_t{});
         size_t i = 0, j = 0;
-        for (size_t row = 0; row < rows; row++) {
-            for (size_t col = 0; col < cols; col++) {
-                if (row != p && col != q) {
-                    cofactor.data[i][j++] = data[row][col];
-                    if (j == cols - 1) {
+        for (size_t r = 0; r < nrows; r++) {
+            for (size_t c = 0; c < ncols; c++) {
+                if (r != p && c != q) {
+                    cofactor(i, j++) = (*this)(r, c);
+                    if (j == ncols - 1) {
                         j = 0;
                         i++;
                     }
@@ -30,144 +26,192 @@
         return cofactor;
     }
 
-    double Matrix::determinant(const Matrix& mat) const {
-        if (mat.rows != mat.cols) {
+    template <class T>
+    T BasicMatrix<T>::determinant(const BasicMatrix& mat) const {
+        if (mat.nrows != mat.ncols) {
             throw std::invalid_argument("Matrix must be square to compute determinant.");
         }
-        if (mat.rows == 1) {
-            return mat.data[0][0];
+        if (mat.nrows == 1) {
+            return mat(0, 0);
         }
-        if (mat.rows == 2) {
-            return mat.data[0][0] * mat.data[1][1] - mat.data[0][1] * mat.data[1][0];
+        if (mat.nrows == 2) {
+            return mat(0, 0) * mat(1, 1) - mat(0, 1) * mat(1, 0);
         }
-        double det = 0;
-        int sign{1};
-        for (size_t f = 0; f < mat.cols; f++) {
-            Matrix cofactor = mat.get_cofactor(0, f);
-            det += sign * mat.data[0][f] * determinant(cofactor);
-            sign = -sign;
+        BasicMatrix lu(mat);
+        std::vector<size_t> piv(mat.nrows);
+        T det = mat_kernels::lu_factor(mat.nrows, lu.data(), lu.ld, piv.data());
+        for (size_t i = 0; i < mat.nrows; ++i) {
+            det *= lu(i, i);
         }
         return det;
     }
 
-    Matrix Matrix::adjoint() const {
+    template <class T>
+    BasicMatrix<T> BasicMatrix<T>::adjoint() const {
        
-        Matrix adj(rows, cols);
+        BasicMatrix adj(nrows, ncols, uninitialized_t{});
         int sign = 1;
-        for (size_t i = 0; i < rows; i++) {
-            for (size_t j = 0; j < cols; j++) {
-                Matrix cofactor = get_cofactor(i, j);
+        for (size_t i = 0; i < nrows; i++) {
+            for (size_t j = 0; j < ncols; j++) {
+                BasicMatrix cofactor = get_cofactor(i, j);
                 sign = ((i + j) % 2 == 0) ? 1 : -1;
-                adj.data[j][i] = sign * determinant(cofactor);
+                adj(j, i) = T(sign) * determinant(cofactor);
             }
         }
         return adj;
     }
 
    
-    Matrix Matrix::operator+(const Matrix& other) const {
-        check_dimensions(other);
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows; ++i) {
-            for (size_t j = 0; j < cols; ++j) {
-                result.data[i][j] = data[i][j] + other.data[i][j];
-            }
-        }
-        return result;
-    }
-    Matrix::Matrix(const std::vector<std::vector<double>>& data) : data(data), rows(data.size()), cols(data[0].size()) {
-        if(data.size() == 0) 
+    template <class T>
+    BasicMatrix<T>::BasicMatrix(const std::vector<std::vector<T>>& data) : nrows(data.size()), ncols(data.empty() ? 0 : data[0].size()), ld(ncols) {
+        if((nrows == 0) || (ncols == 0))
             throw std::runtime_error{"data cannot be empty"};
+        storage.resize(nrows * ld);
+        for (size_t i = 0; i < nrows; ++i) {
+            if (data[i].size() != ncols)
+                throw std::invalid_argument{"All rows must have the same number of columns."};
+            std::copy(data[i].begin(), data[i].end(), row(i));
+        }
     }
 
-    Matrix::Matrix(size_t rows, size_t cols) : rows(rows), cols(cols), data(rows, std::vector<double>(cols)) {
+    template <class T>
+    BasicMatrix<T>::BasicMatrix(size_t rows, size_t cols) : nrows(rows), ncols(cols), ld(cols) {
         if((rows == 0) || (cols == 0))
             throw std::runtime_error{"rows or cols cannot be 0"};
+        storage.assign(rows * cols, T(0));
     }
 
-    Matrix Matrix::operator-(const Matrix& other) const {
-        check_dimensions(other);
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows; ++i) {
-            for (size_t j = 0; j < cols; ++j) {
-                result.data[i][j] = data[i][j] - other.data[i][j];
-            }
-        }
-        return result;
+    template <class T>
+    BasicMatrix<T>::BasicMatrix(size_t rows, size_t cols, uninitialized_t) : storage(rows * cols), nrows(rows), ncols(cols), ld(cols) {
     }
+
         
-    bool Matrix::operator==(const Matrix& other) const {
-        check_dimensions(other);
 
-        for (size_t i{}; i < rows; ++i) {
-            for (size_t j{}; j < cols; ++j) {
-                if(data[i][j] != other.data[i][j])
-                    return false;
-            }
-        }
-        return true;
-    }
 
+    template <class T>
+    BasicMatrix<T> BasicMatrix<T>::operator*(const BasicMatrix& other) const {
+        return multiply(view(), mat_kernels::Transpose::no, other.view(), mat_kernels::Transpose::no);
+    }
 
-    Matrix Matrix::operator*(const Matrix& other) const {
-        if (cols != other.rows) {
+    template <class T>
+    BasicMatrix<T> BasicMatrix<T>::multiply(const BasicConstMatrixView<T>& a, mat_kernels::Transpose ta, const BasicConstMatrixView<T>& b, mat_kernels::Transpose tb) {
+        using mat_kernels::Transpose;
+        const size_t m = ta == Transpose::no ? a.rows() : a.cols();
+        const size_t k = ta == Transpose::no ? a.cols() : a.rows();
+        const size_t kb = tb == Transpose::no ? b.rows() : b.cols();
+        const size_t n = tb == Transpose::no ? b.cols() : b.rows();
+        if (k != kb) {
             throw std::invalid_argument("Matrix multiplication dimensions must agree.");
         }
-        Matrix result(rows, other.cols);
-        for (size_t i = 0; i < rows; ++i) {
-            for (size_t j = 0; j < other.cols; ++j) {
-                result.data[i][j] = 0;
-                for (size_t k = 0; k < cols; ++k) {
-                    result.data[i][j] += data[i][k] * other.data[k][j];
-                }
-            }
+        BasicMatrix result(m, n, uninitialized_t{});
+        if (m * n * k < mat_kernels::gemm_blocked_threshold) {
+            mat_kernels::gemm_small(ta, tb, m, n, k, a.data(), a.stride(), b.data(), b.stride(), result.data(), result.ld);
+        } else {
+            mat_kernels::gemm(ta, tb, m, n, k, T(1), a.data(), a.stride(), b.data(), b.stride(), T(0), result.data(), result.ld);
         }
         return result;
     }
 
-    Matrix Matrix::operator*(const double scalar) const {
-        Matrix result(rows, cols);
-        for (size_t i = 0; i < rows; ++i) {
-            for (size_t j = 0; j < cols; ++j) {
-                result.data[i][j] = data[i][j] * scalar;
+
+    template <class T>
+    BasicMatrix<T>& BasicMatrix<T>::operator*=(T scalar) {
+        if constexpr (mat_kernels::has_elementwise_kernels<T>) {
+            mat_kernels::elementwise<T>().scale(data(), scalar, data(), storage.size());
+        } else {
+            for (T& v : storage) {
+                v *= scalar;
             }
         }
+        return *this;
+    }
+
+    template <class T>
+    BasicMatrix<T>& BasicMatrix<T>::operator*=(const BasicMatrix& other) {
+        *this = *this * other;
+        return *this;
+    }
+
+    template <class T>
+    BasicMatrix<T> BasicMatrix<T>::operator!() const {
+        BasicMatrix result(ncols, nrows, uninitialized_t{});
+        mat_kernels::transpose(nrows, ncols, data(), ld, result.data(), result.ld);
         return result;
     }
 
-    Matrix Matrix::operator!() const {
-        Matrix result(cols, rows);
-        for (size_t i = 0; i < rows; ++i) {
-            for (size_t j = 0; j < cols; ++j) {
-                result.data[j][i] = data[i][j];
-            }
+    template <class T>
+    BasicMatrix<T>& BasicMatrix<T>::transpose_in_place() {
+        if (nrows != ncols) {
+            throw std::invalid_argument("Matrix must be square to transpose in place.");
         }
-        return result;
+        mat_kernels::transpose_inplace(nrows, data(), ld);
+        return *this;
     }
 
-    double Matrix::operator*() const {
+    template <class T>
+    T BasicMatrix<T>::operator*() const {
         return determinant(*this);
     }
 
-    Matrix Matrix::operator~() const {
-        double det = determinant(*this);
-        if (det == 0) {
-            throw std::runtime_error("Matrix is singular and cannot be inverted.");
+    template <class T>
+    BasicMatrix<T> BasicMatrix<T>::operator~() const {
+        if (nrows != ncols) {
+            throw std::invalid_argument("Matrix must be square to compute inverse.");
         }
-        Matrix adj = adjoint();
-        Matrix inv = adj * (1.0 / det);
+        using Real = mat_kernels::real_type_t<T>;
+        Real max_abs = 0;
+        for (const T& v : storage) {
+            max_abs = std::max(max_abs, Real(std::abs(v)));
+        }
+        const Real tol = mat_kernels::singular_tolerance(nrows, max_abs);
+
+        BasicMatrix lu(*this);
+        std::vector<size_t> piv(nrows);
+        mat_kernels::lu_factor(nrows, lu.data(), lu.ld, piv.data());
+        for (size_t i = 0; i < nrows; ++i) {
+            if (!(std::abs(lu(i, i)) > tol)) {
+                throw std::runtime_error("Matrix is singular and cannot be inverted.");
+            }
+        }
+
+        BasicMatrix inv(nrows, ncols);
+        for (size_t i = 0; i < nrows; ++i) {
+            inv(i, i) = T(1);
+        }
+        mat_kernels::lu_solve(nrows, ncols, lu.data(), lu.ld, piv.data(), inv.data(), inv.ld);
         return inv;
     }
 
-     std::ostream& operator<<(std::ostream& os, const Matrix& matrix) {
-        for (const auto& row : matrix.data) {
-            for (double val : row) {
-                os << val << " ";
+    template <class T>
+    std::ostream& operator<<(std::ostream& os, const BasicMatrix<T>& matrix) {
+        for (size_t i = 0; i < matrix.rows(); ++i) {
+            const T* r = matrix.row(i);
+            for (size_t j = 0; j < matrix.cols(); ++j) {
+                os << r[j] << " ";
+            }
+            os << '\n';
+        }
+        return os;
+    }
+
+    template <class T>
+    std::ostream& operator<<(std::ostream& os, const MatTransposed<BasicMatrix<T>>& t) {
+        for (size_t i = 0; i < t.rows(); ++i) {
+            for (size_t j = 0; j < t.cols(); ++j) {
+                os << t(i, j) << " ";
             }
-            os << std::endl;
+            os << '\n';
         }
         return os;
     }
 
+#define MAT_INSTANTIATE(T) \
+    template class BasicMatrix<T>; \
+    template std::ostream& operator<<(std::ostream&, const BasicMatrix<T>&); \
+    template std::ostream& operator<<(std::ostream&, const MatTransposed<BasicMatrix<T>>&);
 
+    MAT_INSTANTIATE(float)
+    MAT_INSTANTIATE(double)
+    MAT_INSTANTIATE(long double)
+    MAT_INSTANTIATE(std::complex<double>)
 
+#undef MAT_INSTANTIATE
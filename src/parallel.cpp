@@ -0,0 +1,327 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mat_parallel.h"
+
+namespace mat_parallel {
+
+namespace {
+
+    thread_local bool inside_pool = false;
+
+    /**
+    * A fixed set of workers that sleep until a parallel_for is posted.
+    * One job runs at a time; concurrent callers queue on run_mutex.
+    */
+    class ThreadPool {
+    public:
+        explicit ThreadPool(std::size_t threads) {
+            for (std::size_t t = 1; t < threads; ++t) {
+                workers.emplace_back([this] { worker_loop(); });
+            }
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stop = true;
+            }
+            wake.notify_all();
+            for (auto& w : workers) {
+                w.join();
+            }
+        }
+
+        std::size_t size() const { return workers.size() + 1; }
+
+        void run(std::size_t n, const std::function<void(std::size_t)>& body) {
+            std::lock_guard<std::mutex> run_lock(run_mutex);
+            {
+                std::lock_guard<std::mutex> lock(m);
+                job = &body;
+                job_size = n;
+                next.store(0, std::memory_order_relaxed);
+                error = nullptr;
+                active = workers.size();
+                ++generation;
+            }
+            wake.notify_all();
+
+            inside_pool = true;
+            drain();
+            inside_pool = false;
+
+            std::unique_lock<std::mutex> lock(m);
+            done.wait(lock, [this] { return active == 0; });
+            job = nullptr;
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+    private:
+        void drain() {
+            for (std::size_t i = next.fetch_add(1); i < job_size; i = next.fetch_add(1)) {
+                try {
+                    (*job)(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(m);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+            }
+        }
+
+        void worker_loop() {
+            inside_pool = true;
+            std::uint64_t seen = 0;
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    wake.wait(lock, [&] { return stop || generation != seen; });
+                    if (stop) {
+                        return;
+                    }
+                    seen = generation;
+                }
+                drain();
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    --active;
+                }
+                done.notify_one();
+            }
+        }
+
+        std::vector<std::thread> workers;
+        std::mutex run_mutex;
+        std::mutex m;
+        std::condition_variable wake;
+        std::condition_variable done;
+        const std::function<void(std::size_t)>* job = nullptr;
+        std::size_t job_size = 0;
+        std::atomic<std::size_t> next{0};
+        std::size_t active = 0;
+        std::uint64_t generation = 0;
+        std::exception_ptr error;
+        bool stop = false;
+    };
+
+    /**
+    * State of one run_graph call: per-thread deques of ready tasks and the
+    * number of unfinished predecessors of every task.
+    */
+    class GraphRun {
+    public:
+        GraphRun(const std::vector<std::vector<std::size_t>>& dependents,
+                 const std::function<void(std::size_t)>& body, std::size_t threads)
+            : dependents(dependents), body(body), pending(new std::atomic<std::size_t>[dependents.size()]),
+              queues(new Queue[threads]), num_queues(threads), remaining(dependents.size()) {
+            for (std::size_t i = 0; i < dependents.size(); ++i) {
+                pending[i].store(0, std::memory_order_relaxed);
+            }
+            for (const auto& ds : dependents) {
+                for (std::size_t d : ds) {
+                    pending[d].fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            std::size_t q = 0;
+            for (std::size_t i = 0; i < dependents.size(); ++i) {
+                if (pending[i].load(std::memory_order_relaxed) == 0) {
+                    queues[q].tasks.push_back(i);
+                    available.fetch_add(1, std::memory_order_relaxed);
+                    q = (q + 1) % num_queues;
+                }
+            }
+        }
+
+        std::size_t threads() const { return num_queues; }
+
+        /**
+        * Runs tasks as thread self until every task has finished.
+        */
+        void work(std::size_t self) {
+            for (;;) {
+                std::size_t task;
+                if (!pop(self, task)) {
+                    std::unique_lock<std::mutex> lock(m);
+                    ready.wait(lock, [this] {
+                        return remaining.load() == 0 || available.load() > 0;
+                    });
+                    if (remaining.load() == 0) {
+                        return;
+                    }
+                    continue;
+                }
+                if (!failed.load(std::memory_order_relaxed)) {
+                    try {
+                        body(task);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(m);
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+                        failed.store(true);
+                    }
+                }
+                for (std::size_t d : dependents[task]) {
+                    if (pending[d].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        push(self, d);
+                    }
+                }
+                if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::lock_guard<std::mutex> lock(m);
+                    ready.notify_all();
+                }
+            }
+        }
+
+        void rethrow() const {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+    private:
+        struct Queue {
+            std::mutex m;
+            std::deque<std::size_t> tasks;
+        };
+
+        void push(std::size_t self, std::size_t task) {
+            {
+                std::lock_guard<std::mutex> lock(queues[self].m);
+                queues[self].tasks.push_back(task);
+                available.fetch_add(1);
+            }
+            std::lock_guard<std::mutex> lock(m);
+            ready.notify_one();
+        }
+
+        /**
+        * Takes the newest task of the own deque, or else steals the oldest of another.
+        */
+        bool pop(std::size_t self, std::size_t& task) {
+            for (std::size_t k = 0; k < num_queues; ++k) {
+                Queue& q = queues[(self + k) % num_queues];
+                std::lock_guard<std::mutex> lock(q.m);
+                if (q.tasks.empty()) {
+                    continue;
+                }
+                if (k == 0) {
+                    task = q.tasks.back();
+                    q.tasks.pop_back();
+                } else {
+                    task = q.tasks.front();
+                    q.tasks.pop_front();
+                }
+                available.fetch_sub(1);
+                return true;
+            }
+            return false;
+        }
+
+        const std::vector<std::vector<std::size_t>>& dependents;
+        const std::function<void(std::size_t)>& body;
+        std::unique_ptr<std::atomic<std::size_t>[]> pending; //< Unfinished predecessors of each task
+        std::unique_ptr<Queue[]> queues;
+        std::size_t num_queues;
+        std::atomic<std::size_t> remaining; //< Tasks not finished
+        std::atomic<std::size_t> available{0}; //< Tasks waiting in the deques
+        std::atomic<bool> failed{false};
+        std::mutex m; //< Guards error and the sleeping of idle threads
+        std::condition_variable ready;
+        std::exception_ptr error;
+    };
+
+    std::size_t default_threads() {
+        if (const char* env = std::getenv("MAT_NUM_THREADS")) {
+            long n = std::strtol(env, nullptr, 10);
+            if (n > 0) {
+                return static_cast<std::size_t>(n);
+            }
+        }
+        std::size_t hw = std::thread::hardware_concurrency();
+        return hw == 0 ? 1 : hw;
+    }
+
+    std::unique_ptr<ThreadPool>& pool() {
+        static std::unique_ptr<ThreadPool> instance = std::make_unique<ThreadPool>(default_threads());
+        return instance;
+    }
+
+}
+
+    std::size_t num_threads() {
+        return pool()->size();
+    }
+
+    void set_num_threads(std::size_t n) {
+        if (n == 0) {
+            n = std::thread::hardware_concurrency();
+        }
+        auto& p = pool();
+        if (p->size() != n) {
+            p.reset();
+            p = std::make_unique<ThreadPool>(n == 0 ? 1 : n);
+        }
+    }
+
+    void parallel_for(std::size_t n, const std::function<void(std::size_t)>& body) {
+        if (n == 0) {
+            return;
+        }
+        if (n == 1 || inside_pool || pool()->size() == 1) {
+            for (std::size_t i = 0; i < n; ++i) {
+                body(i);
+            }
+            return;
+        }
+        pool()->run(n, body);
+    }
+
+    void run_graph(const std::vector<std::vector<std::size_t>>& dependents, const std::function<void(std::size_t)>& body) {
+        const std::size_t n = dependents.size();
+        if (n == 0) {
+            return;
+        }
+        if (n == 1 || inside_pool || pool()->size() == 1) {
+            std::vector<std::size_t> pending(n, 0);
+            for (const auto& ds : dependents) {
+                for (std::size_t d : ds) {
+                    ++pending[d];
+                }
+            }
+            std::vector<std::size_t> ready;
+            for (std::size_t i = n; i-- > 0;) {
+                if (pending[i] == 0) {
+                    ready.push_back(i);
+                }
+            }
+            while (!ready.empty()) {
+                const std::size_t task = ready.back();
+                ready.pop_back();
+                body(task);
+                for (std::size_t d : dependents[task]) {
+                    if (--pending[d] == 0) {
+                        ready.push_back(d);
+                    }
+                }
+            }
+            return;
+        }
+        GraphRun run(dependents, body, pool()->size());
+        pool()->run(run.threads(), [&](std::size_t self) { run.work(self); });
+        run.rethrow();
+    }
+
+}
@@ -0,0 +1,458 @@
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mat_script.h"
+#include "mat_io.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    enum class OutputFormat { text, csv, binary };
+
+    // Base name of the timings file; no statement may take it, or its result file could clash.
+    const std::string timings_name = "timings";
+
+    /**
+    * One matrix or let statement, parsed and validated before anything runs.
+    */
+    struct Statement {
+        enum class Kind { inline_matrix, text_matrix, binary_matrix, let };
+
+        Kind kind;
+        size_t line;
+        std::string name;
+        std::string path; //< Resolved input path of text and binary matrices
+        TextFormat format; //< Delimiter of text matrices
+        std::optional<Matrix> value; //< Inline matrices
+        ExprPtr expr; //< Let statements
+    };
+
+    std::string line_prefix(size_t line) {
+        return "line " + std::to_string(line) + ": ";
+    }
+
+    /**
+    * Runs f, prefixing the message of the errors it throws with the script line.
+    * invalid_argument keeps its type; every other exception becomes a runtime_error.
+    */
+    template <class F>
+    auto at_line(size_t line, F&& f) -> decltype(f()) {
+        try {
+            return f();
+        } catch (const std::invalid_argument& ex) {
+            throw std::invalid_argument(line_prefix(line) + ex.what());
+        } catch (const std::runtime_error& ex) {
+            throw std::runtime_error(line_prefix(line) + ex.what());
+        } catch (const std::exception& ex) {
+            throw std::runtime_error(line_prefix(line) + ex.what());
+        }
+    }
+
+    bool is_identifier(const std::string& s) {
+        if (s.empty() || !(std::isalpha(static_cast<unsigned char>(s[0])) || s[0] == '_')) {
+            return false;
+        }
+        for (char c : s) {
+            if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+    * Splits a statement into words; a word in double quotes may hold spaces.
+    * Stops at a '#' outside quotes.
+    */
+    class Words {
+        const std::string& text;
+        size_t pos = 0;
+
+        void skip_blanks() {
+            while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) {
+                ++pos;
+            }
+        }
+
+    public:
+        explicit Words(const std::string& text) : text(text) {}
+
+        bool done() {
+            skip_blanks();
+            return pos == text.size() || text[pos] == '#';
+        }
+
+        std::string next(const char* what) {
+            if (done()) {
+                throw std::invalid_argument(std::string("Expected ") + what + ".");
+            }
+            if (text[pos] == '"') {
+                const size_t close = text.find('"', pos + 1);
+                if (close == std::string::npos) {
+                    throw std::invalid_argument("Unterminated quoted string.");
+                }
+                std::string word = text.substr(pos + 1, close - pos - 1);
+                pos = close + 1;
+                return word;
+            }
+            const size_t start = pos;
+            while (pos < text.size() && !std::isspace(static_cast<unsigned char>(text[pos])) && text[pos] != '#') {
+                ++pos;
+            }
+            return text.substr(start, pos - start);
+        }
+
+        /**
+        * Returns the rest of the statement without its comment, trimmed.
+        */
+        std::string rest() {
+            skip_blanks();
+            size_t end = text.find('#', pos);
+            if (end == std::string::npos) {
+                end = text.size();
+            }
+            while (end > pos && std::isspace(static_cast<unsigned char>(text[end - 1]))) {
+                --end;
+            }
+            std::string r = text.substr(pos, end - pos);
+            pos = text.size();
+            return r;
+        }
+
+        void expect_end() {
+            if (!done()) {
+                throw std::invalid_argument("Unexpected '" + next("a word") + "'.");
+            }
+        }
+    };
+
+    fs::path resolve(const std::string& base, const std::string& path) {
+        const fs::path p(path);
+        return p.is_absolute() ? p : fs::path(base) / p;
+    }
+
+    /**
+    * Parses "[1 2; 3 4]": rows separated by ';', elements by blanks.
+    */
+    Matrix parse_inline(const std::string& text) {
+        if (text.size() < 2 || text.front() != '[' || text.back() != ']') {
+            throw std::invalid_argument("An inline matrix must be enclosed in [ ].");
+        }
+        std::string rows = text.substr(1, text.size() - 2);
+        for (char& c : rows) {
+            if (c == ';') {
+                c = '\n';
+            }
+        }
+        std::istringstream in(rows);
+        return read_text(in);
+    }
+
+    /**
+    * Everything run_script needs from the script text: settings and statements.
+    */
+    struct Script {
+        std::vector<Statement> statements;
+        std::optional<std::string> output_dir;
+        std::optional<OutputFormat> format;
+    };
+
+    /**
+    * Checks that every name an expression uses is declared by an earlier statement.
+    */
+    void check_names(const ExprNode& node, const Script& script) {
+        if (node.op == ExprNode::Op::matrix) {
+            for (const Statement& st : script.statements) {
+                if (st.name == node.name) {
+                    return;
+                }
+            }
+            throw std::invalid_argument("Unknown matrix: " + node.name);
+        }
+        for (const ExprPtr& arg : node.args) {
+            check_names(*arg, script);
+        }
+    }
+
+    void parse_statement(const std::string& line, size_t number, const std::string& base_dir, Script& script) {
+        Words words(line);
+        const std::string keyword = words.next("a statement");
+
+        if (keyword == "output") {
+            if (script.output_dir) {
+                throw std::invalid_argument("The output directory is already set.");
+            }
+            script.output_dir = resolve(base_dir, words.next("a directory")).string();
+            words.expect_end();
+            return;
+        }
+        if (keyword == "format") {
+            if (script.format) {
+                throw std::invalid_argument("The output format is already set.");
+            }
+            const std::string name = words.next("text, csv or binary");
+            if (name == "text") {
+                script.format = OutputFormat::text;
+            } else if (name == "csv") {
+                script.format = OutputFormat::csv;
+            } else if (name == "binary") {
+                script.format = OutputFormat::binary;
+            } else {
+                throw std::invalid_argument("Unknown format '" + name + "'; expected text, csv or binary.");
+            }
+            words.expect_end();
+            return;
+        }
+        if (keyword != "matrix" && keyword != "let") {
+            throw std::invalid_argument("Unknown statement '" + keyword + "'.");
+        }
+
+        Statement st;
+        st.line = number;
+        st.name = words.next("a name");
+        if (!is_identifier(st.name)) {
+            throw std::invalid_argument("Invalid name '" + st.name + "'.");
+        }
+        if (st.name == timings_name) {
+            throw std::invalid_argument("The name '" + st.name + "' is reserved for the timings file.");
+        }
+        for (const Statement& other : script.statements) {
+            if (other.name == st.name) {
+                throw std::invalid_argument(st.name + " is already defined on line " + std::to_string(other.line) + ".");
+            }
+        }
+        if (words.next("'='") != "=") {
+            throw std::invalid_argument("Expected '=' after " + st.name + ".");
+        }
+
+        if (keyword == "let") {
+            st.kind = Statement::Kind::let;
+            st.expr = parse_expression(words.rest());
+            check_names(*st.expr, script);
+        } else {
+            const std::string rest = words.rest();
+            if (!rest.empty() && rest.front() == '[') {
+                st.kind = Statement::Kind::inline_matrix;
+                st.value.emplace(parse_inline(rest));
+            } else {
+                Words source(rest);
+                const std::string kind = source.next("text, binary or [");
+                if (kind == "text") {
+                    st.kind = Statement::Kind::text_matrix;
+                } else if (kind == "binary") {
+                    st.kind = Statement::Kind::binary_matrix;
+                } else {
+                    throw std::invalid_argument("Unknown matrix source '" + kind + "'; expected text, binary or [.");
+                }
+                st.path = resolve(base_dir, source.next("a path")).string();
+                if (st.kind == Statement::Kind::text_matrix && !source.done()) {
+                    if (source.next("delimiter") != "delimiter") {
+                        throw std::invalid_argument("Expected 'delimiter'.");
+                    }
+                    const std::string d = source.next("a delimiter character");
+                    if (d.size() != 1) {
+                        throw std::invalid_argument("The delimiter must be one character.");
+                    }
+                    st.format.delimiter = d[0];
+                }
+                source.expect_end();
+            }
+        }
+        script.statements.push_back(std::move(st));
+    }
+
+    Script parse_script(std::istream& in, const std::string& base_dir) {
+        Script script;
+        std::string line;
+        for (size_t number = 1; std::getline(in, line); ++number) {
+            if (Words(line).done()) {
+                continue;
+            }
+            at_line(number, [&] { parse_statement(line, number, base_dir, script); });
+        }
+        return script;
+    }
+
+    std::string format_number(double v) {
+        char buf[32];
+        auto res = std::to_chars(buf, buf + sizeof(buf), v);
+        return std::string(buf, res.ptr);
+    }
+
+    void write_scalar(const fs::path& path, double v) {
+        std::ofstream out(path);
+        out << format_number(v) << '\n';
+        if (!out) {
+            throw std::runtime_error("Cannot write " + path.string() + ".");
+        }
+    }
+
+    /**
+    * File a let result is written to; scalars are always written as text.
+    */
+    fs::path result_path(const fs::path& dir, const std::string& name, OutputFormat format, bool scalar) {
+        const char* ext = scalar || format == OutputFormat::text ? ".txt"
+                        : format == OutputFormat::csv            ? ".csv"
+                                                                 : ".mat";
+        return dir / (name + ext);
+    }
+
+    void write_result(const fs::path& dir, const std::string& name, const ExprValue& value, OutputFormat format) {
+        if (const double* scalar = std::get_if<double>(&value)) {
+            write_scalar(result_path(dir, name, format, true), *scalar);
+            return;
+        }
+        const Matrix& m = std::get<Matrix>(value);
+        const std::string path = result_path(dir, name, format, false).string();
+        switch (format) {
+            case OutputFormat::text:
+                save_text(path, m);
+                break;
+            case OutputFormat::csv: {
+                TextFormat csv;
+                csv.delimiter = ',';
+                save_text(path, m, csv);
+                break;
+            }
+            case OutputFormat::binary:
+                save_binary(path, m);
+                break;
+        }
+    }
+
+    /**
+    * Absolute path with symbolic links and "..", resolved as far as it exists, for comparing paths.
+    */
+    fs::path comparable(const fs::path& path) {
+        std::error_code ec;
+        fs::path p = fs::weakly_canonical(path, ec);
+        return ec ? fs::absolute(path, ec).lexically_normal() : p;
+    }
+
+    /**
+    * Rejects a script whose result or timings files would replace one of its input files.
+    */
+    void check_outputs(const Script& script, const fs::path& dir, OutputFormat format) {
+        std::vector<std::pair<fs::path, const Statement*>> inputs;
+        for (const Statement& st : script.statements) {
+            if (st.kind == Statement::Kind::text_matrix || st.kind == Statement::Kind::binary_matrix) {
+                inputs.emplace_back(comparable(st.path), &st);
+            }
+        }
+        auto check = [&](const fs::path& output, size_t line) {
+            const fs::path out = comparable(output);
+            for (const auto& [path, st] : inputs) {
+                if (path == out) {
+                    at_line(line, [&] {
+                        throw std::invalid_argument("Writing " + output.string() + " would overwrite the input " +
+                                                    st->name + " on line " + std::to_string(st->line) + ".");
+                    });
+                }
+            }
+        };
+        for (const Statement& st : script.statements) {
+            if (st.kind == Statement::Kind::let) {
+                // Whether the result is a scalar is only known once it is evaluated.
+                check(result_path(dir, st.name, format, false), st.line);
+                check(result_path(dir, st.name, format, true), st.line);
+            }
+        }
+        for (const auto& [path, st] : inputs) {
+            if (path == comparable(dir / (timings_name + ".csv"))) {
+                at_line(st->line, [&] { throw std::invalid_argument("The input " + st->name + " is the timings file."); });
+            }
+        }
+    }
+
+    void write_timings(const fs::path& path, const std::vector<ScriptTiming>& timings) {
+        std::ofstream out(path);
+        out << "name,seconds,gemm_flops,products,reused\n";
+        for (const ScriptTiming& t : timings) {
+            out << t.name << ',' << format_number(t.seconds) << ',' << format_number(t.stats.gemm_flops) << ','
+                << t.stats.products << ',' << t.stats.reused << '\n';
+        }
+        if (!out) {
+            throw std::runtime_error("Cannot write " + path.string() + ".");
+        }
+    }
+
+}
+
+ScriptRun run_script(std::istream& in, const ScriptOptions& options) {
+    Script script = parse_script(in, options.base_dir);
+    // Interning every expression up front marks the subexpressions that
+    // several lets share, so each is computed once and kept for the others.
+    ExprCache cache(options.cache_budget);
+    for (Statement& st : script.statements) {
+        if (st.kind == Statement::Kind::let) {
+            st.expr = cache.intern(st.expr);
+        }
+    }
+    const OutputFormat format = script.format.value_or(OutputFormat::text);
+    const fs::path out_dir = !options.output_dir.empty() ? fs::path(options.output_dir)
+                             : script.output_dir ? fs::path(*script.output_dir)
+                             : fs::path(options.base_dir);
+    check_outputs(script, out_dir, format);
+    if (options.write_files) {
+        std::error_code ec;
+        fs::create_directories(out_dir, ec);
+        if (ec) {
+            throw std::runtime_error("Cannot create " + out_dir.string() + ": " + ec.message());
+        }
+    }
+
+    ScriptRun run;
+    const MatrixLookup lookup = [&](const std::string& name) -> const Matrix& {
+        auto it = run.values.find(name);
+        if (it == run.values.end()) {
+            throw std::invalid_argument("Unknown matrix: " + name);
+        }
+        if (!std::holds_alternative<Matrix>(it->second)) {
+            throw std::invalid_argument(name + " is a scalar, not a matrix.");
+        }
+        return std::get<Matrix>(it->second);
+    };
+
+    for (const Statement& st : script.statements) {
+        at_line(st.line, [&] {
+            switch (st.kind) {
+                case Statement::Kind::inline_matrix:
+                    run.values.emplace(st.name, *st.value);
+                    break;
+                case Statement::Kind::text_matrix:
+                    run.values.emplace(st.name, load_text(st.path, st.format));
+                    break;
+                case Statement::Kind::binary_matrix:
+                    run.values.emplace(st.name, load_binary(st.path));
+                    break;
+                case Statement::Kind::let: {
+                    ScriptTiming timing{st.name, 0, {}};
+                    const auto start = std::chrono::steady_clock::now();
+                    ExprValue value = evaluate(st.expr, lookup, cache, &timing.stats);
+                    timing.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    if (options.write_files) {
+                        write_result(out_dir, st.name, value, format);
+                    }
+                    run.values.emplace(st.name, std::move(value));
+                    run.timings.push_back(std::move(timing));
+                    break;
+                }
+            }
+        });
+    }
+
+    if (options.write_files) {
+        write_timings(out_dir / (timings_name + ".csv"), run.timings);
+    }
+    return run;
+}
@@ -0,0 +1,394 @@
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+#include "mat_kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MAT_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace mat_kernels {
+
+namespace {
+
+    template <class T>
+    void add_scalar(const T* a, const T* b, T* out, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] + b[i];
+        }
+    }
+
+    template <class T>
+    void sub_scalar(const T* a, const T* b, T* out, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] - b[i];
+        }
+    }
+
+    template <class T>
+    void scale_scalar(const T* a, T s, T* out, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = a[i] * s;
+        }
+    }
+
+    template <class T>
+    bool equal_scalar(const T* a, const T* b, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            if (a[i] != b[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <class T>
+    const BasicElementwiseKernels<T> scalar_kernels{add_scalar<T>, sub_scalar<T>, scale_scalar<T>, equal_scalar<T>};
+
+#ifdef MAT_X86_DISPATCH
+
+    // Each ISA gets the same four loops: a vector body over whole registers
+    // and the scalar routine for the remaining tail. Unaligned loads are used
+    // throughout because rows of a matrix are only aligned when ld is.
+
+    __attribute__((target("sse2")))
+    void add_sse2(const double* a, const double* b, double* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        }
+        add_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("sse2")))
+    void sub_sse2(const double* a, const double* b, double* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            _mm_storeu_pd(out + i, _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        }
+        sub_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("sse2")))
+    void scale_sse2(const double* a, double s, double* out, std::size_t n) {
+        const __m128d vs = _mm_set1_pd(s);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), vs));
+        }
+        scale_scalar(a + i, s, out + i, n - i);
+    }
+
+    __attribute__((target("sse2")))
+    bool equal_sse2(const double* a, const double* b, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            if (_mm_movemask_pd(_mm_cmpneq_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))) != 0) {
+                return false;
+            }
+        }
+        return equal_scalar(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    void add_avx2(const double* a, const double* b, double* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        }
+        add_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    void sub_avx2(const double* a, const double* b, double* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            _mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        }
+        sub_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    void scale_avx2(const double* a, double s, double* out, std::size_t n) {
+        const __m256d vs = _mm256_set1_pd(s);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), vs));
+        }
+        scale_scalar(a + i, s, out + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    bool equal_avx2(const double* a, const double* b, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d ne = _mm256_cmp_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _CMP_NEQ_UQ);
+            if (_mm256_movemask_pd(ne) != 0) {
+                return false;
+            }
+        }
+        return equal_scalar(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx512f")))
+    void add_avx512(const double* a, const double* b, double* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            _mm512_storeu_pd(out + i, _mm512_add_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i)));
+        }
+        add_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("avx512f")))
+    void sub_avx512(const double* a, const double* b, double* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            _mm512_storeu_pd(out + i, _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i)));
+        }
+        sub_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("avx512f")))
+    void scale_avx512(const double* a, double s, double* out, std::size_t n) {
+        const __m512d vs = _mm512_set1_pd(s);
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            _mm512_storeu_pd(out + i, _mm512_mul_pd(_mm512_loadu_pd(a + i), vs));
+        }
+        scale_scalar(a + i, s, out + i, n - i);
+    }
+
+    __attribute__((target("avx512f")))
+    bool equal_avx512(const double* a, const double* b, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            if (_mm512_cmp_pd_mask(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), _CMP_NEQ_UQ) != 0) {
+                return false;
+            }
+        }
+        return equal_scalar(a + i, b + i, n - i);
+    }
+
+    // Single precision: the same loops over twice as many lanes per register.
+
+    __attribute__((target("sse2")))
+    void add_sse2_f(const float* a, const float* b, float* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+        add_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("sse2")))
+    void sub_sse2_f(const float* a, const float* b, float* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(out + i, _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+        sub_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("sse2")))
+    void scale_sse2_f(const float* a, float s, float* out, std::size_t n) {
+        const __m128 vs = _mm_set1_ps(s);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(a + i), vs));
+        }
+        scale_scalar(a + i, s, out + i, n - i);
+    }
+
+    __attribute__((target("sse2")))
+    bool equal_sse2_f(const float* a, const float* b, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            if (_mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))) != 0) {
+                return false;
+            }
+        }
+        return equal_scalar(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    void add_avx2_f(const float* a, const float* b, float* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        }
+        add_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    void sub_avx2_f(const float* a, const float* b, float* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            _mm256_storeu_ps(out + i, _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        }
+        sub_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    void scale_avx2_f(const float* a, float s, float* out, std::size_t n) {
+        const __m256 vs = _mm256_set1_ps(s);
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), vs));
+        }
+        scale_scalar(a + i, s, out + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    bool equal_avx2_f(const float* a, const float* b, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256 ne = _mm256_cmp_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), _CMP_NEQ_UQ);
+            if (_mm256_movemask_ps(ne) != 0) {
+                return false;
+            }
+        }
+        return equal_scalar(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx512f")))
+    void add_avx512_f(const float* a, const float* b, float* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            _mm512_storeu_ps(out + i, _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        }
+        add_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("avx512f")))
+    void sub_avx512_f(const float* a, const float* b, float* out, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            _mm512_storeu_ps(out + i, _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        }
+        sub_scalar(a + i, b + i, out + i, n - i);
+    }
+
+    __attribute__((target("avx512f")))
+    void scale_avx512_f(const float* a, float s, float* out, std::size_t n) {
+        const __m512 vs = _mm512_set1_ps(s);
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(a + i), vs));
+        }
+        scale_scalar(a + i, s, out + i, n - i);
+    }
+
+    __attribute__((target("avx512f")))
+    bool equal_avx512_f(const float* a, const float* b, std::size_t n) {
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            if (_mm512_cmp_ps_mask(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), _CMP_NEQ_UQ) != 0) {
+                return false;
+            }
+        }
+        return equal_scalar(a + i, b + i, n - i);
+    }
+
+    const ElementwiseKernels sse2_kernels{add_sse2, sub_sse2, scale_sse2, equal_sse2};
+    const ElementwiseKernels avx2_kernels{add_avx2, sub_avx2, scale_avx2, equal_avx2};
+    const ElementwiseKernels avx512_kernels{add_avx512, sub_avx512, scale_avx512, equal_avx512};
+    const BasicElementwiseKernels<float> sse2_kernels_f{add_sse2_f, sub_sse2_f, scale_sse2_f, equal_sse2_f};
+    const BasicElementwiseKernels<float> avx2_kernels_f{add_avx2_f, sub_avx2_f, scale_avx2_f, equal_avx2_f};
+    const BasicElementwiseKernels<float> avx512_kernels_f{add_avx512_f, sub_avx512_f, scale_avx512_f, equal_avx512_f};
+
+    Isa detect_isa() {
+        __builtin_cpu_init();
+        // Kernels of the avx2 and avx512 levels are built with FMA enabled, so
+        // both levels require it; a few early AVX2 parts lack it.
+        const bool fma = __builtin_cpu_supports("fma");
+        if (fma && __builtin_cpu_supports("avx512f")) {
+            return Isa::avx512;
+        }
+        if (fma && __builtin_cpu_supports("avx2")) {
+            return Isa::avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return Isa::sse2;
+        }
+        return Isa::scalar;
+    }
+
+#else
+
+    Isa detect_isa() {
+        return Isa::scalar;
+    }
+
+#endif
+
+    /**
+    * Reads MAT_ISA and lowers the detected level to it; an unknown value is ignored.
+    */
+    Isa select_isa() {
+        Isa isa = detect_isa();
+        const char* forced = std::getenv("MAT_ISA");
+        if (forced == nullptr) {
+            return isa;
+        }
+        for (Isa level : {Isa::scalar, Isa::sse2, Isa::avx2, Isa::avx512}) {
+            if (std::strcmp(forced, isa_name(level)) == 0) {
+                return level < isa ? level : isa;
+            }
+        }
+        return isa;
+    }
+
+}
+
+    Isa active_isa() {
+        static const Isa isa = select_isa();
+        return isa;
+    }
+
+    const char* isa_name(Isa isa) {
+        switch (isa) {
+            case Isa::sse2: return "sse2";
+            case Isa::avx2: return "avx2";
+            case Isa::avx512: return "avx512";
+            default: return "scalar";
+        }
+    }
+
+    template <>
+    const ElementwiseKernels* elementwise_for<double>(Isa isa) {
+        switch (isa) {
+            case Isa::scalar: return &scalar_kernels<double>;
+#ifdef MAT_X86_DISPATCH
+            case Isa::sse2: return &sse2_kernels;
+            case Isa::avx2: return &avx2_kernels;
+            case Isa::avx512: return &avx512_kernels;
+#endif
+            default: return nullptr;
+        }
+    }
+
+    template <>
+    const BasicElementwiseKernels<float>* elementwise_for<float>(Isa isa) {
+        switch (isa) {
+            case Isa::scalar: return &scalar_kernels<float>;
+#ifdef MAT_X86_DISPATCH
+            case Isa::sse2: return &sse2_kernels_f;
+            case Isa::avx2: return &avx2_kernels_f;
+            case Isa::avx512: return &avx512_kernels_f;
+#endif
+            default: return nullptr;
+        }
+    }
+
+    template <class T>
+    const BasicElementwiseKernels<T>& elementwise() {
+        static const BasicElementwiseKernels<T>& kernels = *elementwise_for<T>(active_isa());
+        return kernels;
+    }
+
+    template const ElementwiseKernels& elementwise<double>();
+    template const BasicElementwiseKernels<float>& elementwise<float>();
+
+}
@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "mat_parallel.h"
+#include "mat_sparse.h"
+
+namespace {
+
+    // Products with fewer multiply-adds than this stay on the calling thread;
+    // an SpMV does two flops per entry, so waking the pool only pays off for
+    // matrices well beyond the size of L2.
+    constexpr size_t sparse_parallel_threshold = 1 << 16;
+
+    /**
+    * Runs body(r0, r1) over row ranges of about equal nnz, on the pool when
+    * work (multiply-adds) is large enough.
+    */
+    template <class F>
+    void for_row_chunks(const std::vector<size_t>& ptr, size_t rows, size_t work, const F& body) {
+        const size_t threads = mat_parallel::num_threads();
+        if (threads == 1 || work < sparse_parallel_threshold) {
+            body(0, rows);
+            return;
+        }
+        // A few chunks per thread so that dynamic scheduling evens out rows of
+        // different cost; the boundaries split the entries, not the rows.
+        const size_t chunks = std::min(rows, 4 * threads);
+        const size_t nnz = ptr[rows];
+        auto boundary = [&](size_t c) -> size_t {
+            if (c == chunks) {
+                return rows;
+            }
+            const size_t target = nnz / chunks * c + nnz % chunks * c / chunks;
+            return std::min<size_t>(std::lower_bound(ptr.begin(), ptr.end(), target) - ptr.begin(), rows);
+        };
+        mat_parallel::parallel_for(chunks, [&](size_t c) {
+            const size_t r0 = boundary(c);
+            const size_t r1 = boundary(c + 1);
+            if (r0 < r1) {
+                body(r0, r1);
+            }
+        });
+    }
+
+    void check_shape(size_t rows, size_t cols) {
+        if (rows == 0 || cols == 0) {
+            throw std::runtime_error{"rows or cols cannot be 0"};
+        }
+    }
+
+}
+
+CsrMatrix::CsrMatrix(size_t rows, size_t cols) : nrows(rows), ncols(cols), ptr(rows + 1, 0) {
+    check_shape(rows, cols);
+}
+
+CsrMatrix::CsrMatrix(size_t rows, size_t cols, std::vector<size_t> row_ptr, std::vector<size_t> col_idx, std::vector<double> values)
+    : nrows(rows), ncols(cols), ptr(std::move(row_ptr)), idx(std::move(col_idx)), vals(std::move(values)) {
+    check_shape(rows, cols);
+    if (ptr.size() != rows + 1 || ptr[0] != 0 || ptr[rows] != idx.size() || idx.size() != vals.size()) {
+        throw std::invalid_argument("Invalid compressed sparse structure.");
+    }
+    for (size_t i = 0; i < rows; ++i) {
+        if (ptr[i] > ptr[i + 1]) {
+            throw std::invalid_argument("Invalid compressed sparse structure.");
+        }
+        for (size_t p = ptr[i]; p < ptr[i + 1]; ++p) {
+            if (idx[p] >= cols || (p > ptr[i] && idx[p] <= idx[p - 1])) {
+                throw std::invalid_argument("Invalid compressed sparse structure.");
+            }
+        }
+    }
+}
+
+CsrMatrix CsrMatrix::from_triplets(size_t rows, size_t cols, const std::vector<Triplet>& entries) {
+    CsrMatrix result(rows, cols);
+    const size_t n = entries.size();
+    for (const Triplet& e : entries) {
+        if (e.row >= rows || e.col >= cols) {
+            throw std::out_of_range("Sparse entry index out of range.");
+        }
+    }
+
+    // Two stable counting sorts, by column and then by row, leave every row
+    // with its columns in ascending order.
+    std::vector<size_t> count(cols + 1, 0);
+    for (const Triplet& e : entries) {
+        ++count[e.col + 1];
+    }
+    for (size_t j = 0; j < cols; ++j) {
+        count[j + 1] += count[j];
+    }
+    std::vector<size_t> by_col(n);
+    for (size_t k = 0; k < n; ++k) {
+        by_col[count[entries[k].col]++] = k;
+    }
+
+    std::vector<size_t>& ptr = result.ptr;
+    for (const Triplet& e : entries) {
+        ++ptr[e.row + 1];
+    }
+    for (size_t i = 0; i < rows; ++i) {
+        ptr[i + 1] += ptr[i];
+    }
+    result.idx.resize(n);
+    result.vals.resize(n);
+    {
+        std::vector<size_t> next(ptr.begin(), ptr.end() - 1);
+        for (size_t k : by_col) {
+            const Triplet& e = entries[k];
+            const size_t p = next[e.row]++;
+            result.idx[p] = e.col;
+            result.vals[p] = e.value;
+        }
+    }
+
+    // Sum repeated positions and drop zeros, compacting in place.
+    size_t out = 0;
+    size_t begin = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        const size_t end = ptr[i + 1];
+        for (size_t p = begin; p < end;) {
+            const size_t col = result.idx[p];
+            double sum = 0.0;
+            for (; p < end && result.idx[p] == col; ++p) {
+                sum += result.vals[p];
+            }
+            if (sum != 0.0) {
+                result.idx[out] = col;
+                result.vals[out] = sum;
+                ++out;
+            }
+        }
+        begin = end;
+        ptr[i + 1] = out;
+    }
+    result.idx.resize(out);
+    result.vals.resize(out);
+    return result;
+}
+
+CsrMatrix::CsrMatrix(const ConstMatrixView& m) : CsrMatrix(m.rows(), m.cols()) {
+    for (size_t i = 0; i < nrows; ++i) {
+        const double* row = m.row(i);
+        for (size_t j = 0; j < ncols; ++j) {
+            if (row[j] != 0.0) {
+                idx.push_back(j);
+                vals.push_back(row[j]);
+            }
+        }
+        ptr[i + 1] = vals.size();
+    }
+}
+
+CsrMatrix::CsrMatrix(const CscMatrix& m) : CsrMatrix(!m.t) {}
+
+double CsrMatrix::operator()(size_t i, size_t j) const {
+    if (i >= nrows || j >= ncols) {
+        throw std::out_of_range("Sparse matrix index out of range.");
+    }
+    const auto first = idx.begin() + ptr[i];
+    const auto last = idx.begin() + ptr[i + 1];
+    const auto it = std::lower_bound(first, last, j);
+    return it != last && *it == j ? vals[it - idx.begin()] : 0.0;
+}
+
+Matrix CsrMatrix::to_dense() const {
+    Matrix result(nrows, ncols);
+    for (size_t i = 0; i < nrows; ++i) {
+        double* row = result.row(i);
+        for (size_t p = ptr[i]; p < ptr[i + 1]; ++p) {
+            row[idx[p]] = vals[p];
+        }
+    }
+    return result;
+}
+
+void CsrMatrix::multiply(const double* x, double* y) const {
+    for_row_chunks(ptr, nrows, nnz(), [&](size_t r0, size_t r1) {
+        for (size_t i = r0; i < r1; ++i) {
+            double sum = 0.0;
+            for (size_t p = ptr[i]; p < ptr[i + 1]; ++p) {
+                sum += vals[p] * x[idx[p]];
+            }
+            y[i] = sum;
+        }
+    });
+}
+
+std::vector<double> CsrMatrix::operator*(const std::vector<double>& x) const {
+    if (x.size() != ncols) {
+        throw std::invalid_argument("Matrix multiplication dimensions must agree.");
+    }
+    std::vector<double> y(nrows);
+    multiply(x.data(), y.data());
+    return y;
+}
+
+Matrix CsrMatrix::operator*(const Matrix& other) const {
+    if (ncols != other.rows()) {
+        throw std::invalid_argument("Matrix multiplication dimensions must agree.");
+    }
+    const size_t n = other.cols();
+    Matrix result(nrows, n);
+    for_row_chunks(ptr, nrows, nnz() * n, [&](size_t r0, size_t r1) {
+        for (size_t i = r0; i < r1; ++i) {
+            double* c = result.row(i);
+            for (size_t p = ptr[i]; p < ptr[i + 1]; ++p) {
+                const double a = vals[p];
+                const double* b = other.row(idx[p]);
+                for (size_t j = 0; j < n; ++j) {
+                    c[j] += a * b[j];
+                }
+            }
+        }
+    });
+    return result;
+}
+
+CsrMatrix CsrMatrix::operator*(const CsrMatrix& other) const {
+    if (ncols != other.nrows) {
+        throw std::invalid_argument("Matrix multiplication dimensions must agree.");
+    }
+    CsrMatrix result(nrows, other.ncols);
+    // Dense accumulator for one row of the result; mark[j] records the last
+    // row that touched column j so it never needs clearing.
+    std::vector<double> acc(other.ncols, 0.0);
+    std::vector<size_t> mark(other.ncols, nrows);
+    std::vector<size_t> touched;
+    for (size_t i = 0; i < nrows; ++i) {
+        touched.clear();
+        for (size_t p = ptr[i]; p < ptr[i + 1]; ++p) {
+            const double a = vals[p];
+            const size_t k = idx[p];
+            for (size_t q = other.ptr[k]; q < other.ptr[k + 1]; ++q) {
+                const size_t j = other.idx[q];
+                if (mark[j] != i) {
+                    mark[j] = i;
+                    acc[j] = 0.0;
+                    touched.push_back(j);
+                }
+                acc[j] += a * other.vals[q];
+            }
+        }
+        std::sort(touched.begin(), touched.end());
+        for (size_t j : touched) {
+            if (acc[j] != 0.0) {
+                result.idx.push_back(j);
+                result.vals.push_back(acc[j]);
+            }
+        }
+        result.ptr[i + 1] = result.vals.size();
+    }
+    return result;
+}
+
+namespace {
+
+    /**
+    * Merges the sorted rows of a and b, storing op(a_ij, b_ij) where either is present.
+    */
+    template <class Op>
+    CsrMatrix merge(const CsrMatrix& a, const CsrMatrix& b, Op op) {
+        if (a.rows() != b.rows() || a.cols() != b.cols()) {
+            throw std::invalid_argument("Matrix dimensions must agree.");
+        }
+        const std::vector<size_t>& ap = a.row_ptr();
+        const std::vector<size_t>& ai = a.col_idx();
+        const std::vector<double>& av = a.values();
+        const std::vector<size_t>& bp = b.row_ptr();
+        const std::vector<size_t>& bi = b.col_idx();
+        const std::vector<double>& bv = b.values();
+        std::vector<size_t> ptr(a.rows() + 1, 0);
+        std::vector<size_t> idx;
+        std::vector<double> vals;
+        idx.reserve(std::max(a.nnz(), b.nnz()));
+        vals.reserve(std::max(a.nnz(), b.nnz()));
+        auto emit = [&](size_t j, double v) {
+            if (v != 0.0) {
+                idx.push_back(j);
+                vals.push_back(v);
+            }
+        };
+        for (size_t i = 0; i < a.rows(); ++i) {
+            size_t p = ap[i], q = bp[i];
+            while (p < ap[i + 1] && q < bp[i + 1]) {
+                if (ai[p] < bi[q]) {
+                    emit(ai[p], op(av[p], 0.0));
+                    ++p;
+                } else if (bi[q] < ai[p]) {
+                    emit(bi[q], op(0.0, bv[q]));
+                    ++q;
+                } else {
+                    emit(ai[p], op(av[p], bv[q]));
+                    ++p;
+                    ++q;
+                }
+            }
+            for (; p < ap[i + 1]; ++p) {
+                emit(ai[p], op(av[p], 0.0));
+            }
+            for (; q < bp[i + 1]; ++q) {
+                emit(bi[q], op(0.0, bv[q]));
+            }
+            ptr[i + 1] = vals.size();
+        }
+        return CsrMatrix(a.rows(), a.cols(), std::move(ptr), std::move(idx), std::move(vals));
+    }
+
+}
+
+CsrMatrix CsrMatrix::operator+(const CsrMatrix& other) const {
+    return merge(*this, other, [](double a, double b) { return a + b; });
+}
+
+CsrMatrix CsrMatrix::operator-(const CsrMatrix& other) const {
+    return merge(*this, other, [](double a, double b) { return a - b; });
+}
+
+CsrMatrix CsrMatrix::operator*(double scalar) const {
+    CsrMatrix result(nrows, ncols);
+    if (scalar == 0.0) {
+        return result;
+    }
+    result.ptr = ptr;
+    result.idx = idx;
+    result.vals.resize(vals.size());
+    for (size_t p = 0; p < vals.size(); ++p) {
+        result.vals[p] = vals[p] * scalar;
+    }
+    return result;
+}
+
+CsrMatrix CsrMatrix::operator!() const {
+    CsrMatrix result(ncols, nrows);
+    std::vector<size_t>& tp = result.ptr;
+    for (size_t p = 0; p < nnz(); ++p) {
+        ++tp[idx[p] + 1];
+    }
+    for (size_t j = 0; j < ncols; ++j) {
+        tp[j + 1] += tp[j];
+    }
+    result.idx.resize(nnz());
+    result.vals.resize(nnz());
+    // Walking the rows in order keeps the row indices of every column sorted.
+    std::vector<size_t> next(tp.begin(), tp.end() - 1);
+    for (size_t i = 0; i < nrows; ++i) {
+        for (size_t p = ptr[i]; p < ptr[i + 1]; ++p) {
+            const size_t q = next[idx[p]]++;
+            result.idx[q] = i;
+            result.vals[q] = vals[p];
+        }
+    }
+    return result;
+}
+
+bool CsrMatrix::operator==(const CsrMatrix& other) const {
+    return nrows == other.nrows && ncols == other.ncols && ptr == other.ptr && idx == other.idx && vals == other.vals;
+}
+
+CscMatrix CscMatrix::from_triplets(size_t rows, size_t cols, const std::vector<Triplet>& entries) {
+    std::vector<Triplet> swapped(entries.size());
+    for (size_t k = 0; k < entries.size(); ++k) {
+        swapped[k] = {entries[k].col, entries[k].row, entries[k].value};
+    }
+    return CscMatrix(CsrMatrix::from_triplets(cols, rows, swapped), transposed_t{});
+}
+
+CscMatrix::CscMatrix(const ConstMatrixView& m) : t(m.cols(), m.rows()) {
+    std::vector<size_t> ptr(m.cols() + 1, 0);
+    std::vector<size_t> idx;
+    std::vector<double> vals;
+    for (size_t j = 0; j < m.cols(); ++j) {
+        for (size_t i = 0; i < m.rows(); ++i) {
+            if (m(i, j) != 0.0) {
+                idx.push_back(i);
+                vals.push_back(m(i, j));
+            }
+        }
+        ptr[j + 1] = vals.size();
+    }
+    t = CsrMatrix(m.cols(), m.rows(), std::move(ptr), std::move(idx), std::move(vals));
+}
+
+void CscMatrix::multiply(const double* x, double* y) const {
+    const std::vector<size_t>& ptr = t.row_ptr();
+    const std::vector<size_t>& idx = t.col_idx();
+    const std::vector<double>& vals = t.values();
+    std::fill(y, y + rows(), 0.0);
+    for (size_t j = 0; j < cols(); ++j) {
+        const double xj = x[j];
+        for (size_t p = ptr[j]; p < ptr[j + 1]; ++p) {
+            y[idx[p]] += vals[p] * xj;
+        }
+    }
+}
+
+std::vector<double> CscMatrix::operator*(const std::vector<double>& x) const {
+    if (x.size() != cols()) {
+        throw std::invalid_argument("Matrix multiplication dimensions must agree.");
+    }
+    std::vector<double> y(rows());
+    multiply(x.data(), y.data());
+    return y;
+}
+
+Matrix CscMatrix::operator*(const Matrix& other) const {
+    if (cols() != other.rows()) {
+        throw std::invalid_argument("Matrix multiplication dimensions must agree.");
+    }
+    const std::vector<size_t>& ptr = t.row_ptr();
+    const std::vector<size_t>& idx = t.col_idx();
+    const std::vector<double>& vals = t.values();
+    const size_t n = other.cols();
+    Matrix result(rows(), n);
+    for (size_t k = 0; k < cols(); ++k) {
+        const double* b = other.row(k);
+        for (size_t p = ptr[k]; p < ptr[k + 1]; ++p) {
+            const double a = vals[p];
+            double* c = result.row(idx[p]);
+            for (size_t j = 0; j < n; ++j) {
+                c[j] += a * b[j];
+            }
+        }
+    }
+    return result;
+}
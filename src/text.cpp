@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mat_io.h"
+
+namespace {
+
+    // Size of the blocks read from and written to the stream.
+    constexpr std::size_t text_block = 1 << 20;
+
+    bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+    /**
+    * Accumulates the rows of read_text: one call per line.
+    */
+    template <class T>
+    struct TextParser {
+        TextFormat format;
+        std::vector<T> values;
+        std::size_t rows = 0;
+        std::size_t cols = 0;
+        std::size_t line = 0; //< 1-based number of the current line
+
+        explicit TextParser(const TextFormat& format) : format(format) {}
+
+        /**
+        * Whether c pads a field; a tab delimiter separates fields instead.
+        */
+        bool is_padding(char c) const {
+            return is_blank(c) && (c != format.delimiter || format.delimiter == ' ');
+        }
+
+        [[noreturn]] void fail(const char* begin, const char* at) const {
+            throw std::invalid_argument("Invalid number at line " + std::to_string(line) + ", column " +
+                                        std::to_string(at - begin + 1) + ".");
+        }
+
+        void parse_line(const char* begin, const char* end) {
+            ++line;
+            if (end > begin && end[-1] == '\r') {
+                --end;
+            }
+            const char* p = begin;
+            while (p < end && is_padding(*p)) {
+                ++p;
+            }
+            if (p == end) {
+                return;
+            }
+            const bool spaces = format.delimiter == ' ';
+            std::size_t fields = 0;
+            for (;;) {
+                T v;
+                const std::from_chars_result r = std::from_chars(p, end, v);
+                if (r.ec != std::errc()) {
+                    fail(begin, p);
+                }
+                values.push_back(v);
+                ++fields;
+                p = r.ptr;
+                const char* field_end = p;
+                while (p < end && is_padding(*p)) {
+                    ++p;
+                }
+                if (p == end) {
+                    break;
+                }
+                if (spaces) {
+                    if (p == field_end) {
+                        fail(begin, p);
+                    }
+                } else {
+                    if (*p != format.delimiter) {
+                        fail(begin, p);
+                    }
+                    ++p;
+                    while (p < end && is_padding(*p)) {
+                        ++p;
+                    }
+                }
+            }
+            if (rows == 0) {
+                cols = fields;
+            } else if (fields != cols) {
+                throw std::invalid_argument{"All rows must have the same number of columns."};
+            }
+            ++rows;
+        }
+    };
+
+}
+
+template <class T>
+BasicMatrix<T> read_text(std::istream& in, const TextFormat& format) {
+    TextParser<T> parser(format);
+    // Whole lines are parsed out of each block; a partial last line moves to
+    // the front of the buffer and is completed by the next read.
+    std::vector<char> buf(text_block);
+    std::size_t have = 0;
+    for (;;) {
+        in.read(buf.data() + have, static_cast<std::streamsize>(buf.size() - have));
+        have += static_cast<std::size_t>(in.gcount());
+        const bool eof = !in;
+        const char* data = buf.data();
+        const char* end = data + have;
+        const char* p = data;
+        for (const char* nl; (nl = static_cast<const char*>(std::memchr(p, '\n', end - p))) != nullptr; p = nl + 1) {
+            parser.parse_line(p, nl);
+        }
+        if (eof) {
+            if (p < end) {
+                parser.parse_line(p, end);
+            }
+            break;
+        }
+        have = static_cast<std::size_t>(end - p);
+        std::memmove(buf.data(), p, have);
+        if (have == buf.size()) {
+            buf.resize(2 * buf.size());
+        }
+    }
+    if (parser.rows == 0) {
+        throw std::runtime_error{"data cannot be empty"};
+    }
+    BasicMatrix<T> m(parser.rows, parser.cols);
+    for (std::size_t i = 0; i < parser.rows; ++i) {
+        std::copy_n(parser.values.begin() + i * parser.cols, parser.cols, m.row(i));
+    }
+    return m;
+}
+
+template <class T>
+void write_text(std::ostream& out, const BasicConstMatrixView<T>& m, const TextFormat& format) {
+    if (format.precision < 0 || format.precision > std::numeric_limits<T>::max_digits10) {
+        throw std::invalid_argument("Text precision must be between 0 and " +
+                                    std::to_string(std::numeric_limits<T>::max_digits10) + ".");
+    }
+    // Room for the longest number (about 50 characters for a long double in
+    // scientific notation) plus a delimiter, with margin.
+    constexpr std::size_t max_field = 128;
+    std::vector<char> buf(text_block + max_field);
+    char* p = buf.data();
+    char* const limit = buf.data() + text_block;
+    for (std::size_t i = 0; i < m.rows(); ++i) {
+        const T* row = m.row(i);
+        for (std::size_t j = 0; j < m.cols(); ++j) {
+            if (j > 0) {
+                *p++ = format.delimiter;
+            }
+            const std::to_chars_result r = format.precision > 0
+                ? std::to_chars(p, p + max_field, row[j], std::chars_format::general, format.precision)
+                : std::to_chars(p, p + max_field, row[j]);
+            if (r.ec != std::errc()) {
+                throw std::invalid_argument("Number does not fit in a text field.");
+            }
+            p = r.ptr;
+            if (p >= limit) {
+                out.write(buf.data(), p - buf.data());
+                p = buf.data();
+            }
+        }
+        *p++ = '\n';
+    }
+    out.write(buf.data(), p - buf.data());
+}
+
+template <class T>
+BasicMatrix<T> load_text(const std::string& path, const TextFormat& format) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + path + " for reading.");
+    }
+    return read_text<T>(in, format);
+}
+
+template <class T>
+void save_text(const std::string& path, const BasicConstMatrixView<T>& m, const TextFormat& format) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot open " + path + " for writing.");
+    }
+    write_text(out, m, format);
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Write to " + path + " failed.");
+    }
+}
+
+#define MAT_INSTANTIATE_TEXT(T) \
+    template BasicMatrix<T> read_text<T>(std::istream&, const TextFormat&); \
+    template void write_text<T>(std::ostream&, const BasicConstMatrixView<T>&, const TextFormat&); \
+    template BasicMatrix<T> load_text<T>(const std::string&, const TextFormat&); \
+    template void save_text<T>(const std::string&, const BasicConstMatrixView<T>&, const TextFormat&);
+
+MAT_INSTANTIATE_TEXT(float)
+MAT_INSTANTIATE_TEXT(double)
+MAT_INSTANTIATE_TEXT(long double)
+
+#undef MAT_INSTANTIATE_TEXT
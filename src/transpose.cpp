@@ -0,0 +1,209 @@
+#include <utility>
+
+#include "mat_kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MAT_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace mat_kernels {
+
+namespace {
+
+    // Register tile edge, and the largest block handled without further
+    // splitting: a 32 x 32 source plus destination is 16 KiB and fits in L1.
+    constexpr std::size_t TILE = 4;
+    constexpr std::size_t LEAF = 32;
+
+    /**
+    * Writes the transpose of the 4 x 4 tile at a into b.
+    */
+    template <class T>
+    using TileKernel = void (*)(const T* a, std::size_t lda, T* b, std::size_t ldb);
+
+    template <class T>
+    void tile_scalar(const T* a, std::size_t lda, T* b, std::size_t ldb) {
+        for (std::size_t i = 0; i < TILE; ++i) {
+            for (std::size_t j = 0; j < TILE; ++j) {
+                b[j * ldb + i] = a[i * lda + j];
+            }
+        }
+    }
+
+#ifdef MAT_X86_DISPATCH
+
+    __attribute__((target("avx2")))
+    void tile_avx2(const double* a, std::size_t lda, double* b, std::size_t ldb) {
+        const __m256d r0 = _mm256_loadu_pd(a);
+        const __m256d r1 = _mm256_loadu_pd(a + lda);
+        const __m256d r2 = _mm256_loadu_pd(a + 2 * lda);
+        const __m256d r3 = _mm256_loadu_pd(a + 3 * lda);
+        const __m256d t0 = _mm256_unpacklo_pd(r0, r1); // a00 a10 a02 a12
+        const __m256d t1 = _mm256_unpackhi_pd(r0, r1); // a01 a11 a03 a13
+        const __m256d t2 = _mm256_unpacklo_pd(r2, r3); // a20 a30 a22 a32
+        const __m256d t3 = _mm256_unpackhi_pd(r2, r3); // a21 a31 a23 a33
+        _mm256_storeu_pd(b, _mm256_permute2f128_pd(t0, t2, 0x20));
+        _mm256_storeu_pd(b + ldb, _mm256_permute2f128_pd(t1, t3, 0x20));
+        _mm256_storeu_pd(b + 2 * ldb, _mm256_permute2f128_pd(t0, t2, 0x31));
+        _mm256_storeu_pd(b + 3 * ldb, _mm256_permute2f128_pd(t1, t3, 0x31));
+    }
+
+#endif
+
+    template <class T>
+    TileKernel<T> tile_kernel() {
+        return tile_scalar<T>;
+    }
+
+    // Only double has a register tile; other element types use the scalar one.
+    template <>
+    TileKernel<double> tile_kernel<double>() {
+#ifdef MAT_X86_DISPATCH
+        static const TileKernel<double> kernel = active_isa() >= Isa::avx2 ? tile_avx2 : tile_scalar<double>;
+        return kernel;
+#else
+        return tile_scalar<double>;
+#endif
+    }
+
+    /**
+    * Splits a dimension larger than LEAF roughly in half on a tile boundary.
+    */
+    std::size_t split(std::size_t n) {
+        return n / 2 / TILE * TILE;
+    }
+
+    template <class T>
+    void transpose_leaf(std::size_t m, std::size_t n, const T* A, std::size_t lda,
+                        T* B, std::size_t ldb, TileKernel<T> tile) {
+        const std::size_t m4 = m / TILE * TILE;
+        const std::size_t n4 = n / TILE * TILE;
+        for (std::size_t i = 0; i < m4; i += TILE) {
+            for (std::size_t j = 0; j < n4; j += TILE) {
+                tile(A + i * lda + j, lda, B + j * ldb + i, ldb);
+            }
+            for (std::size_t r = i; r < i + TILE; ++r) {
+                for (std::size_t j = n4; j < n; ++j) {
+                    B[j * ldb + r] = A[r * lda + j];
+                }
+            }
+        }
+        for (std::size_t i = m4; i < m; ++i) {
+            for (std::size_t j = 0; j < n; ++j) {
+                B[j * ldb + i] = A[i * lda + j];
+            }
+        }
+    }
+
+    /**
+    * Halves the longer side until the block fits in L1, so every level of the
+    * cache hierarchy is used well without knowing its size.
+    */
+    template <class T>
+    void transpose_rec(std::size_t m, std::size_t n, const T* A, std::size_t lda,
+                       T* B, std::size_t ldb, TileKernel<T> tile) {
+        if (m <= LEAF && n <= LEAF) {
+            transpose_leaf(m, n, A, lda, B, ldb, tile);
+        } else if (m >= n) {
+            const std::size_t h = split(m);
+            transpose_rec(h, n, A, lda, B, ldb, tile);
+            transpose_rec(m - h, n, A + h * lda, lda, B + h, ldb, tile);
+        } else {
+            const std::size_t h = split(n);
+            transpose_rec(m, h, A, lda, B, ldb, tile);
+            transpose_rec(m, n - h, A + h, lda, B + h * ldb, ldb, tile);
+        }
+    }
+
+    /**
+    * Exchanges the m x n block X with the transpose of the n x m block Y.
+    */
+    template <class T>
+    void swap_leaf(std::size_t m, std::size_t n, T* X, T* Y, std::size_t ld, TileKernel<T> tile) {
+        const std::size_t m4 = m / TILE * TILE;
+        const std::size_t n4 = n / TILE * TILE;
+        T tmp[TILE * TILE];
+        for (std::size_t i = 0; i < m4; i += TILE) {
+            for (std::size_t j = 0; j < n4; j += TILE) {
+                T* x = X + i * ld + j;
+                T* y = Y + j * ld + i;
+                tile(x, ld, tmp, TILE);
+                tile(y, ld, x, ld);
+                for (std::size_t r = 0; r < TILE; ++r) {
+                    for (std::size_t c = 0; c < TILE; ++c) {
+                        y[r * ld + c] = tmp[r * TILE + c];
+                    }
+                }
+            }
+            for (std::size_t r = i; r < i + TILE; ++r) {
+                for (std::size_t j = n4; j < n; ++j) {
+                    std::swap(X[r * ld + j], Y[j * ld + r]);
+                }
+            }
+        }
+        for (std::size_t i = m4; i < m; ++i) {
+            for (std::size_t j = 0; j < n; ++j) {
+                std::swap(X[i * ld + j], Y[j * ld + i]);
+            }
+        }
+    }
+
+    template <class T>
+    void swap_rec(std::size_t m, std::size_t n, T* X, T* Y, std::size_t ld, TileKernel<T> tile) {
+        if (m <= LEAF && n <= LEAF) {
+            swap_leaf(m, n, X, Y, ld, tile);
+        } else if (m >= n) {
+            const std::size_t h = split(m);
+            swap_rec(h, n, X, Y, ld, tile);
+            swap_rec(m - h, n, X + h * ld, Y + h, ld, tile);
+        } else {
+            const std::size_t h = split(n);
+            swap_rec(m, h, X, Y, ld, tile);
+            swap_rec(m, n - h, X + h, Y + h * ld, ld, tile);
+        }
+    }
+
+    /**
+    * Transposes the two diagonal quadrants recursively and swaps the off-diagonal ones.
+    */
+    template <class T>
+    void inplace_rec(std::size_t n, T* A, std::size_t ld, TileKernel<T> tile) {
+        if (n <= LEAF) {
+            for (std::size_t i = 0; i < n; ++i) {
+                for (std::size_t j = i + 1; j < n; ++j) {
+                    std::swap(A[i * ld + j], A[j * ld + i]);
+                }
+            }
+            return;
+        }
+        const std::size_t h = split(n);
+        inplace_rec(h, A, ld, tile);
+        inplace_rec(n - h, A + h * ld + h, ld, tile);
+        swap_rec(h, n - h, A + h, A + h * ld, ld, tile);
+    }
+
+}
+
+    template <class T>
+    void transpose(std::size_t m, std::size_t n, const T* A, std::size_t lda, T* B, std::size_t ldb) {
+        transpose_rec(m, n, A, lda, B, ldb, tile_kernel<T>());
+    }
+
+    template <class T>
+    void transpose_inplace(std::size_t n, T* A, std::size_t lda) {
+        inplace_rec(n, A, lda, tile_kernel<T>());
+    }
+
+#define MAT_INSTANTIATE_TRANSPOSE(T) \
+    template void transpose<T>(std::size_t, std::size_t, const T*, std::size_t, T*, std::size_t); \
+    template void transpose_inplace<T>(std::size_t, T*, std::size_t);
+
+    MAT_INSTANTIATE_TRANSPOSE(float)
+    MAT_INSTANTIATE_TRANSPOSE(double)
+    MAT_INSTANTIATE_TRANSPOSE(long double)
+    MAT_INSTANTIATE_TRANSPOSE(std::complex<double>)
+
+#undef MAT_INSTANTIATE_TRANSPOSE
+
+}
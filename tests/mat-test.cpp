@@ -3,7 +3,43 @@
 
 #include "doctest.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+
 #include "mat.h"
+#include "mat_kernels.h"
+#include "mat_parallel.h"
+#include "mat_chain.h"
+#include "mat_eval.h"
+#include "mat_fixed.h"
+#include "mat_batch.h"
+#include "mat_cholesky.h"
+#include "mat_lu.h"
+#include "mat_io.h"
+#include "mat_sparse.h"
+#include "mat_script.h"
+
+// Counts the aligned allocations made by Matrix storage.
+static std::atomic<size_t> aligned_allocations{0};
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    ++aligned_allocations;
+    void* p = std::aligned_alloc(static_cast<std::size_t>(align), (size + static_cast<std::size_t>(align) - 1) & ~(static_cast<std::size_t>(align) - 1));
+    if (p == nullptr)
+        throw std::bad_alloc{};
+    return p;
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
 
 TEST_CASE("Addition test") {
     Matrix A({{1,2}, {3,4}}), B({{1,2}, {3,4}});
@@ -122,4 +158,1131 @@ TEST_CASE("Exclusion test when calculating the inverse matrix for a degenerate m
 
 TEST_CASE("Exclusion test when creating a matrix with incorrect dimensions") {
     CHECK_THROWS_AS(Matrix(0, 0), std::runtime_error);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Contiguous aligned storage test") {
+    Matrix A({{1,2,3}, {4,5,6}});
+
+    CHECK(A.rows() == 2);
+    CHECK(A.cols() == 3);
+    CHECK(A.stride() == 3);
+    CHECK(reinterpret_cast<std::uintptr_t>(A.data()) % 64 == 0);
+    CHECK(A.row(1) == A.data() + A.stride());
+    CHECK(A.row(1)[2] == 6);
+    CHECK(A(0, 1) == 2);
+}
+
+TEST_CASE("Exclusion test when creating a matrix from ragged rows") {
+    CHECK_THROWS_AS(Matrix({{1,2}, {3}}), std::invalid_argument);
+}
+
+TEST_CASE("Blocked matrix multiplication test") {
+    // Large and oddly shaped enough to take the packed path with partial tiles.
+    const size_t m = 131, k = 97, n = 70;
+    std::vector<std::vector<double>> a(m, std::vector<double>(k)), b(k, std::vector<double>(n));
+    for (size_t i = 0; i < m; ++i)
+        for (size_t j = 0; j < k; ++j)
+            a[i][j] = static_cast<double>((i * 7 + j * 3) % 11) - 5;
+    for (size_t i = 0; i < k; ++i)
+        for (size_t j = 0; j < n; ++j)
+            b[i][j] = static_cast<double>((i * 5 + j * 2) % 13) - 6;
+    Matrix A(a), B(b);
+
+    std::vector<std::vector<double>> expected(m, std::vector<double>(n));
+    for (size_t i = 0; i < m; ++i)
+        for (size_t j = 0; j < n; ++j)
+            for (size_t p = 0; p < k; ++p)
+                expected[i][j] += a[i][p] * b[p][j];
+
+    CHECK(A * B == Matrix(expected));
+}
+
+TEST_CASE("Packed gemm scales, accumulates and transposes") {
+    using namespace mat_kernels;
+    // Edges that are not multiples of any micro-kernel tile, and a k longer than one KC panel.
+    const size_t m = 53, k = 301, n = 45;
+    std::vector<double> a(m * k), b(k * n), c(m * n);
+    for (size_t i = 0; i < a.size(); ++i) a[i] = static_cast<double>(i * 7 % 11) - 5;
+    for (size_t i = 0; i < b.size(); ++i) b[i] = static_cast<double>(i * 5 % 13) - 6;
+    for (size_t i = 0; i < c.size(); ++i) c[i] = static_cast<double>(i % 9) - 4;
+
+    for (Transpose ta : {Transpose::no, Transpose::yes}) {
+        for (Transpose tb : {Transpose::no, Transpose::yes}) {
+            // a and b hold op(A) and op(B) as stored, whichever way they are read.
+            const size_t lda = ta == Transpose::no ? k : m;
+            const size_t ldb = tb == Transpose::no ? n : k;
+            auto at = [&](size_t i, size_t p) { return ta == Transpose::no ? a[i * lda + p] : a[p * lda + i]; };
+            auto bt = [&](size_t p, size_t j) { return tb == Transpose::no ? b[p * ldb + j] : b[j * ldb + p]; };
+            std::vector<double> expected(c);
+            for (size_t i = 0; i < m; ++i)
+                for (size_t j = 0; j < n; ++j) {
+                    double s = 0;
+                    for (size_t p = 0; p < k; ++p)
+                        s += at(i, p) * bt(p, j);
+                    expected[i * n + j] = 2 * s - 3 * c[i * n + j];
+                }
+            std::vector<double> out(c);
+            gemm(ta, tb, m, n, k, 2.0, a.data(), lda, b.data(), ldb, -3.0, out.data(), n);
+            CHECK(out == expected);
+        }
+    }
+}
+
+TEST_CASE("Elementwise kernels agree across instruction sets") {
+    using namespace mat_kernels;
+    const size_t n = 37; // not a multiple of any vector width
+    std::vector<double> a(n), b(n), expected(n), out(n);
+    for (size_t i = 0; i < n; ++i) {
+        a[i] = 0.5 * i - 3;
+        b[i] = 2.0 - 0.25 * i;
+    }
+    for (Isa isa : {Isa::scalar, Isa::sse2, Isa::avx2, Isa::avx512}) {
+        // Levels above the selected one may not be supported by this CPU.
+        const ElementwiseKernels* k = elementwise_for(isa);
+        if (k == nullptr || isa > active_isa())
+            continue;
+        CAPTURE(isa_name(isa));
+
+        k->add(a.data(), b.data(), out.data(), n);
+        for (size_t i = 0; i < n; ++i) expected[i] = a[i] + b[i];
+        CHECK(out == expected);
+
+        k->sub(a.data(), b.data(), out.data(), n);
+        for (size_t i = 0; i < n; ++i) expected[i] = a[i] - b[i];
+        CHECK(out == expected);
+
+        k->scale(a.data(), 1.5, out.data(), n);
+        for (size_t i = 0; i < n; ++i) expected[i] = a[i] * 1.5;
+        CHECK(out == expected);
+
+        CHECK(k->equal(a.data(), a.data(), n));
+        std::vector<double> c(a);
+        c[n - 1] += 1;
+        CHECK_FALSE(k->equal(a.data(), c.data(), n));
+    }
+}
+
+TEST_CASE("LU determinant test") {
+    // Zero leading pivot forces a row swap.
+    Matrix A({{0,2,1}, {1,1,1}, {2,1,3}});
+    CHECK(*A == doctest::Approx(-3.0));
+
+    Matrix S({{1,2,3}, {4,5,6}, {7,8,9}});
+    CHECK(*S == doctest::Approx(0.0));
+
+    // Upper triangular 12x12: the determinant is the product of the diagonal.
+    const size_t n = 12;
+    Matrix T(n, n);
+    double expected = 1;
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = i; j < n; ++j)
+            T(i, j) = 1.0 + (i + j) % 3;
+        expected *= T(i, i);
+    }
+    CHECK(*(!T) == doctest::Approx(expected));
+}
+
+TEST_CASE("LU inverse test") {
+    Matrix A({{4,7,2}, {3,6,1}, {2,5,3}});
+    Matrix product = A * ~A;
+    for (size_t i = 0; i < 3; ++i)
+        for (size_t j = 0; j < 3; ++j)
+            CHECK(product(i, j) == doctest::Approx(i == j ? 1.0 : 0.0));
+
+    // Singular up to rounding: the third row is the sum of the first two.
+    Matrix S({{0.1,0.2,0.3}, {0.4,0.5,0.6}, {0.5,0.7,0.9}});
+    CHECK_THROWS_AS(~S, std::runtime_error);
+}
+
+TEST_CASE("Fused expression chain test") {
+    Matrix A({{1,2}, {3,4}}), B({{5,6}, {7,8}}), C({{1,1}, {2,2}});
+
+    Matrix D = A + B - C * 2.0;
+    CHECK(D == Matrix({{4,6}, {6,8}}));
+
+    A = A + B;
+    CHECK(A == Matrix({{6,8}, {10,12}}));
+
+    Matrix E = (B - C) * (A * 0.5);
+    CHECK(E == Matrix({{37,46}, {45,56}}));
+
+    CHECK(*(B - C) == doctest::Approx(-1.0));
+    CHECK_THROWS_AS(A + Matrix({{1,2,3}}) * 2.0, std::invalid_argument);
+}
+
+TEST_CASE("Compound assignment test") {
+    Matrix A({{1,2}, {3,4}}), B({{1,1}, {1,1}});
+    A += B;
+    CHECK(A == Matrix({{2,3}, {4,5}}));
+    A -= B * 2.0;
+    CHECK(A == Matrix({{0,1}, {2,3}}));
+    A *= 3.0;
+    CHECK(A == Matrix({{0,3}, {6,9}}));
+    A *= Matrix({{1,0}, {1,1}});
+    CHECK(A == Matrix({{3,3}, {15,9}}));
+    CHECK_THROWS_AS(A += Matrix({{1,2,3}}), std::invalid_argument);
+}
+
+TEST_CASE("Expiring operands reuse their buffer") {
+    Matrix A({{1,2}, {3,4}}), B({{5,6}, {7,8}});
+
+    size_t before = aligned_allocations;
+    Matrix C = Matrix(A) + B;      // one allocation for the copy, none for the sum
+    Matrix D = A - Matrix(B);      // the right operand is reused too
+    Matrix E = Matrix(A) * 2.0 + std::move(C);
+    CHECK(aligned_allocations - before == 3);
+
+    CHECK(D == Matrix({{-4,-4}, {-4,-4}}));
+    CHECK(E == Matrix({{8,12}, {16,20}}));
+
+    before = aligned_allocations;
+    Matrix F = std::move(D);
+    F += A;
+    F *= 0.5;
+    CHECK(aligned_allocations == before);
+}
+
+TEST_CASE("Parallel matrix multiplication test") {
+    const size_t m = 300, k = 170, n = 260;
+    Matrix A(m, k), B(k, n);
+    for (size_t i = 0; i < m; ++i)
+        for (size_t j = 0; j < k; ++j)
+            A(i, j) = static_cast<double>((i * 3 + j) % 7) - 3;
+    for (size_t i = 0; i < k; ++i)
+        for (size_t j = 0; j < n; ++j)
+            B(i, j) = static_cast<double>((i + j * 5) % 9) - 4;
+
+    const size_t saved = mat_parallel::num_threads();
+    mat_parallel::set_num_threads(1);
+    Matrix serial = A * B;
+    mat_parallel::set_num_threads(4);
+    CHECK(mat_parallel::num_threads() == 4);
+    Matrix parallel = A * B;
+    mat_parallel::set_num_threads(saved);
+
+    CHECK(parallel == serial);
+}
+
+TEST_CASE("Thread pool runs every index once and propagates exceptions") {
+    std::vector<int> hits(1000);
+    mat_parallel::parallel_for(hits.size(), [&](size_t i) { hits[i]++; });
+    CHECK(std::count(hits.begin(), hits.end(), 1) == 1000);
+
+    CHECK_THROWS_AS(mat_parallel::parallel_for(10, [](size_t i) {
+        if (i == 7)
+            throw std::runtime_error("boom");
+    }), std::runtime_error);
+}
+
+TEST_CASE("Task graph runs every task after its dependencies") {
+    const size_t saved = mat_parallel::num_threads();
+    mat_parallel::set_num_threads(4);
+    // A layered graph: each task of layer l depends on two tasks of layer l - 1.
+    const size_t width = 16, layers = 20, n = width * layers;
+    std::vector<std::vector<size_t>> dependents(n);
+    for (size_t l = 1; l < layers; ++l)
+        for (size_t i = 0; i < width; ++i) {
+            dependents[(l - 1) * width + i].push_back(l * width + i);
+            dependents[(l - 1) * width + (i + 1) % width].push_back(l * width + i);
+        }
+    std::vector<std::atomic<int>> done(n);
+    std::atomic<size_t> violations{0};
+    mat_parallel::run_graph(dependents, [&](size_t t) {
+        const size_t l = t / width, i = t % width;
+        if (l > 0 && (done[(l - 1) * width + i].load() == 0 || done[(l - 1) * width + (i + 1) % width].load() == 0))
+            ++violations;
+        done[t].fetch_add(1);
+    });
+    CHECK(violations.load() == 0);
+    CHECK(std::all_of(done.begin(), done.end(), [](const std::atomic<int>& d) { return d.load() == 1; }));
+
+    std::atomic<size_t> runs{0};
+    CHECK_THROWS_AS(mat_parallel::run_graph(dependents, [&](size_t t) {
+        ++runs;
+        if (t == 3)
+            throw std::runtime_error("boom");
+    }), std::runtime_error);
+    CHECK(runs.load() < n);
+    mat_parallel::set_num_threads(saved);
+}
+
+TEST_CASE("Matrix chain order test") {
+    // 10x100 * 100x5 * 5x50: (AB)C costs 7500 multiply-adds, A(BC) costs 75000.
+    ChainOrder order = plan_chain({{10,100}, {100,5}, {5,50}});
+    CHECK(order.split[0 * 3 + 2] == 1);
+    CHECK(order.flops == 2.0 * 7500);
+
+    CHECK_THROWS_AS(plan_chain({{2,3}, {2,3}}), std::invalid_argument);
+
+    Matrix A({{1,2}, {3,4}, {5,6}}), B({{1,0,2}, {0,1,1}}), C({{2}, {1}, {0}});
+    double flops = 0;
+    Matrix P = multiply_chain({&A, &B, &C}, &flops);
+    CHECK(P == (A * B) * C);
+    CHECK(flops == 2.0 * (2*3*1 + 3*2*1));
+}
+
+TEST_CASE("Expression parser precedence test") {
+    CHECK(to_string(*parse_expression("A+B*C")) == "(A + (B * C))");
+    CHECK(to_string(*parse_expression("A*B+C")) == "((A * B) + C)");
+    CHECK(to_string(*parse_expression("A - B - C")) == "((A - B) - C)");
+    CHECK(to_string(*parse_expression("(A + B) * ~C - 2 * !D")) == "(((A + B) * ~(C)) - (2 * !(D)))");
+    CHECK(to_string(*parse_expression("*A * -B")) == "(*(A) * -(B))");
+
+    CHECK_THROWS_AS(parse_expression("A + "), std::invalid_argument);
+    CHECK_THROWS_AS(parse_expression("(A + B"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_expression("A B"), std::invalid_argument);
+
+    // Numbers are plain decimal whatever the locale: no hex floats, inf or nan.
+    CHECK(parse_expression("2.5")->value == 2.5);
+    CHECK(parse_expression(".5e1")->value == 5.0);
+    CHECK(parse_expression("1.5e-1")->value == 0.15);
+    CHECK_THROWS_AS(parse_expression("0x1p3"), std::invalid_argument);
+    CHECK_THROWS_AS(parse_expression("1 + .inf"), std::invalid_argument);
+
+    // Deep nesting is a syntax error rather than a stack overflow.
+    const size_t deep = 100000;
+    std::string sum = "A";
+    for (size_t i = 0; i < deep; ++i) sum += "+A";
+    for (const std::string& text : {std::string(deep, '(') + "A" + std::string(deep, ')'), std::string(deep, '-') + "A", sum})
+        CHECK_THROWS_WITH_AS(parse_expression(text), doctest::Contains("nested too deeply"), std::invalid_argument);
+    CHECK(parse_expression(std::string(500, '(') + "A" + std::string(500, ')'))->name == "A");
+    CHECK(parse_expression(std::string(500, '-') + "A")->op == ExprNode::Op::neg);
+}
+
+TEST_CASE("Expression evaluation test") {
+    std::map<std::string, Matrix> env;
+    env.emplace("A", Matrix({{1,2}, {3,4}}));
+    env.emplace("B", Matrix({{2,0}, {1,2}}));
+    env.emplace("C", Matrix({{1,1}, {1,1}}));
+    MatrixLookup lookup = [&](const std::string& name) -> const Matrix& { return env.at(name); };
+    const Matrix& A = env.at("A");
+    const Matrix& B = env.at("B");
+    const Matrix& C = env.at("C");
+
+    CHECK(std::get<Matrix>(evaluate(parse_expression("A+B*C"), lookup)) == A + B * C);
+    CHECK(std::get<Matrix>(evaluate(parse_expression("A*B+C"), lookup)) == A * B + C);
+    CHECK(std::get<Matrix>(evaluate(parse_expression("(A+B)*C"), lookup)) == (A + B) * C);
+    CHECK(std::get<Matrix>(evaluate(parse_expression("A - B - C"), lookup)) == A - B - C);
+    CHECK(std::get<Matrix>(evaluate(parse_expression("2 * !A * B * 0.5"), lookup)) == !A * B);
+    CHECK(std::get<Matrix>(evaluate(parse_expression("-A + A"), lookup)) == Matrix(2, 2));
+    CHECK(std::get<double>(evaluate(parse_expression("*A * *B"), lookup)) == doctest::Approx(-8.0));
+
+    Matrix inv = std::get<Matrix>(evaluate(parse_expression("~B * B"), lookup));
+    CHECK(inv(0, 0) == doctest::Approx(1.0));
+    CHECK(inv(0, 1) == doctest::Approx(0.0));
+
+    EvalStats stats;
+    evaluate(parse_expression("A * (B * C)"), lookup, &stats);
+    CHECK(stats.products == 2);
+    CHECK(stats.gemm_flops == 2.0 * (2*2*2 + 2*2*2));
+
+    CHECK_THROWS_AS(evaluate(parse_expression("A + *B"), lookup), std::invalid_argument);
+    CHECK_THROWS_AS(evaluate(parse_expression("!(*A)"), lookup), std::invalid_argument);
+    CHECK_THROWS_AS(evaluate(parse_expression("A + D"), lookup), std::out_of_range);
+}
+
+TEST_CASE("Expression sharing and cache test") {
+    std::map<std::string, Matrix> env;
+    env.emplace("A", Matrix({{1,2}, {3,4}}));
+    env.emplace("B", Matrix({{2,0}, {1,2}}));
+    env.emplace("C", Matrix({{1,1}, {1,1}}));
+    size_t lookups = 0;
+    MatrixLookup lookup = [&](const std::string& name) -> const Matrix& { ++lookups; return env.at(name); };
+    const Matrix& A = env.at("A");
+    const Matrix& B = env.at("B");
+    const Matrix& C = env.at("C");
+
+    // Equal subtrees are interned to one node.
+    ExprCache table(0);
+    ExprPtr e1 = table.intern(parse_expression("A*B + C"));
+    ExprPtr e2 = table.intern(parse_expression("(A*B) - 2"));
+    CHECK(e1->args[0] == e2->args[0]);
+    CHECK(table.shared(*e1->args[0]));
+    CHECK_FALSE(table.shared(*e1->args[1]));
+    CHECK(table.intern(parse_expression("A*B + C")) == e1);
+
+    // A repeated subexpression is computed once within one evaluation.
+    EvalStats stats;
+    CHECK(std::get<Matrix>(evaluate(parse_expression("A*B + A*B"), lookup, &stats)) == (A * B) * 2.0);
+    CHECK(stats.products == 1);
+    CHECK(stats.reused == 1);
+    stats = {};
+    CHECK(std::get<Matrix>(evaluate(parse_expression("~(A*B) * (A*B)"), lookup, &stats))(1, 1) == doctest::Approx(1.0));
+    CHECK(stats.products == 2);
+
+    // Results persist across evaluations sharing a cache.
+    ExprCache cache;
+    stats = {};
+    CHECK(std::get<Matrix>(evaluate(parse_expression("A*B + C"), lookup, cache, &stats)) == A * B + C);
+    CHECK(stats.products == 1);
+    stats = {};
+    lookups = 0;
+    CHECK(std::get<Matrix>(evaluate(parse_expression("A*B - C"), lookup, cache, &stats)) == A * B - C);
+    CHECK(stats.products == 0);
+    CHECK(stats.reused == 1);
+    CHECK(lookups == 1);
+    CHECK(cache.hits() == 1);
+    stats = {};
+    CHECK(std::get<double>(evaluate(parse_expression("*(A*B) + *(A*B)"), lookup, cache, &stats)) == doctest::Approx(-16.0));
+    CHECK(stats.products == 0);
+
+    // The budget bounds the cached bytes; least recently used results go first.
+    const size_t one = sizeof(Matrix) + 4 * sizeof(double);
+    ExprCache small(2 * one);
+    evaluate(parse_expression("A*B + C"), lookup, small);
+    evaluate(parse_expression("B*C + C"), lookup, small);
+    CHECK(small.size() == 2);
+    evaluate(parse_expression("A*B + C"), lookup, small);
+    CHECK(small.hits() == 1);
+    evaluate(parse_expression("C*A + C"), lookup, small);
+    CHECK(small.size() == 2);
+    CHECK(small.bytes() <= small.budget());
+    // B*C was evicted; recomputing it evicts A*B, while C*A stays.
+    stats = {};
+    evaluate(parse_expression("B*C + C"), lookup, small, &stats);
+    CHECK(stats.products == 1);
+    stats = {};
+    evaluate(parse_expression("C*A + C"), lookup, small, &stats);
+    CHECK(stats.products == 0);
+    small.clear();
+    CHECK(small.size() == 0);
+    CHECK(small.bytes() == 0);
+    CHECK(small.interned() > 0);
+    small.reset();
+    CHECK(small.interned() == 0);
+    stats = {};
+    CHECK(std::get<Matrix>(evaluate(parse_expression("A*B + C"), lookup, small, &stats)) == A * B + C);
+    CHECK(stats.products == 1);
+}
+
+TEST_CASE("Parallel expression evaluation test") {
+    const size_t saved = mat_parallel::num_threads();
+    mat_parallel::set_num_threads(4);
+    const size_t n = 64, terms = 16;
+    std::map<std::string, Matrix> env;
+    std::string text;
+    Matrix expected(n, n);
+    for (size_t t = 0; t < terms; ++t) {
+        Matrix P(n, n), Q(n, n);
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < n; ++j) {
+                P(i, j) = static_cast<double>((i * 7 + j * 3 + t) % 11) - 5;
+                Q(i, j) = static_cast<double>((i + j * 5 + 2 * t) % 13) - 6;
+            }
+        expected = expected + P * Q;
+        const std::string p = "P" + std::to_string(t), q = "Q" + std::to_string(t);
+        text += (t == 0 ? "" : " + ") + p + "*" + q;
+        env.emplace(p, std::move(P));
+        env.emplace(q, std::move(Q));
+    }
+    env.emplace("Z", Matrix(n, n));
+    MatrixLookup lookup = [&](const std::string& name) -> const Matrix& { return env.at(name); };
+
+    // Many small independent products run as a task graph.
+    EvalStats stats;
+    CHECK(std::get<Matrix>(evaluate(parse_expression(text), lookup, &stats)) == expected);
+    CHECK(stats.parallel);
+    CHECK(stats.products == terms);
+    CHECK(stats.gemm_flops == doctest::Approx(2.0 * n * n * n * terms));
+
+    ExprCache cache;
+    stats = {};
+    CHECK(std::get<Matrix>(evaluate(parse_expression(text + " - P0*Q0"), lookup, cache, &stats)) == expected - env.at("P0") * env.at("Q0"));
+    CHECK(stats.parallel);
+
+    // Too little work for the pool.
+    stats = {};
+    evaluate(parse_expression("P0*Q0 + P1*Q1"), lookup, &stats);
+    CHECK_FALSE(stats.parallel);
+
+    // A failing branch stops the evaluation.
+    CHECK_THROWS_AS(evaluate(parse_expression(text + " + ~Z"), lookup), std::runtime_error);
+    mat_parallel::set_num_threads(saved);
+}
+
+TEST_CASE("Blocked transposition test") {
+    // Sides that are not multiples of the tile or leaf size exercise every edge path.
+    for (auto [m, n] : {std::pair<size_t, size_t>{1, 7}, {67, 45}, {130, 131}}) {
+        Matrix A(m, n);
+        for (size_t i = 0; i < m; ++i)
+            for (size_t j = 0; j < n; ++j)
+                A(i, j) = static_cast<double>(i * 1000 + j);
+        Matrix T = !A;
+        CHECK(T.rows() == n);
+        CHECK(T.cols() == m);
+        bool same = true;
+        for (size_t i = 0; i < m; ++i)
+            for (size_t j = 0; j < n; ++j)
+                same = same && T(j, i) == A(i, j);
+        CHECK(same);
+    }
+
+    Matrix S(133, 133);
+    for (size_t i = 0; i < 133; ++i)
+        for (size_t j = 0; j < 133; ++j)
+            S(i, j) = static_cast<double>(i * 1000 + j);
+    Matrix expected = !S;
+    size_t before = aligned_allocations;
+    S.transpose_in_place();
+    CHECK(aligned_allocations == before);
+    CHECK(S == expected);
+
+    Matrix R({{1,2,3}, {4,5,6}});
+    CHECK_THROWS_AS(R.transpose_in_place(), std::invalid_argument);
+}
+
+TEST_CASE("Transposed view test") {
+    Matrix A({{1,2,3}, {4,5,6}}), B({{1,0}, {2,1}});
+
+    size_t before = aligned_allocations;
+    Matrix N = A.transposed() * B;   // only the product is allocated
+    CHECK(aligned_allocations - before == 1);
+    CHECK(N == !A * B);
+    CHECK(A.transposed() * B.transposed() == !(B * A));
+    CHECK(A.transposed() * A == !A * A);
+
+    Matrix S = A.transposed() + A.transposed() * 2.0;
+    CHECK(S == !A * 3.0);
+    CHECK(Matrix(A.transposed()) == !A);
+    CHECK(!B.transposed() == B);
+    CHECK(*B.transposed() == *B);
+
+    // Assigning a view of a matrix to itself must not read overwritten elements.
+    Matrix C({{1,2}, {3,4}});
+    C = C.transposed();
+    CHECK(C == Matrix({{1,3}, {2,4}}));
+    C += C.transposed();
+    CHECK(C == Matrix({{2,5}, {5,8}}));
+
+    // Large enough for the packed GEMM path.
+    const size_t m = 150, k = 90, n = 110;
+    Matrix P(k, m), Q(n, k);
+    for (size_t i = 0; i < k; ++i)
+        for (size_t j = 0; j < m; ++j)
+            P(i, j) = static_cast<double>((i * 3 + j) % 7) - 3;
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < k; ++j)
+            Q(i, j) = static_cast<double>((i + j * 5) % 9) - 4;
+    CHECK(P.transposed() * Q.transposed() == !P * !Q);
+
+    std::ostringstream view, copy;
+    view << A.transposed();
+    copy << !A;
+    CHECK(view.str() == copy.str());
+}
+
+TEST_CASE("Block view test") {
+    Matrix A({{1,2,3,4}, {5,6,7,8}, {9,10,11,12}});
+
+    ConstMatrixView B = static_cast<const Matrix&>(A).block(1, 1, 2, 3);
+    CHECK(B.rows() == 2);
+    CHECK(B.cols() == 3);
+    CHECK(B.stride() == 4);
+    CHECK(B.data() == A.data() + 5);
+    CHECK(Matrix(B) == Matrix({{6,7,8}, {10,11,12}}));
+    CHECK(Matrix(A.row_view(2)) == Matrix({{9,10,11,12}}));
+    CHECK(Matrix(A.col_view(0)) == Matrix({{1}, {5}, {9}}));
+    CHECK(Matrix(B.block(1, 1, 1, 2)) == Matrix({{11,12}}));
+    CHECK_THROWS_AS(A.block(2, 0, 2, 1), std::out_of_range);
+    CHECK_THROWS_AS(A.col_view(4), std::out_of_range);
+
+    // Arithmetic on views writes through to the matrix without allocating.
+    Matrix I({{1,0}, {0,1}});
+    size_t before = aligned_allocations;
+    A.block(0, 0, 2, 2) += I;
+    A.block(1, 2, 2, 2) = A.block(0, 0, 2, 2) * 2.0 - I;
+    A.row_view(0) *= 10.0;
+    CHECK(aligned_allocations == before);
+    CHECK(A == Matrix({{20,20,30,40}, {5,7,3,4}, {9,10,10,13}}));
+
+    CHECK(A.block(0, 0, 2, 2) == Matrix({{20,20}, {5,7}}));
+    CHECK(A.block(0, 0, 2, 2) * A.block(1, 2, 2, 2) == Matrix({{20,20}, {5,7}}) * Matrix({{3,4}, {10,13}}));
+
+    // Overlapping blocks at different positions go through a temporary.
+    Matrix S({{1,2,3}, {4,5,6}, {7,8,9}});
+    S.block(1, 1, 2, 2) = S.block(0, 0, 2, 2);
+    CHECK(S == Matrix({{1,2,3}, {4,1,2}, {7,4,5}}));
+    CHECK_THROWS_AS(S.block(0, 0, 2, 2) = S.row_view(0), std::invalid_argument);
+}
+
+template <class L, class R, class = void>
+struct can_multiply : std::false_type {};
+
+template <class L, class R>
+struct can_multiply<L, R, std::void_t<decltype(std::declval<L>() * std::declval<R>())>> : std::true_type {};
+
+TEST_CASE("Fixed-size matrix test") {
+    using M2 = FixedMatrix<2, 2>;
+    using M23 = FixedMatrix<2, 3>;
+
+    // Everything is constexpr and shapes are checked at compile time.
+    constexpr M2 A(1, 2, 3, 4);
+    static_assert(*A == -2);
+    static_assert(A * M2::identity() == A);
+    static_assert((!M23(1, 2, 3, 4, 5, 6))(2, 1) == 6);
+    static_assert(can_multiply<M2, M23>::value);
+    static_assert(!can_multiply<M23, M23>::value);
+    static_assert(std::is_same_v<decltype(A * M23()), M23>);
+
+    CHECK(A + A * 2.0 - A == M2(2, 4, 6, 8));
+    CHECK(~M2(1, 3, 2, 7) == M2(7, -3, -2, 1));
+    CHECK_THROWS_AS(~M2(2, 4, 3, 6), std::runtime_error);
+
+    // Closed forms up to order 4 and elimination above agree with the dynamic Matrix.
+    auto check_inverse = [](auto m) {
+        constexpr size_t n = decltype(m)::rows();
+        Matrix d = m.to_matrix();
+        CHECK(*m == doctest::Approx(*d));
+        auto product = m * ~m;
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < n; ++j)
+                CHECK(product(i, j) == doctest::Approx(i == j ? 1.0 : 0.0));
+        CHECK(decltype(m)(d) == m);
+    };
+    check_inverse(FixedMatrix<3, 3>(2, -1, 0, 1, 3, 2, 0, 1, 4));
+    check_inverse(FixedMatrix<4, 4>(4, 7, 2, 1, 3, 6, 1, 0, 2, 5, 3, 1, 1, 0, 2, 5));
+    check_inverse(FixedMatrix<5, 5>(0, 2, 1, 0, 1, 1, 1, 1, 3, 0, 2, 1, 3, 0, 1, 1, 0, 0, 2, 2, 3, 1, 0, 1, 4));
+
+    // Complex elements: magnitudes and tolerances are taken on the real type.
+    using Z = std::complex<double>;
+    using Z2 = FixedMatrix<2, 2, Z>;
+    const Z2 Zm(Z(1, 1), Z(2, 0), Z(0, -1), Z(3, 2));
+    const Z2 Zi = ~Zm * Zm;
+    for (size_t i = 0; i < 2; ++i)
+        for (size_t j = 0; j < 2; ++j)
+            CHECK(std::abs(Zi(i, j) - Z(i == j ? 1 : 0)) < 1e-12);
+    const FixedMatrix<5, 5, Z> Z5 = FixedMatrix<5, 5, Z>::identity() * Z(0, 2);
+    CHECK(std::abs(*Z5 - Z(0, 32)) < 1e-12);
+    CHECK((~Z5)(4, 4) == Z(0, -0.5));
+    CHECK_THROWS_AS(~Z2(Z(1, 1), Z(2, 2), Z(1, 1), Z(2, 2)), std::runtime_error);
+
+    Matrix D({{1,2,3}, {4,5,6}});
+    CHECK(M23(D) == M23(1, 2, 3, 4, 5, 6));
+    CHECK(M2(D.block(0, 1, 2, 2)) == M2(2, 3, 5, 6));
+    CHECK_THROWS_AS(M2(D.view()), std::invalid_argument);
+}
+
+TEST_CASE("Element type test") {
+    // Single precision takes the float SIMD kernels and a blocked product.
+    const size_t n = 70;
+    BasicMatrix<float> F(n, n), I(n, n);
+    for (size_t i = 0; i < n; ++i) {
+        I(i, i) = 1;
+        for (size_t j = 0; j < n; ++j)
+            F(i, j) = static_cast<float>((i * 7 + j * 3) % 11) - 5;
+    }
+    BasicMatrix<float> G = F + F * 2.0f - F;
+    CHECK(G == F * 2.0f);
+    CHECK(F * I == F);
+    CHECK(F.transposed() * I == !F);
+    CHECK(G.block(1, 2, 3, 4) == F.block(1, 2, 3, 4) * 2.0f);
+
+    BasicMatrix<long double> L({{4, 7}, {2, 6}});
+    CHECK(static_cast<double>(*L) == doctest::Approx(10.0));
+    BasicMatrix<long double> Li = ~L * L;
+    CHECK(static_cast<double>(Li(0, 0)) == doctest::Approx(1.0));
+    CHECK(static_cast<double>(Li(1, 0)) == doctest::Approx(0.0));
+
+    using C = std::complex<double>;
+    BasicMatrix<C> Z({{C(1, 1), C(2, 0)}, {C(0, -1), C(3, 2)}});
+    CHECK(Z + Z == Z * C(2, 0));
+    CHECK(*Z == Z(0, 0) * Z(1, 1) - Z(0, 1) * Z(1, 0));
+    BasicMatrix<C> Zi = Z * ~Z;
+    CHECK(std::abs(Zi(0, 0) - C(1, 0)) < 1e-12);
+    CHECK(std::abs(Zi(0, 1)) < 1e-12);
+    CHECK_THROWS_AS(~BasicMatrix<C>({{C(1, 1), C(2, 2)}, {C(1, 1), C(2, 2)}}), std::runtime_error);
+
+    std::ostringstream os;
+    os << BasicMatrix<C>({{C(1, 2)}});
+    CHECK(os.str() == "(1,2) \n");
+}
+
+TEST_CASE("Matrix batch test") {
+    // Every batched operator agrees with the per-Matrix one, for the closed
+    // forms (orders 1 to 4) and the LU path (order 5), with a batch size that
+    // is not a multiple of any vector width.
+    const size_t count = 37;
+    for (size_t n = 1; n <= 5; ++n) {
+        CAPTURE(n);
+        MatrixBatch A(count, n, n), B(count, n, n);
+        for (size_t b = 0; b < count; ++b) {
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < n; ++j) {
+                    A(b, i, j) = static_cast<double>((b * 5 + i * 3 + j * 7) % 13) - 6;
+                    B(b, i, j) = static_cast<double>((b + i * 11 + j * 2) % 9) - 4;
+                }
+                A(b, i, i) += 20;
+            }
+        }
+        MatrixBatch P = A * B, T = !A, I = ~A;
+        std::vector<double> det = *A;
+        for (size_t b = 0; b < count; ++b) {
+            const Matrix a = A.get(b);
+            CHECK(P.get(b) == a * B.get(b));
+            CHECK(T.get(b) == !a);
+            CHECK(det[b] == doctest::Approx(*a));
+            const Matrix inv = ~a;
+            for (size_t i = 0; i < n; ++i)
+                for (size_t j = 0; j < n; ++j)
+                    CHECK(I(b, i, j) == doctest::Approx(inv(i, j)));
+        }
+    }
+
+    MatrixBatch R(3, 2, 3);
+    R.set(1, Matrix({{1,2,3}, {4,5,6}}).view());
+    CHECK(R.get(1) == Matrix({{1,2,3}, {4,5,6}}));
+    CHECK((!R).get(1) == Matrix({{1,4}, {2,5}, {3,6}}));
+    CHECK_THROWS_AS(R * R, std::invalid_argument);
+    CHECK_THROWS_AS(R * MatrixBatch(2, 3, 2), std::invalid_argument);
+    CHECK_THROWS_AS(~R, std::invalid_argument);
+    CHECK_THROWS_AS(R.get(3), std::out_of_range);
+
+    BasicMatrixBatch<float> S(2, 2, 2);
+    S(0, 0, 0) = S(0, 1, 1) = 2;
+    S(1, 0, 0) = S(1, 0, 1) = S(1, 1, 0) = S(1, 1, 1) = 1;
+    CHECK_THROWS_AS(~S, std::runtime_error);
+}
+
+TEST_CASE("Sparse matrix test") {
+    Matrix D({{0, 2, 0, 0}, {1, 0, 0, 3}, {0, 0, 0, 0}, {0, 4, 5, 0}, {6, 0, 0, 7}});
+    const CsrMatrix A(D);
+    const CscMatrix C(D);
+    CHECK(A.nnz() == 7);
+    CHECK(A.row_ptr() == std::vector<size_t>{0, 1, 3, 3, 5, 7});
+    CHECK(C.col_ptr() == std::vector<size_t>{0, 2, 4, 5, 7});
+    CHECK(A.to_dense() == D);
+    CHECK(C.to_dense() == D);
+    CHECK(CsrMatrix(C) == A);
+    CHECK(CscMatrix(A) == C);
+    CHECK(A(3, 2) == 5);
+    CHECK(A(2, 2) == 0);
+    CHECK(C(4, 3) == 7);
+    CHECK((!A).to_dense() == !D);
+    CHECK((!C).to_dense() == !D);
+
+    // Unordered entries with a duplicate and a cancelling pair.
+    const CsrMatrix T = CsrMatrix::from_triplets(5, 4, {{4, 3, 7}, {0, 1, 2}, {3, 2, 5}, {1, 3, 3}, {3, 1, 4},
+                                                        {1, 0, 1}, {4, 0, 2}, {4, 0, 4}, {2, 2, 1}, {2, 2, -1}});
+    CHECK(T == A);
+    CHECK(CscMatrix::from_triplets(5, 4, {{4, 3, 7}, {0, 1, 2}, {3, 2, 5}, {1, 3, 3}, {3, 1, 4}, {1, 0, 1}, {4, 0, 6}}) == C);
+
+    const std::vector<double> x{1, -2, 3, 0.5};
+    const std::vector<double> expected{-4, 2.5, 0, 7, 9.5};
+    CHECK(A * x == expected);
+    CHECK(C * x == expected);
+
+    const Matrix B({{1, 2}, {3, 4}, {5, 6}, {7, 8}});
+    CHECK(A * B == D * B);
+    CHECK(C * B == D * B);
+
+    const Matrix E({{0, 0, 1, 0}, {-1, 0, 0, 0}, {0, 0, 0, 0}, {0, -4, 0, 2}, {0, 0, 0, 0}});
+    CHECK((A + CsrMatrix(E)).to_dense() == D + E);
+    CHECK((A - CsrMatrix(E)).to_dense() == D - E);
+    CHECK((C + CscMatrix(E)).to_dense() == D + E);
+    CHECK((A + CsrMatrix(E)).nnz() == 7);
+    CHECK((A - A).nnz() == 0);
+    CHECK((A * 2.0).to_dense() == D * 2.0);
+    CHECK((A * !A).to_dense() == D * !D);
+    CHECK((C * !C).to_dense() == D * !D);
+
+    CHECK_THROWS_AS(A * std::vector<double>(5), std::invalid_argument);
+    CHECK_THROWS_AS(A * D, std::invalid_argument);
+    CHECK_THROWS_AS(A * A, std::invalid_argument);
+    CHECK_THROWS_AS(A + !A, std::invalid_argument);
+    CHECK_THROWS_AS(A(5, 0), std::out_of_range);
+    CHECK_THROWS_AS(CsrMatrix::from_triplets(2, 2, {{0, 2, 1}}), std::out_of_range);
+    CHECK_THROWS_AS(CsrMatrix(2, 2, {0, 2, 2}, {1, 0}, {1, 1}), std::invalid_argument);
+    CHECK_THROWS_AS(CsrMatrix(0, 2), std::runtime_error);
+
+    // A large banded matrix takes the threaded SpMV path; the result must not
+    // depend on the number of threads.
+    const size_t n = 200000;
+    std::vector<Triplet> band;
+    for (size_t i = 0; i < n; ++i) {
+        band.push_back({i, i, 4.0});
+        if (i > 0) band.push_back({i, i - 1, -1.0});
+        if (i + 1 < n) band.push_back({i, i + 1, -1.0});
+        if (i % 97 == 0) band.push_back({i, (i * 31) % n, 0.5});
+    }
+    const CsrMatrix L = CsrMatrix::from_triplets(n, n, band);
+    std::vector<double> v(n);
+    for (size_t i = 0; i < n; ++i) v[i] = static_cast<double>(i % 17) - 8;
+    const size_t threads = mat_parallel::num_threads();
+    mat_parallel::set_num_threads(1);
+    const std::vector<double> serial = L * v;
+    mat_parallel::set_num_threads(4);
+    CHECK(L * v == serial);
+    CHECK(CscMatrix(L) * v == serial);
+    mat_parallel::set_num_threads(threads);
+}
+
+TEST_CASE("Cholesky factorization test") {
+    // n = 150 spans several diagonal blocks and a partial last block.
+    for (size_t n : {1, 3, 150}) {
+        CAPTURE(n);
+        Matrix M(n, n);
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < n; ++j)
+                M(i, j) = static_cast<double>((i * 7 + j * 3) % 11) / 10.0 - 0.5;
+        Matrix S = M * !M;
+        for (size_t i = 0; i < n; ++i) S(i, i) += 1.0;
+        const Cholesky C(S);
+
+        const Matrix& L = C.factor();
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = i + 1; j < n; ++j)
+                CHECK(L(i, j) == 0);
+        const Matrix LLt = L * !L;
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < n; ++j)
+                CHECK(LLt(i, j) == doctest::Approx(S(i, j)));
+
+        Matrix B(n, 2);
+        for (size_t i = 0; i < n; ++i) {
+            B(i, 0) = static_cast<double>(i % 5);
+            B(i, 1) = 1.0;
+        }
+        const Matrix X = C.solve(B);
+        const Matrix R = S * X;
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < 2; ++j)
+                CHECK(R(i, j) == doctest::Approx(B(i, j)));
+
+        const Matrix inv = C.inverse(), ref = ~S;
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < n; ++j)
+                CHECK(inv(i, j) == doctest::Approx(ref(i, j)));
+        if (n <= 3) {
+            CHECK(C.logdet() == doctest::Approx(std::log(*S)));
+        }
+
+        std::vector<double> x(n);
+        for (size_t i = 0; i < n; ++i) x[i] = static_cast<double>(i % 3) - 1.0;
+        Matrix xxt(n, n);
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < n; ++j)
+                xxt(i, j) = x[i] * x[j];
+        Cholesky U = C;
+        U.update(x);
+        const Matrix up = U.factor() * !U.factor();
+        const Matrix S2 = S + xxt;
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < n; ++j)
+                CHECK(up(i, j) == doctest::Approx(S2(i, j)));
+        U.downdate(x);
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j <= i; ++j)
+                CHECK(U.factor()(i, j) == doctest::Approx(L(i, j)));
+    }
+
+    // Only the lower triangle is read.
+    CHECK(Cholesky(Matrix({{4, 99}, {2, 5}})).factor() == Matrix({{2, 0}, {1, 2}}));
+    CHECK_THROWS_AS(Cholesky(Matrix({{1, 2}, {2, 1}})), std::runtime_error);
+    CHECK_THROWS_AS(Cholesky(Matrix(std::vector<std::vector<double>>{{-1}})), std::runtime_error);
+    CHECK_THROWS_AS(Cholesky(Matrix(2, 3)), std::invalid_argument);
+    Cholesky I(Matrix({{1, 0}, {0, 1}}));
+    CHECK_THROWS_AS(I.downdate({2, 0}), std::runtime_error);
+    CHECK(I.factor() == Matrix({{1, 0}, {0, 1}}));
+    CHECK_THROWS_AS(I.solve(std::vector<double>{1, 2, 3}), std::invalid_argument);
+    CHECK(I.solve(std::vector<double>{1, 2}) == std::vector<double>{1, 2});
+
+    BasicCholesky<float> F(BasicMatrix<float>({{4, 2}, {2, 5}}));
+    CHECK(F.logdet() == doctest::Approx(std::log(16.0)));
+}
+
+TEST_CASE("Linear solve test") {
+    const Matrix A({{2, 1, 1}, {4, -6, 0}, {-2, 7, 2}});
+    const Matrix B({{5, 1}, {-2, 0}, {9, 2}});
+    const Matrix X = solve(A, B);
+    const Matrix R = A * X;
+    for (size_t i = 0; i < 3; ++i)
+        for (size_t j = 0; j < 2; ++j)
+            CHECK(R(i, j) == doctest::Approx(B(i, j)));
+    CHECK(X(0, 0) == doctest::Approx(1));
+    CHECK(X(1, 0) == doctest::Approx(1));
+    CHECK(X(2, 0) == doctest::Approx(2));
+
+    // One factorization reused across batches and for the determinant and inverse.
+    const LU F(A);
+    CHECK(F.determinant() == doctest::Approx(*A));
+    const Matrix inv = F.inverse(), ref = ~A;
+    for (size_t i = 0; i < 3; ++i)
+        for (size_t j = 0; j < 3; ++j)
+            CHECK(inv(i, j) == doctest::Approx(ref(i, j)));
+    const std::vector<double> x = F.solve(std::vector<double>{5, -2, 9});
+    CHECK(x[0] == doctest::Approx(1));
+    CHECK(x[2] == doctest::Approx(2));
+    CHECK(F.solve(B.block(0, 1, 3, 1)) == X.block(0, 1, 3, 1));
+
+    // A Hilbert matrix is badly conditioned; refinement with a wider residual
+    // must bring the float solution closer to the exact one.
+    const size_t n = 5;
+    BasicMatrix<float> H(n, n);
+    Matrix Hd(n, n);
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < n; ++j)
+            Hd(i, j) = H(i, j) = 1.0f / static_cast<float>(i + j + 1);
+    const std::vector<double> exact = solve(Hd, std::vector<double>(n, 1.0), 2);
+    auto error = [&](const std::vector<float>& v) {
+        double worst = 0;
+        for (size_t i = 0; i < n; ++i) worst = std::max(worst, std::abs(v[i] - exact[i]) / std::abs(exact[i]));
+        return worst;
+    };
+    const BasicLU<float> HF(H);
+    const std::vector<float> b(n, 1.0f);
+    CHECK(error(HF.solve(H, b, 3)) < error(HF.solve(b)) / 10);
+    CHECK(HF.solve(H, b, 0) == HF.solve(b));
+
+    BasicMatrix<std::complex<double>> Z({{{1, 1}, {0, 0}}, {{0, 0}, {0, 2}}});
+    const std::vector<std::complex<double>> z = solve(Z, std::vector<std::complex<double>>{{2, 0}, {4, 0}}, 1);
+    CHECK(std::abs(z[0] - std::complex<double>(1, -1)) < 1e-12);
+    CHECK(std::abs(z[1] - std::complex<double>(0, -2)) < 1e-12);
+
+    CHECK_THROWS_AS(solve(Matrix({{1, 2}, {2, 4}}), Matrix({{1, 0}, {2, 0}})), std::runtime_error);
+    CHECK_THROWS_AS(solve(Matrix(2, 3), Matrix(2, 1)), std::invalid_argument);
+    CHECK_THROWS_AS(F.solve(Matrix(2, 1)), std::invalid_argument);
+    CHECK_THROWS_AS(F.solve(Matrix(2, 2), B, 1), std::invalid_argument);
+}
+
+TEST_CASE("Binary matrix file test") {
+    auto hash = [](const std::string& s) {
+        Checksum c;
+        c.update(s.data(), s.size());
+        return c.digest();
+    };
+    CHECK(hash("") == 0xEF46DB3751D8E999ULL);
+    CHECK(hash("abc") == 0x44BC2CF5AD770999ULL);
+    std::string bytes(1000, '\0');
+    for (size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<char>(i * 37 + 11);
+    Checksum split;
+    for (size_t pos = 0, step = 1; pos < bytes.size(); pos += step, step = step % 45 + 7) {
+        split.update(bytes.data() + pos, std::min(step, bytes.size() - pos));
+    }
+    CHECK(split.digest() == hash(bytes));
+
+    const std::string path = "mat-test-binary.mat";
+    Matrix A(37, 21);
+    for (size_t i = 0; i < A.rows(); ++i)
+        for (size_t j = 0; j < A.cols(); ++j)
+            A(i, j) = static_cast<double>(i) * 0.25 - static_cast<double>(j) / 3.0;
+    save_binary(path, A);
+    const BinaryHeader hdr = read_binary_header(path);
+    CHECK(hdr.rows == 37);
+    CHECK(hdr.cols == 21);
+    CHECK(hdr.dtype == Dtype::f64);
+    CHECK(hdr.data_offset % hdr.alignment == 0);
+    CHECK(load_binary(path) == A);
+    {
+        const MappedMatrix M(path);
+        CHECK(reinterpret_cast<std::uintptr_t>(M.data()) % 64 == 0);
+        CHECK(M(36, 20) == A(36, 20));
+        CHECK(M.to_matrix() == A);
+        const Matrix twice = M.view() * 2.0;
+        CHECK(twice == A * 2.0);
+        CHECK(Matrix(M.view().block(3, 4, 5, 6)) == Matrix(A.block(3, 4, 5, 6)));
+    }
+    CHECK_THROWS_AS(load_binary<float>(path), std::runtime_error);
+    CHECK_THROWS_AS(BasicMappedMatrix<float>{path}, std::runtime_error);
+
+    // A streamed file equals the saved one, whatever the row grouping.
+    const std::string streamed = "mat-test-streamed.mat";
+    {
+        MatrixWriter w(streamed, 37, 21);
+        w.write_row(A.row(0));
+        w.write(A.block(1, 0, 20, 21));
+        CHECK_THROWS_AS(w.write(A.block(0, 0, 17, 20)), std::invalid_argument);
+        CHECK_THROWS_AS(w.close(), std::runtime_error);
+        w.write(A.block(21, 0, 16, 21));
+        CHECK_THROWS_AS(w.write_row(A.row(0)), std::out_of_range);
+        w.close();
+    }
+    CHECK(read_binary_header(streamed).checksum == hdr.checksum);
+    {
+        MatrixWriter abandoned(streamed, 2, 2);
+        abandoned.write_row(A.row(0));
+    }
+    CHECK_THROWS_AS(load_binary(streamed), std::runtime_error);
+    CHECK_THROWS_AS(MappedMatrix{streamed}, std::runtime_error);
+
+    // Flipping one element byte fails the checksum, unless verification is skipped.
+    {
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(64 + 100);
+        f.put('\x7f');
+    }
+    CHECK_THROWS_AS(load_binary(path), std::runtime_error);
+    CHECK_THROWS_AS(MappedMatrix{path}, std::runtime_error);
+    CHECK(MappedMatrix(path, false).rows() == 37);
+
+    // A huge shape in a short file is rejected before anything is allocated.
+    {
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+        const unsigned char huge[8] = {0, 0, 0x10, 0, 0, 0, 0, 0};
+        f.seekp(16);
+        f.write(reinterpret_cast<const char*>(huge), 8);
+        f.write(reinterpret_cast<const char*>(huge), 8);
+    }
+    CHECK(read_binary_header(path).rows == (uint64_t(1) << 20));
+    CHECK_THROWS_WITH_AS(load_binary(path), doctest::Contains("truncated data"), std::runtime_error);
+
+    BasicMatrix<std::complex<double>> Z({{{1, 2}, {3, -4}}, {{0, 0.5}, {-1, 0}}});
+    save_binary(path, Z);
+    CHECK(load_binary<std::complex<double>>(path) == Z);
+    BasicMatrix<float> F({{1.5f, 2}, {3, 4}, {5, 6}});
+    save_binary(path, F);
+    CHECK(BasicMappedMatrix<float>(path).to_matrix() == F);
+    std::remove(path.c_str());
+    std::remove(streamed.c_str());
+    CHECK_THROWS_AS(load_binary(path), std::runtime_error);
+}
+
+TEST_CASE("Text matrix I/O test") {
+    std::istringstream in("  1 2\t3.5 \n\n-4 5e-3   6\r\n");
+    const Matrix A = read_text(in);
+    CHECK(A == Matrix({{1, 2, 3.5}, {-4, 5e-3, 6}}));
+
+    std::istringstream csv("1, 2,3\n4 ,5, 6");
+    TextFormat comma;
+    comma.delimiter = ',';
+    CHECK(read_text(csv, comma) == Matrix({{1, 2, 3}, {4, 5, 6}}));
+
+    // Shortest round-trip output reads back bit for bit.
+    Matrix B(40, 30);
+    for (size_t i = 0; i < B.rows(); ++i)
+        for (size_t j = 0; j < B.cols(); ++j)
+            B(i, j) = std::sin(static_cast<double>(i * 31 + j)) * std::pow(10.0, static_cast<double>(j % 9) - 4);
+    std::ostringstream out;
+    write_text(out, B, comma);
+    std::istringstream back(out.str());
+    CHECK(read_text(back, comma) == B);
+
+    // A tab delimiter is not padding: each tab ends exactly one field.
+    TextFormat tab;
+    tab.delimiter = '\t';
+    std::stringstream tabbed;
+    write_text(tabbed, Matrix({{1, 2}, {3, 4}}), tab);
+    CHECK(tabbed.str() == "1\t2\n3\t4\n");
+    CHECK(read_text(tabbed, tab) == Matrix({{1, 2}, {3, 4}}));
+    std::istringstream padded_tabs(" 1 \t 2\n"), empty_field("1\t\t2\n");
+    CHECK(read_text(padded_tabs, tab) == Matrix({{1, 2}}));
+    CHECK_THROWS_AS(read_text(empty_field, tab), std::invalid_argument);
+
+    std::ostringstream fixed;
+    TextFormat three;
+    three.precision = 3;
+    write_text(fixed, Matrix({{1.0 / 3, 2}, {0.5, 1e10}}), three);
+    CHECK(fixed.str() == "0.333 2\n0.5 1e+10\n");
+    TextFormat wide_precision;
+    wide_precision.precision = 200;
+    std::ostringstream rejected;
+    CHECK_THROWS_AS(write_text(rejected, Matrix({{1.0 / 3, 2}}), wide_precision), std::invalid_argument);
+    wide_precision.precision = 17;
+    std::ostringstream exact;
+    write_text(exact, Matrix({{1.0 / 3, 2}}), wide_precision);
+    CHECK(exact.str() == "0.33333333333333331 2\n");
+    std::ostringstream shortest;
+    write_text(shortest, Matrix({{0.1, -2}}).view());
+    CHECK(shortest.str() == "0.1 -2\n");
+
+    // Lines far longer than one read block.
+    BasicMatrix<float> W(3, 200000);
+    for (size_t j = 0; j < W.cols(); ++j) W(1, j) = static_cast<float>(j) * 0.5f;
+    std::stringstream wide;
+    write_text(wide, W);
+    CHECK(read_text<float>(wide) == W);
+
+    const std::string path = "mat-test-text.csv";
+    save_text(path, B, comma);
+    CHECK(load_text(path, comma) == B);
+    std::remove(path.c_str());
+
+    std::istringstream ragged("1 2\n3\n"), bad("1 2\n3 x\n"), empty(" \n\n"), glued("1,2");
+    CHECK_THROWS_AS(read_text(ragged), std::invalid_argument);
+    CHECK_THROWS_WITH_AS(read_text(bad), "Invalid number at line 2, column 3.", std::invalid_argument);
+    CHECK_THROWS_AS(read_text(empty), std::runtime_error);
+    CHECK_THROWS_AS(read_text(glued), std::invalid_argument);
+    CHECK_THROWS_AS(load_text(path), std::runtime_error);
+}
+
+TEST_CASE("Batch script test") {
+    const std::string dir = "mat-test-script";
+    std::filesystem::create_directories(dir);
+    save_text(dir + "/b.csv", Matrix({{1, 0}, {0, 2}}), [] { TextFormat f; f.delimiter = ','; return f; }());
+    save_binary(dir + "/c.mat", Matrix({{5, 6}, {7, 8}}));
+
+    std::istringstream script(
+        "# inputs\n"
+        "matrix A = [1 2; 3 4]\n"
+        "matrix B = text \"b.csv\" delimiter ,\n"
+        "matrix C = binary c.mat   # trailing comment\n"
+        "\n"
+        "let P = A * B + C\n"
+        "let Q = P - C\n"
+        "let d = *A\n"
+        "let R = A * B - C\n"
+        "output out\n"
+        "format csv\n");
+    ScriptOptions options;
+    options.base_dir = dir;
+    const ScriptRun run = run_script(script, options);
+
+    CHECK(std::get<Matrix>(run.values.at("P")) == Matrix({{6, 10}, {10, 16}}));
+    CHECK(std::get<Matrix>(run.values.at("Q")) == Matrix({{1, 4}, {3, 8}}));
+    CHECK(std::get<double>(run.values.at("d")) == doctest::Approx(-2));
+    REQUIRE(run.timings.size() == 4);
+    CHECK(run.timings[0].name == "P");
+    CHECK(run.timings[0].stats.products == 1);
+    // A * B is shared with P and taken from the cache.
+    CHECK(std::get<Matrix>(run.values.at("R")) == Matrix({{-4, -2}, {-4, 0}}));
+    CHECK(run.timings[3].stats.products == 0);
+    CHECK(run.timings[3].stats.reused == 1);
+    CHECK(run.timings[0].seconds >= 0);
+
+    TextFormat comma;
+    comma.delimiter = ',';
+    CHECK(load_text(dir + "/out/P.csv", comma) == Matrix({{6, 10}, {10, 16}}));
+    std::ifstream scalar(dir + "/out/d.txt");
+    double d = 0;
+    scalar >> d;
+    CHECK(d == doctest::Approx(-2));
+    std::ifstream timings(dir + "/out/timings.csv");
+    std::string header, first;
+    std::getline(timings, header);
+    std::getline(timings, first);
+    CHECK(header == "name,seconds,gemm_flops,products,reused");
+    CHECK(first.rfind("P,", 0) == 0);
+
+    // Errors carry the script line; a syntax error stops the script before any work.
+    ScriptOptions dry;
+    dry.write_files = false;
+    std::istringstream syntax("matrix A = [1]\nlet X = A +\n");
+    CHECK_THROWS_WITH_AS(run_script(syntax, dry), doctest::Contains("line 2:"), std::invalid_argument);
+    std::istringstream unknown("matrix A = [1 2]\nlet X = A * Y\n");
+    CHECK_THROWS_WITH_AS(run_script(unknown, dry), "line 2: Unknown matrix: Y", std::invalid_argument);
+    std::istringstream forward("matrix A = [1]\nlet X = A * B\nmatrix B = [2]\n");
+    CHECK_THROWS_WITH_AS(run_script(forward, dry), "line 2: Unknown matrix: B", std::invalid_argument);
+    std::istringstream reserved("matrix A = [1]\nlet timings = A\n");
+    CHECK_THROWS_WITH_AS(run_script(reserved, dry), doctest::Contains("line 2:"), std::invalid_argument);
+    std::istringstream twice("matrix A = [1]\nlet A = A\n");
+    CHECK_THROWS_AS(run_script(twice, dry), std::invalid_argument);
+    std::istringstream scalar_operand("matrix A = [1 2; 3 4]\nlet d = *A\nlet X = d * A\n");
+    CHECK_THROWS_AS(run_script(scalar_operand, dry), std::invalid_argument);
+    std::istringstream missing("matrix M = binary missing.mat\n");
+    CHECK_THROWS_WITH_AS(run_script(missing, dry), doctest::Contains("line 1:"), std::runtime_error);
+    std::istringstream bad_format("format xml\n");
+    CHECK_THROWS_AS(run_script(bad_format, dry), std::invalid_argument);
+
+    // A result file may not replace an input, whichever directory and format select it.
+    save_text(dir + "/X.txt", Matrix({{1, 2}}));
+    std::istringstream overwrite("matrix A = text X.txt\nlet X = A * 2\n");
+    CHECK_THROWS_WITH_AS(run_script(overwrite, options), doctest::Contains("line 2:"), std::invalid_argument);
+    CHECK(load_text(dir + "/X.txt") == Matrix({{1, 2}}));
+    std::istringstream overwrite_csv("matrix B = text out/../b.csv delimiter ,\nlet b = B * 2\nformat csv\n");
+    CHECK_THROWS_AS(run_script(overwrite_csv, options), std::invalid_argument);
+    std::istringstream elsewhere("matrix A = text X.txt\nlet X = A * 2\noutput out\n");
+    CHECK(std::get<Matrix>(run_script(elsewhere, options).values.at("X")) == Matrix({{2, 4}}));
+    std::istringstream timings_input("matrix T = text timings.csv\n");
+    CHECK_THROWS_AS(run_script(timings_input, options), std::invalid_argument);
+
+    std::filesystem::remove_all(dir);
+}